@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+struct Color {
+    union {
+        uint32_t color;
+        struct {
+            uint8_t b;
+            uint8_t g;
+            uint8_t r;
+            uint8_t a;
+        };
+    };
+
+    Color(uint8_t r = 0, uint8_t g = 0, uint8_t b = 0)
+        : b{b}
+        , g{g}
+        , r{r}
+        , a{255}
+    { }
+
+    bool operator==(Color const& other) const
+    {
+        return color == other.color;
+    }
+};
+
+// The sRGB transfer function, colors have to be averaged in linear light to keep their brightness
+inline float srgb_to_linear(uint8_t value)
+{
+    static auto const table = []() {
+        std::array<float, 256> result;
+        for (std::size_t i = 0; i < result.size(); ++i) {
+            auto const normalized = i / 255.0f;
+            result[i] = normalized <= 0.04045f ? normalized / 12.92f : std::pow((normalized + 0.055f) / 1.055f, 2.4f);
+        }
+        return result;
+    }();
+    return table[value];
+}
+
+inline uint8_t linear_to_srgb(float value)
+{
+    auto const encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::clamp(encoded, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
@@ -0,0 +1,660 @@
+#include "engine.hpp"
+
+#include <cstdlib>
+#include <string_view>
+
+void apply_settings(Settings const& settings)
+{
+    chunk_size = settings.chunk_size;
+    thread_count = settings.thread_count > 0 ? settings.thread_count : std::max<int32_t>(std::thread::hardware_concurrency(), 1);
+    max_queue_size = settings.max_queue_size > 0 ? settings.max_queue_size : thread_count;
+    max_chunk_memory = settings.max_chunk_memory;
+    worker_processes = settings.worker_processes;
+    kernel_interleave = settings.kernel_interleave > 0 ? settings.kernel_interleave : default_kernel_interleave;
+}
+
+std::optional<int> run_as_worker(int argc, char** argv)
+{
+    if (argc != 4 || std::string_view{argv[1]} != "--worker") {
+        return {};
+    }
+
+    trace_set_thread_name("worker process");
+    return run_worker(std::atoi(argv[2]), std::atoi(argv[3]), [](WorkerJob const& job, int64_t job_chunk_size, std::span<Color> pixels) {
+        chunk_size = job_chunk_size;
+        auto chunk = Chunk::create(Complex{job.position_real, job.position_imag}, job.complex_size, job.formula % formula_amount, job.max_iterations, job.color_function % color_function_amount, job.sample_step, job.antialiasing_samples, pixels);
+        chunk.compute();
+        return WorkerResult{
+            .job_id = job.job_id,
+            .iteration_count = chunk.iteration_count(),
+            .max_iterations = chunk.max_iterations(),
+            .bounded_count = chunk.bounded_count(),
+        };
+    });
+}
+
+void Buffer::blit(Chunk const& chunk, ScreenPosition position)
+{
+    auto const buffer_col_start = std::clamp(position.y, 0l, m_height);
+    auto const buffer_col_end = std::clamp(position.y + chunk_size, 0l, m_height);
+    auto const col_height = buffer_col_end - buffer_col_start;
+    auto const chunk_col_start = std::clamp(-position.y, 0l, chunk_size);
+
+    auto const buffer_line_start = std::clamp(position.x, 0l, m_width);
+    auto const buffer_line_end = std::clamp(position.x + chunk_size, 0l, m_width);
+    auto line_width = buffer_line_end - buffer_line_start;
+    auto const chunk_line_start = std::clamp(-position.x, 0l, chunk_size);
+
+    if (col_height == 0 || line_width == 0) {
+        return;
+    }
+
+    for (int64_t y = 0; y < col_height; ++y) {
+        auto* dest = &m_buffer.data()[(buffer_col_start + y) * m_width + buffer_line_start];
+        auto const* src = &chunk.buffer()[(chunk_col_start + y) * chunk_size + chunk_line_start];
+        std::memcpy(dest, src, line_width * sizeof(Color));
+    }
+}
+
+Complex screen_space_to_mandelbrot_space(ScreenPosition screen_position, double chunk_resolution)
+{
+    // chunk_resolution: width and height of a chunk in mandelbrot space
+    // chunk_size: width and height of a chunk in screen space
+    return Complex{
+        .real = (chunk_resolution / chunk_size) * screen_position.x,
+        .imag = (chunk_resolution / chunk_size) * screen_position.y,
+    };
+}
+
+ScreenPosition mandelbrot_space_to_screen_space(Complex mandelbrot_position, double chunk_resolution)
+{
+    return ScreenPosition{
+        .x = static_cast<int64_t>((chunk_size / chunk_resolution) * mandelbrot_position.real),
+        .y = static_cast<int64_t>((chunk_size / chunk_resolution) * mandelbrot_position.imag),
+    };
+}
+
+double zoom_level_to_chunk_resolution(double zoom_level)
+{
+    return 2 * std::pow(0.9, zoom_level) / 256 * chunk_size;
+}
+bool Mandelbrot::render(Buffer& buffer, ScreenPosition top_left_global, double chunk_resolution, int64_t sample_step, RenderParameters const& parameters)
+{
+    auto const top_left_mandelbrot_space = screen_space_to_mandelbrot_space(top_left_global, chunk_resolution);
+
+    auto const chunk_x_count = static_cast<int32_t>(std::ceil(static_cast<double>(buffer.width()) / chunk_size)) + 1;
+    auto const chunk_y_count = static_cast<int32_t>(std::ceil(static_cast<double>(buffer.height()) / chunk_size)) + 1;
+
+    // Grid starts at 0+0i, with step width of chunk_resolution
+    auto const top_left_chunk_position = ChunkGridPosition{
+        static_cast<int64_t>(std::floor(top_left_mandelbrot_space.real / chunk_resolution)),
+        static_cast<int64_t>(std::floor(top_left_mandelbrot_space.imag / chunk_resolution)),
+    };
+
+    auto const top_left_chunk_global_screen_position = ScreenPosition{
+        .x = top_left_chunk_position.real * chunk_size,
+        .y = top_left_chunk_position.imag * chunk_size,
+    };
+
+    auto const top_left_local_screen_chunk_offset = ScreenPosition{
+        .x = top_left_chunk_global_screen_position.x - top_left_global.x,
+        .y = top_left_chunk_global_screen_position.y - top_left_global.y,
+    };
+
+    std::lock_guard<std::mutex> cache_lock{m_cache_mutex};
+    ++m_access_time;
+
+    auto is_resolved = true;
+    uint64_t bounded_count = 0;
+    uint64_t bounded_iterations = 0;
+    m_view_iterations = ViewIterations{.highest_limit = parameters.base_max_iterations(chunk_resolution)};
+    for (auto chunk_grid_x = 0; chunk_grid_x < chunk_x_count; ++chunk_grid_x) {
+        for (auto chunk_grid_y = 0; chunk_grid_y < chunk_y_count; ++chunk_grid_y) {
+            auto const chunk_grid_position = ChunkGridPosition{
+                .real = top_left_chunk_position.real + chunk_grid_x,
+                .imag = top_left_chunk_position.imag + chunk_grid_y,
+            };
+
+            auto const local_screen_chunk_offset = ScreenPosition{
+                .x = top_left_local_screen_chunk_offset.x + chunk_grid_x * chunk_size,
+                .y = top_left_local_screen_chunk_offset.y + chunk_grid_y * chunk_size,
+            };
+
+            auto* chunk = get_or_create_chunk(chunk_resolution, chunk_grid_position, sample_step, parameters);
+            if (chunk && chunk->is_ready()) {
+                chunk->update_last_access_time(m_access_time);
+                buffer.blit(*chunk, local_screen_chunk_offset);
+                m_view_iterations.highest_limit = std::max(m_view_iterations.highest_limit, chunk->max_iterations());
+                m_view_iterations.computed_iterations += chunk->iteration_count();
+                bounded_count += chunk->bounded_count();
+                bounded_iterations += chunk->bounded_count() * chunk->max_iterations();
+            } else {
+                buffer.fill_rect(local_screen_chunk_offset, chunk_size, chunk_size, default_color);
+            }
+
+            is_resolved = is_resolved && chunk && chunk->sample_step() == 1;
+        }
+    }
+    m_view_iterations.saved_iterations = bounded_count * m_view_iterations.highest_limit - bounded_iterations;
+
+    return is_resolved;
+}
+
+RenderTicket Mandelbrot::request_viewport(ViewportParameters const& viewport, RenderCallback callback)
+{
+    return submit(Buffer::init(viewport.width, viewport.height), BandLayout::create(viewport), viewport.render_parameters(), std::move(callback));
+}
+
+RenderTicket Mandelbrot::request_tile(double chunk_resolution, ChunkGridPosition position, RenderParameters const& parameters, RenderCallback callback)
+{
+    auto const layout = BandLayout{
+        .chunk_resolution = chunk_resolution,
+        .top_left_chunk_position = position,
+        .chunk_offset = ScreenPosition{0, 0},
+        .chunk_x_count = 1,
+        .band_count = 1,
+    };
+    return submit(Buffer::init(chunk_size, chunk_size), layout, parameters, std::move(callback));
+}
+
+void Mandelbrot::cancel(uint64_t request_id)
+{
+    PendingRequest request;
+    {
+        std::lock_guard<std::mutex> lock{m_request_mutex};
+        auto const it = m_requests.find(request_id);
+        if (it == m_requests.end()) {
+            return;
+        }
+        request = std::move(it->second);
+        m_requests.erase(it);
+
+        for (auto const trace_id : request.waited_chunks) {
+            auto const waiters = m_chunk_waiters.find(trace_id);
+            if (waiters == m_chunk_waiters.end()) {
+                continue;
+            }
+            std::erase_if(waiters->second.requests, [&](auto const& waiter) { return waiter.first == request_id; });
+            if (waiters->second.requests.empty()) {
+                m_chunk_waiters.erase(waiters);
+            }
+        }
+    }
+    deliver(request, true);
+}
+
+Mandelbrot::~Mandelbrot()
+{
+    destroy_thread_pool();
+}
+
+void Mandelbrot::create_thread_pool()
+{
+    m_threads_running = true;
+
+    if (worker_processes > 0 && !m_arena) {
+        create_arena();
+    }
+
+    auto const pool_size = m_arena ? worker_processes : thread_count;
+    for (int32_t i = 0; i < pool_size; ++i) {
+        m_threads.emplace_back([&, i]() {
+            auto const thread_name = "worker " + std::to_string(i);
+            trace_set_thread_name(thread_name.c_str());
+
+            // With worker processes, every pool thread only feeds its process
+            auto remote_worker = m_arena ? std::make_unique<RemoteWorker>(*m_arena, chunk_size) : nullptr;
+
+            while (m_threads_running) {
+                std::unique_lock<std::mutex> queue_lock{m_queue_mutex};
+                m_queue_convar.wait(queue_lock, [&]() { return !m_chunk_queue.empty() || !m_background_queue.empty() || !m_task_queue.empty() || !m_threads_running; });
+
+                // Chunks for the interactive view always go first, tasks only run when no chunk is waiting
+                if (m_chunk_queue.empty() && m_background_queue.empty() && !m_task_queue.empty()) {
+                    auto const task = std::move(m_task_queue.front());
+                    m_task_queue.pop();
+                    queue_lock.unlock();
+
+                    m_statistics.busy_workers.fetch_add(1, std::memory_order_relaxed);
+                    task();
+                    m_statistics.busy_workers.fetch_sub(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                auto& queue = !m_chunk_queue.empty() ? m_chunk_queue : m_background_queue;
+                if (!queue.empty()) {
+                    auto chunk = queue.front();
+                    queue.pop();
+                    chunk.get().mark_started();
+                    queue_lock.unlock();
+
+                    auto const trace_id = chunk.get().trace_id();
+                    trace_async_end("queued", trace_id);
+                    trace_instant("start", trace_id);
+                    m_statistics.busy_workers.fetch_add(1, std::memory_order_relaxed);
+                    // Worker processes only return colors, chunks that keep their field are always computed here
+                    if (!remote_worker || chunk.get().keeps_field()) {
+                        compute_with_mirror(chunk.get());
+                    } else if (!compute_remotely(*remote_worker, chunk.get(), m_scratch_slots.at(i))) {
+                        m_statistics.busy_workers.fetch_sub(1, std::memory_order_relaxed);
+                        retry_or_abandon(chunk, queue);
+                        continue;
+                    }
+                    m_statistics.busy_workers.fetch_sub(1, std::memory_order_relaxed);
+                    m_statistics.computed_chunks.fetch_add(1, std::memory_order_relaxed);
+                    complete_requests(trace_id);
+
+                    {
+                        std::lock_guard<std::mutex> done_lock{m_done_mutex};
+                    }
+                    m_done_convar.notify_all();
+                }
+            }
+        });
+    }
+}
+
+void Mandelbrot::destroy_thread_pool()
+{
+    m_threads_running = false;
+    m_queue_convar.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+    m_task_queue = {};
+}
+
+void Mandelbrot::invalidate_cache()
+{
+    std::lock_guard<std::mutex> cache_lock{m_cache_mutex};
+    evict_chunks();
+}
+
+void Mandelbrot::clear_cache()
+{
+    destroy_thread_pool();
+
+    std::vector<PendingRequest> cancelled;
+    {
+        std::lock_guard<std::mutex> cache_lock{m_cache_mutex};
+        {
+            std::lock_guard<std::mutex> lock{m_queue_mutex};
+
+            while (!m_chunk_queue.empty()) {
+                m_chunk_queue.pop();
+            }
+
+            for (auto const& [identifier, chunk] : m_chunks) {
+                release_arena_slot(chunk);
+            }
+            m_chunks.clear();
+            m_failed_attempts.clear();
+        }
+
+        // The chunks the requests wait for are gone
+        std::lock_guard<std::mutex> request_lock{m_request_mutex};
+        for (auto& [id, request] : m_requests) {
+            cancelled.push_back(std::move(request));
+        }
+        m_requests.clear();
+        m_chunk_waiters.clear();
+    }
+    for (auto& request : cancelled) {
+        deliver(request, true);
+    }
+
+    create_thread_pool();
+}
+
+void Mandelbrot::enqueue_background(std::span<Chunk> chunks)
+{
+    {
+        std::lock_guard<std::mutex> lock{m_queue_mutex};
+        for (auto& chunk : chunks) {
+            trace_async_begin("queued", chunk.trace_id());
+            m_background_queue.push(chunk);
+        }
+    }
+    m_queue_convar.notify_all();
+}
+
+void Mandelbrot::enqueue_task(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock{m_queue_mutex};
+        m_task_queue.push(std::move(task));
+    }
+    m_queue_convar.notify_one();
+}
+
+void Mandelbrot::wait_for_chunks(std::span<Chunk const> chunks)
+{
+    std::unique_lock<std::mutex> lock{m_done_mutex};
+    m_done_convar.wait(lock, [&]() {
+        return std::all_of(chunks.begin(), chunks.end(), [](auto const& chunk) { return chunk.is_ready(); });
+    });
+}
+
+void Mandelbrot::create_arena()
+{
+    // The cache may briefly exceed max_chunk_memory by the queued chunks, chunks that do not fit are copied from a scratch slot
+    auto const cache_slots = max_chunk_memory / single_chunk_memory() + 4 * static_cast<std::size_t>(max_queue_size);
+    auto arena = SharedChunkArena::create(chunk_size * chunk_size, worker_processes + cache_slots);
+    if (!arena) {
+        std::cerr << "Failed to create the shared memory for the worker processes, using threads\n";
+        return;
+    }
+    m_arena.emplace(std::move(*arena));
+
+    m_scratch_slots.clear();
+    for (int32_t i = 0; i < worker_processes; ++i) {
+        m_scratch_slots.push_back(*m_arena->allocate());
+    }
+}
+
+void Mandelbrot::release_arena_slot(Chunk const& chunk)
+{
+    if (!m_arena) {
+        return;
+    }
+    if (auto const slot = m_arena->find(chunk.buffer())) {
+        m_arena->release(*slot);
+    }
+}
+
+// Called with m_cache_mutex held
+void Mandelbrot::evict_chunks()
+{
+    std::size_t cache_memory = m_chunks.size() * single_chunk_memory();
+
+    if (cache_memory <= max_chunk_memory) {
+        return;
+    }
+
+    auto const memory_to_delete = cache_memory - max_chunk_memory;
+    auto const chunk_amount_to_delete = memory_to_delete / single_chunk_memory();
+
+    std::cout << "Removing " << chunk_amount_to_delete << " chunks\n";
+
+    // Requests still have to copy the chunks they wait for, even after they are ready
+    std::vector<ChunkCacheListItem> chunks;
+    {
+        std::lock_guard<std::mutex> request_lock{m_request_mutex};
+        for (auto const& [identifier, chunk] : m_chunks) {
+            if (chunk.is_ready() && !m_chunk_waiters.contains(chunk.trace_id()))
+                chunks.push_back(ChunkCacheListItem{identifier, &chunk});
+        }
+    }
+    std::sort(std::begin(chunks), std::end(chunks), [](auto const& lhs, auto const& rhs) -> bool {
+        return lhs.chunk->last_access_time() < rhs.chunk->last_access_time();
+    });
+
+    for (std::size_t i = 0; i < std::min(chunk_amount_to_delete, chunks.size()); ++i) {
+        auto const& to_delete = chunks[i];
+        trace_instant("evict", to_delete.chunk->trace_id());
+        release_arena_slot(*to_delete.chunk);
+        m_chunks.erase(to_delete.identifier);
+        ++m_statistics.evicted_chunks;
+    }
+}
+
+RenderTicket Mandelbrot::submit(Buffer image, BandLayout const& layout, RenderParameters const& parameters, RenderCallback callback)
+{
+    auto request = PendingRequest{
+        .image = std::move(image),
+        .remaining_chunks = 0,
+        .waited_chunks = {},
+        .promise = {},
+        .callback = std::move(callback),
+    };
+    auto future = request.promise.get_future();
+
+    uint64_t request_id;
+    auto is_pending = false;
+    {
+        std::lock_guard<std::mutex> cache_lock{m_cache_mutex};
+        ++m_access_time;
+
+        std::vector<std::pair<Chunk*, ScreenPosition>> chunks;
+        chunks.reserve(layout.chunk_x_count * layout.band_count);
+        for (int64_t band = 0; band < layout.band_count; ++band) {
+            for (int64_t chunk_x = 0; chunk_x < layout.chunk_x_count; ++chunk_x) {
+                auto const position = ChunkGridPosition{
+                    .real = layout.top_left_chunk_position.real + chunk_x,
+                    .imag = layout.top_left_chunk_position.imag + band,
+                };
+                auto const identifier = ChunkIdentifier::create(layout.chunk_resolution, position, parameters, 1);
+
+                Chunk* chunk;
+                if (auto const it = m_chunks.find(identifier); it != m_chunks.end()) {
+                    ++m_statistics.cache_hits;
+                    chunk = &it->second;
+                } else {
+                    ++m_statistics.cache_misses;
+                    chunk = &insert_and_queue_chunk(identifier);
+                }
+                chunk->update_last_access_time(m_access_time);
+
+                auto const offset = ScreenPosition{
+                    .x = layout.chunk_offset.x + chunk_x * chunk_size,
+                    .y = layout.chunk_offset.y + band * chunk_size,
+                };
+                chunks.emplace_back(chunk, offset);
+            }
+        }
+
+        {
+            // A chunk that is not ready here is blitted by its worker, which takes this lock after publishing it
+            std::lock_guard<std::mutex> request_lock{m_request_mutex};
+            request_id = m_next_request_id++;
+            for (auto const& [chunk, offset] : chunks) {
+                if (chunk->is_ready()) {
+                    request.image.blit(*chunk, offset);
+                    continue;
+                }
+                auto& waiters = m_chunk_waiters[chunk->trace_id()];
+                waiters.chunk = chunk;
+                waiters.requests.emplace_back(request_id, offset);
+                request.waited_chunks.push_back(chunk->trace_id());
+                ++request.remaining_chunks;
+            }
+            is_pending = request.remaining_chunks > 0;
+            if (is_pending) {
+                m_requests.emplace(request_id, std::move(request));
+            }
+        }
+
+        evict_chunks();
+    }
+
+    if (!is_pending) {
+        deliver(request, false);
+    }
+    return RenderTicket{request_id, std::move(future)};
+}
+
+// Called by the worker after it published the chunk, which is not evicted until it is blitted into its waiting requests
+void Mandelbrot::complete_requests(uint64_t trace_id)
+{
+    std::vector<PendingRequest> finished;
+    {
+        std::lock_guard<std::mutex> lock{m_request_mutex};
+        auto const waiters = m_chunk_waiters.find(trace_id);
+        if (waiters == m_chunk_waiters.end()) {
+            return;
+        }
+
+        for (auto const& [request_id, offset] : waiters->second.requests) {
+            auto const it = m_requests.find(request_id);
+            auto& request = it->second;
+            request.image.blit(*waiters->second.chunk, offset);
+            if (--request.remaining_chunks == 0) {
+                finished.push_back(std::move(request));
+                m_requests.erase(it);
+            }
+        }
+        m_chunk_waiters.erase(waiters);
+    }
+
+    for (auto& request : finished) {
+        deliver(request, false);
+    }
+}
+
+void Mandelbrot::deliver(PendingRequest& request, bool cancelled)
+{
+    auto result = RenderResult{
+        .image = std::move(request.image),
+        .cancelled = cancelled,
+    };
+    if (request.callback) {
+        request.callback(result);
+    }
+    request.promise.set_value(std::move(result));
+}
+
+void Mandelbrot::compute_with_mirror(Chunk& chunk)
+{
+    auto const iterations = chunk.compute_pixels();
+    if (auto* mirror = chunk.mirror()) {
+        auto const mirror_trace_id = mirror->trace_id();
+        trace_async_end("queued", mirror_trace_id);
+        mirror->copy_mirrored(chunk, iterations);
+        mirror->compute_pixels();
+        m_statistics.computed_chunks.fetch_add(1, std::memory_order_relaxed);
+        m_statistics.computed_iterations.fetch_add(mirror->iteration_count(), std::memory_order_relaxed);
+        mirror->publish();
+        complete_requests(mirror_trace_id);
+    }
+    // A published chunk without waiting requests may be evicted at any time
+    m_statistics.computed_iterations.fetch_add(chunk.iteration_count(), std::memory_order_relaxed);
+    chunk.publish();
+}
+
+bool Mandelbrot::compute_remotely(RemoteWorker& remote_worker, Chunk& chunk, std::size_t scratch_slot)
+{
+    auto const slot = m_arena->find(chunk.buffer()).value_or(scratch_slot);
+    auto const result = remote_worker.run(chunk.worker_job(slot), chunk.worker_job_timeout());
+    if (!result) {
+        return false;
+    }
+    m_statistics.computed_iterations.fetch_add(result->iteration_count, std::memory_order_relaxed);
+    chunk.complete_remotely(*result, m_arena->slot(slot));
+    return true;
+}
+
+void Mandelbrot::retry_or_abandon(std::reference_wrapper<Chunk> chunk, std::queue<std::reference_wrapper<Chunk>>& queue)
+{
+    auto const trace_id = chunk.get().trace_id();
+    {
+        std::lock_guard<std::mutex> lock{m_queue_mutex};
+        auto& attempts = m_failed_attempts[trace_id];
+        if (++attempts < max_worker_attempts) {
+            trace_async_begin("queued", trace_id);
+            queue.push(chunk);
+            m_queue_convar.notify_one();
+            return;
+        }
+        m_failed_attempts.erase(trace_id);
+    }
+
+    std::cerr << "Giving up on a chunk after " << max_worker_attempts << " failed attempts\n";
+    chunk.get().abandon();
+    complete_requests(trace_id);
+    {
+        std::lock_guard<std::mutex> done_lock{m_done_mutex};
+    }
+    m_done_convar.notify_all();
+}
+
+Chunk* Mandelbrot::get_or_create_chunk(double chunk_resolution, ChunkGridPosition position, int64_t sample_step, RenderParameters const& parameters)
+{
+    auto chunk_identifier = ChunkIdentifier::create(chunk_resolution, position, parameters, 1);
+
+    Chunk* best_chunk = nullptr;
+    for (; chunk_identifier.sample_step <= interaction_sample_step; chunk_identifier.sample_step *= 2) {
+        auto const it = m_chunks.find(chunk_identifier);
+        if (it != m_chunks.end() && it->second.is_ready()) {
+            best_chunk = &it->second;
+            break;
+        }
+    }
+
+    if (!best_chunk || chunk_identifier.sample_step > sample_step) {
+        ++m_statistics.cache_misses;
+        chunk_identifier.sample_step = sample_step;
+        enqueue_chunk(chunk_identifier);
+    } else {
+        ++m_statistics.cache_hits;
+    }
+
+    return best_chunk;
+}
+
+bool Mandelbrot::enqueue_chunk(ChunkIdentifier identifier)
+{
+    if (m_chunk_queue.size() > static_cast<std::size_t>(max_queue_size)) {
+        return false;
+    }
+
+    if (m_chunks.contains(identifier)) {
+        return false;
+    }
+
+    insert_and_queue_chunk(identifier);
+    return true;
+}
+
+Chunk& Mandelbrot::insert_and_queue_chunk(ChunkIdentifier identifier)
+{
+    auto const complex_chunk_position = Complex{
+        .real = identifier.chunk_grid_position.real * identifier.chunk_resolution,
+        .imag = identifier.chunk_grid_position.imag * identifier.chunk_resolution,
+    };
+
+    // With worker processes the chunk lives in the shared memory, so the result does not have to be copied
+    std::span<Color> pixels;
+    if (m_arena) {
+        if (auto const slot = m_arena->allocate()) {
+            pixels = m_arena->slot(*slot);
+        }
+    }
+
+    m_chunks.insert(std::make_pair(identifier, Chunk::create(complex_chunk_position, identifier.chunk_resolution, identifier.formula, identifier.max_iterations, identifier.color_function, identifier.sample_step, identifier.antialiasing_samples, pixels)));
+
+    auto& new_chunk = m_chunks.at(identifier);
+    trace_instant("enqueue", new_chunk.trace_id());
+    trace_async_begin("queued", new_chunk.trace_id());
+
+    auto* mirror = find_mirror(identifier);
+    if (mirror && mirror->is_ready() && new_chunk.can_mirror_colors()) {
+        // Only the first row is left to compute
+        new_chunk.copy_mirrored(*mirror, {});
+    } else if (mirror && !mirror->is_ready()) {
+        // The worker of the mirror computes this chunk with it, unless it already took the mirror
+        std::lock_guard<std::mutex> lock{m_queue_mutex};
+        if (!mirror->is_started() && !mirror->mirror()) {
+            mirror->set_mirror(&new_chunk);
+            return new_chunk;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{m_queue_mutex};
+        m_chunk_queue.push(new_chunk);
+    }
+    m_queue_convar.notify_one();
+    return new_chunk;
+}
+
+Chunk* Mandelbrot::find_mirror(ChunkIdentifier identifier)
+{
+    if (m_arena || identifier.sample_step != 1 || !is_conjugate_symmetric(identifier.formula)) {
+        return nullptr;
+    }
+
+    identifier.chunk_grid_position.imag = -identifier.chunk_grid_position.imag - 1;
+    auto const it = m_chunks.find(identifier);
+    return it != m_chunks.end() ? &it->second : nullptr;
+}
@@ -0,0 +1,1677 @@
+#pragma once
+
+#include "color.hpp"
+#include "formula.hpp"
+#include "npy.hpp"
+#include "settings.hpp"
+#include "trace.hpp"
+#include "worker.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <immintrin.h>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <queue>
+#include <span>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// The render engine: chunks, their colorizers and the Mandelbrot object, which owns the chunk cache and the thread pool
+// or worker processes that fill it. It has no dependency on the viewer, several views and services can share one
+// Mandelbrot through render() and the asynchronous requests, everything that differs between them is passed per call.
+
+// Parameters
+int64_t constexpr interaction_sample_step = 4; // Render only every n-th pixel in each direction while panning or zooming
+inline std::size_t color_function_amount = 4;
+int64_t constexpr default_antialiasing_samples = 8; // Extra jittered samples per boundary pixel, 0 disables anti-aliasing
+int64_t constexpr max_antialiasing_samples = 32;
+uint32_t constexpr antialiasing_threshold = 2; // Pixels whose iteration count differs from a neighbour by more than this are on a boundary
+double constexpr antialiasing_distance = 0.5; // Exterior pixels closer to the set than this many pixels are on a boundary, if the distance is estimated
+float constexpr phong_normal_height = 1.5f; // z component of the Phong normals before normalizing, larger values give flatter lighting
+Color const default_color{100, 100, 100};
+
+// Runtime parameters from the Settings, only changed by apply_settings() while no worker threads are running. They are
+// tuning for the machine, shared by every Mandelbrot of the process.
+inline int64_t chunk_size = 32 * 8;
+inline int32_t thread_count = 8;
+inline int32_t max_queue_size = thread_count;
+inline std::size_t max_chunk_memory = 1024 * 1024 * 1024; // 1GiB
+inline int32_t worker_processes = 0;
+
+// Vectors of 4 pixels the AVX kernel iterates together. More groups hide more of the latency of the multiply and add
+// chains, until their state no longer fits into the 16 vector registers. 4 was the fastest with both AVX and AVX2 + FMA,
+// the kernel_interleave setting overrides it for a host, see the "kernel interleave" benchmark.
+int32_t constexpr max_kernel_interleave = 4;
+int32_t constexpr default_kernel_interleave = 4;
+inline int32_t kernel_interleave = default_kernel_interleave;
+
+template <typename Function>
+void with_kernel_interleave(int32_t groups, Function&& function)
+{
+    switch (groups) {
+    case 1:
+        return function.template operator()<1>();
+    case 2:
+        return function.template operator()<2>();
+    case 3:
+        return function.template operator()<3>();
+    default:
+        return function.template operator()<4>();
+    }
+}
+
+// A max_iterations of auto_iterations derives the limit from the zoom level, see auto_max_iterations(), and lets every
+// chunk raise it up to max_adaptive_iterations_factor times. The limit is raised while the samples that escape in its
+// upper half are at least adaptive_late_escape_fraction of all samples and adaptive_late_escape_yield of the bounded
+// ones, so chunks that are mostly inside the set stop early.
+int64_t constexpr auto_iterations = 0;
+int64_t constexpr max_adaptive_iterations_factor = 16;
+double constexpr adaptive_late_escape_fraction = 0.001;
+double constexpr adaptive_late_escape_yield = 0.02;
+
+// Deeper views need more iterations to resolve the boundary. The limit grows with a power of the number of decimal
+// digits zoomed in past the whole set and is rounded to the steps of +/-.
+inline int64_t auto_max_iterations(double pixel_size)
+{
+    auto const depth = std::max(std::log10(4.0 / 1024 / pixel_size), 0.0);
+    return std::max<int64_t>(std::llround(200 * std::pow(1 + depth, 1.5) / 50) * 50, 50);
+}
+
+// A worker process is assumed to hang when it takes longer for a job than a slow core running every sample to the
+// iteration limit, or min_worker_job_timeout for small jobs. See Chunk::worker_job_timeout().
+auto constexpr min_worker_job_timeout = std::chrono::seconds{30};
+double constexpr min_worker_iterations_per_second = 50e6;
+int32_t constexpr max_worker_attempts = 3; // A chunk that makes this many worker processes fail is filled with default_color
+
+inline std::size_t single_chunk_memory()
+{
+    return chunk_size * chunk_size * sizeof(Color);
+}
+
+void apply_settings(Settings const& settings);
+
+// Worker processes are started as "/proc/self/exe --worker ...", so a program that uses worker_processes calls this first
+// in main(). Returns the exit code of the worker process, or nothing if the program was not started as one.
+std::optional<int> run_as_worker(int argc, char** argv);
+
+struct ScreenPosition {
+    int64_t x;
+    int64_t y;
+};
+
+struct Complex {
+    double real;
+    double imag;
+
+    bool operator==(Complex const& other) const = default;
+};
+
+struct ChunkGridPosition {
+    int64_t real;
+    int64_t imag;
+
+    bool operator==(ChunkGridPosition const& other) const = default;
+};
+
+template <>
+struct std::hash<ChunkGridPosition> {
+    std::size_t operator()(ChunkGridPosition const& value) const
+    {
+        return (hash<int64_t>()(value.real) ^ hash<int64_t>()(value.imag));
+    }
+};
+
+struct HSLColor {
+    uint16_t hue; // 0-359
+    uint8_t saturation; // 0-100
+    uint8_t lightness; // 0-100
+
+    [[nodiscard]] Color to_rgb() const
+    {
+        if (saturation == 0) {
+            return Color{
+                lightness,
+                lightness,
+                lightness,
+            };
+        }
+
+        auto const h = std::clamp<uint16_t>(hue, 0, 359);
+        auto const s = std::clamp<uint8_t>(saturation, 0, 100) / 100.0;
+        auto const l = std::clamp<uint8_t>(lightness, 0, 100) / 100.0;
+
+        auto const chroma = (1 - std::abs(2 * l - 1)) * s;
+        auto const h1 = h / 60.0;
+        auto const x = chroma * (1.0 - std::abs(std::fmod(h1, 2.0) - 1));
+
+        auto const [r1, g1, b1] = ([&]() {
+            switch (static_cast<int32_t>(std::floor(h1))) {
+            case 0:
+                return std::make_tuple(chroma, x, 0.0);
+            case 1:
+                return std::make_tuple(x, chroma, 0.0);
+            case 2:
+                return std::make_tuple(0.0, chroma, x);
+            case 3:
+                return std::make_tuple(0.0, x, chroma);
+            case 4:
+                return std::make_tuple(x, 0.0, chroma);
+            case 5:
+                return std::make_tuple(chroma, 0.0, x);
+            default:
+                return std::make_tuple(0.0, 0.0, 0.0);
+            }
+        })();
+
+        auto const m = l - (chroma / 2.0);
+
+        auto const r = r1 + m;
+        auto const g = g1 + m;
+        auto const b = b1 + m;
+
+        return Color{
+            static_cast<uint8_t>(r * 255),
+            static_cast<uint8_t>(g * 255),
+            static_cast<uint8_t>(b * 255),
+        };
+    }
+};
+
+struct Chunk;
+
+struct Buffer {
+    static Buffer init(int64_t width, int64_t height)
+    {
+        return Buffer{
+            width,
+            height,
+            std::vector<int32_t>(width * height),
+        };
+    }
+
+    Buffer() = default;
+
+    Buffer(int64_t width, int64_t height, std::vector<int32_t> buffer)
+        : m_width{width}
+        , m_height{height}
+        , m_buffer{buffer}
+    { }
+
+    void set(ScreenPosition position, Color color)
+    {
+        m_buffer[position.y * m_width + position.x] = color.color;
+    }
+
+    void set(int64_t position, Color color)
+    {
+        m_buffer[position] = color.color;
+    }
+
+    std::span<int32_t> buffer()
+    {
+        return m_buffer;
+    }
+
+    [[nodiscard]] std::span<int32_t const> buffer() const
+    {
+        return m_buffer;
+    }
+
+    [[nodiscard]] int64_t width() const
+    {
+        return m_width;
+    }
+
+    [[nodiscard]] int64_t height() const
+    {
+        return m_height;
+    }
+
+    void resize(int64_t width, int64_t height)
+    {
+        m_width = width;
+        m_height = height;
+        m_buffer.resize(width * height);
+    }
+
+    void fill(Color color)
+    {
+        std::fill(m_buffer.begin(), m_buffer.end(), color.color);
+    }
+
+    void fill_rect(ScreenPosition position, int64_t width, int64_t height, Color color)
+    {
+        auto const x_start = std::clamp(position.x, 0l, m_width);
+        auto const x_end = std::clamp(position.x + width, 0l, m_width);
+        auto const y_start = std::clamp(position.y, 0l, m_height);
+        auto const y_end = std::clamp(position.y + height, 0l, m_height);
+
+        for (auto y = y_start; y < y_end; ++y) {
+            std::fill(&m_buffer[y * m_width + x_start], &m_buffer[y * m_width + x_end], color.color);
+        }
+    }
+
+    void blit(Chunk const&, ScreenPosition);
+
+private:
+    int64_t m_width{0};
+    int64_t m_height{0};
+    std::vector<int32_t> m_buffer;
+};
+
+struct Chunk {
+    // The pixels are stored in the chunk, unless pixels with chunk_size * chunk_size elements are given
+    static Chunk create(Complex position, double complex_size, std::size_t formula, int64_t max_iterations_local, std::size_t color_function, int64_t sample_step, int64_t antialiasing_samples, std::span<Color> pixels = {})
+    {
+        return Chunk{
+            position,
+            complex_size,
+            formula,
+            max_iterations_local,
+            color_function,
+            sample_step,
+            antialiasing_samples,
+            pixels,
+        };
+    };
+
+    Chunk(Chunk&&) = default;
+    Chunk(Chunk const&) = delete;
+    Chunk& operator=(Chunk const&) = delete;
+
+    void compute()
+    {
+        compute_pixels();
+        publish();
+    }
+
+    // compute() without publishing the result. Returns the iteration counts, if the chunk was computed from them, for
+    // copy_mirrored().
+    std::vector<uint32_t> compute_pixels()
+    {
+        if (m_ready) {
+            return {};
+        }
+
+        if (m_mirrored == MirrorSource::COLORS) {
+            auto const span = TraceSpan{"compute", m_trace_id};
+            compute_mirrored_first_row();
+            return {};
+        }
+
+        {
+            auto const span = TraceSpan{"compute", m_trace_id};
+            if (m_mirrored == MirrorSource::ITERATIONS) {
+                compute_first_row_with_surface();
+            } else {
+                if (computes_surface()) {
+                    m_surface.assign(m_buffer.size(), SurfaceSample{});
+                }
+                with_formula(m_formula, [&]<typename Formula>() {
+#ifdef __AVX__
+                    with_kernel_interleave(kernel_interleave, [&]<int GROUPS>() {
+                        computes_surface() ? compute_avx_double<Formula, true, GROUPS>() : compute_avx_double<Formula, false, GROUPS>();
+                    });
+#else
+                    computes_surface() ? compute_double<Formula, true>() : compute_double<Formula>();
+#endif
+                    count_iterations();
+                    if (m_adaptive_iterations) {
+                        extend_iterations<Formula>();
+                    }
+                });
+            }
+        }
+
+        if (m_sample_step > 1) {
+            scale(m_buffer);
+            if (computes_surface()) {
+                scale(std::span<SurfaceSample>{m_surface});
+            }
+        }
+
+        // Field chunks are exported before they are colored
+        if (m_keeps_field) {
+            with_formula(m_formula, [&]<typename Formula>() { store_field<Formula>(); });
+            return {};
+        }
+
+        // Colorizing overwrites the iteration counts, which are still needed for the neighbours of each pixel
+        auto iterations = std::vector<uint32_t>(m_buffer.size());
+        std::transform(m_buffer.begin(), m_buffer.end(), iterations.begin(), [](Color color) { return color.color; });
+
+        {
+            auto const span = TraceSpan{"colorize", m_trace_id};
+            colorize(iterations);
+        }
+
+        // Reduced density chunks are only shown while interacting, where aliasing does not matter
+        if (m_antialiasing_samples > 0 && m_sample_step == 1) {
+            auto const span = TraceSpan{"antialias", m_trace_id};
+            antialias(iterations);
+        }
+
+        return iterations;
+    }
+
+    void publish()
+    {
+        if (m_ready) {
+            return;
+        }
+        m_surface = {};
+        m_ready = true;
+        trace_instant("publish", m_trace_id);
+    }
+
+    // Fills all rows but the first from the chunk on the other side of the real axis, for formulas that are conjugate
+    // symmetric. Row y of this chunk is the conjugate of row chunk_size - y of the mirror, so row 0 belongs to the chunk
+    // after the mirror and is left to compute_pixels().
+    // Phong shading depends on the direction to the neighbours, which flips with the rows, so then the iteration counts
+    // of the mirror are needed to colorize again. Otherwise its final colors are copied and mirror_iterations is unused.
+    void copy_mirrored(Chunk const& mirror, std::span<uint32_t const> mirror_iterations)
+    {
+        auto const copy_colors = can_mirror_colors();
+        if (!copy_colors) {
+            m_surface.assign(m_buffer.size(), SurfaceSample{});
+        }
+
+        for (int64_t y = 1; y < chunk_size; ++y) {
+            auto const source_row = (chunk_size - y) * chunk_size;
+            auto const target = m_buffer.subspan(y * chunk_size, chunk_size);
+            if (copy_colors) {
+                std::copy_n(mirror.m_buffer.begin() + source_row, chunk_size, target.begin());
+            } else {
+                for (int64_t x = 0; x < chunk_size; ++x) {
+                    target[x].color = mirror_iterations[source_row + x];
+                    auto surface = mirror.m_surface[source_row + x];
+                    surface.normal_y = -surface.normal_y;
+                    m_surface[y * chunk_size + x] = surface;
+                }
+            }
+        }
+        // Row 0 has to be computed with the limit the mirror ended up with
+        m_max_iterations_local = mirror.m_max_iterations_local;
+        m_bounded_count = mirror.m_bounded_count;
+        m_mirrored = copy_colors ? MirrorSource::COLORS : MirrorSource::ITERATIONS;
+        trace_instant("mirror", m_trace_id);
+    }
+
+    [[nodiscard]] bool can_mirror_colors() const
+    {
+        return !uses_surface();
+    }
+
+    // Phong shading lights the analytic surface of the distance estimate
+    [[nodiscard]] bool uses_surface() const
+    {
+        return m_color_function == 3;
+    }
+
+    [[nodiscard]] bool computes_surface() const
+    {
+        return uses_surface() || m_keeps_field;
+    }
+
+    // Keeps the raw iteration field instead of colors, for chunks that are exported and not shown. Only called before the
+    // chunk is started.
+    void keep_field()
+    {
+        m_keeps_field = true;
+    }
+
+    [[nodiscard]] bool keeps_field() const
+    {
+        return m_keeps_field;
+    }
+
+    // chunk_size * chunk_size samples once the chunk is ready, if it keeps the field
+    [[nodiscard]] std::span<FieldSample const> field() const
+    {
+        return m_field;
+    }
+
+    // Color of an escape count, which is fractional when a field is recolored. color_iterations spans the color range.
+    [[nodiscard]] static Color iteration_color(std::size_t color_function, double iterations, int64_t color_iterations, bool is_inside, float shade)
+    {
+        auto const iterations_ratio = wrap_color_ratio(iterations / static_cast<double>(color_iterations));
+
+        switch (color_function) {
+        case 0:
+            return is_inside ? Color{} : Color{255, 255, 255};
+        case 1:
+            if (is_inside) {
+                return Color{};
+            }
+            return HSLColor{
+                100,
+                static_cast<uint8_t>(iterations_ratio * 100),
+                std::clamp<uint8_t>(static_cast<uint8_t>(iterations_ratio * 100), 20, 80),
+            }
+                .to_rgb();
+        case 2:
+            if (is_inside) {
+                return Color{};
+            }
+            return HSLColor{
+                .hue = static_cast<uint16_t>((iterations_ratio) * 360),
+                .saturation = 50,
+                .lightness = 50,
+            }
+                .to_rgb();
+        case 3: {
+            auto const base_color = HSLColor{
+                .hue = static_cast<uint16_t>(wrap_color_ratio(static_cast<float>(iterations) / color_iterations) * 360),
+                .saturation = 50,
+                .lightness = 50,
+            }
+                                        .to_rgb();
+            return Color{
+                static_cast<uint8_t>(base_color.r * shade),
+                static_cast<uint8_t>(base_color.g * shade),
+                static_cast<uint8_t>(base_color.b * shade),
+            };
+        }
+        }
+
+        return default_color;
+    }
+
+    // Diffuse lighting of the analytic surface, see SurfaceSample. Every pixel is shaded on its own, so there are no seams
+    // at chunk edges.
+    [[nodiscard]] static float phong_shade(float normal_x, float normal_y)
+    {
+        auto const light_direction = Vec3{.x = 1.0f, .y = 1.0f, .z = 1.0f}.normalize();
+        auto const normal = Vec3{.x = normal_x, .y = normal_y, .z = phong_normal_height}.normalize();
+        return std::max(normal * light_direction, 0.0f);
+    }
+
+    // The chunk that copies this one when it is computed, only changed before the chunk is started
+    [[nodiscard]] Chunk* mirror() const
+    {
+        return m_mirror;
+    }
+
+    void set_mirror(Chunk* mirror)
+    {
+        m_mirror = mirror;
+    }
+
+    // Set by the thread pool when a worker takes the chunk, guarded by the queue mutex
+    [[nodiscard]] bool is_started() const
+    {
+        return m_is_started;
+    }
+
+    void mark_started()
+    {
+        m_is_started = true;
+    }
+
+    [[nodiscard]] Color const* buffer() const
+    {
+        return m_buffer.data();
+    }
+
+    [[nodiscard]] bool is_ready() const
+    {
+        return m_ready;
+    }
+
+    [[nodiscard]] double complex_size() const
+    {
+        return m_complex_size;
+    }
+
+    [[nodiscard]] uint64_t iteration_count() const
+    {
+        return m_iteration_count;
+    }
+
+    [[nodiscard]] int64_t sample_step() const
+    {
+        return m_sample_step;
+    }
+
+    // The limit the chunk was computed with, which adaptive chunks may have raised
+    [[nodiscard]] int64_t max_iterations() const
+    {
+        return m_max_iterations_local;
+    }
+
+    // The limit of the zoom level, equal to max_iterations() unless the chunk is adaptive
+    [[nodiscard]] int64_t color_iterations() const
+    {
+        return m_color_iterations;
+    }
+
+    // Computed samples that did not escape within max_iterations()
+    [[nodiscard]] uint64_t bounded_count() const
+    {
+        return m_bounded_count;
+    }
+
+    [[nodiscard]] uint64_t trace_id() const
+    {
+        return m_trace_id;
+    }
+
+    [[nodiscard]] WorkerJob worker_job(std::size_t slot) const
+    {
+        return WorkerJob{
+            .job_id = m_trace_id,
+            .position_real = m_position.real,
+            .position_imag = m_position.imag,
+            .complex_size = m_complex_size,
+            .formula = m_formula,
+            .max_iterations = m_adaptive_iterations ? auto_iterations : m_max_iterations_local,
+            .color_function = m_color_function,
+            .sample_step = m_sample_step,
+            .antialiasing_samples = m_antialiasing_samples,
+            .slot = slot,
+        };
+    }
+
+    [[nodiscard]] std::chrono::milliseconds worker_job_timeout() const
+    {
+        auto const pixels = (chunk_size / m_sample_step) * (chunk_size / m_sample_step);
+        auto const samples = 1 + (m_sample_step == 1 ? m_antialiasing_samples : 0);
+        auto const iterations = m_adaptive_iterations ? m_color_iterations * max_adaptive_iterations_factor : m_max_iterations_local;
+        auto const worst_case = std::chrono::duration<double>{static_cast<double>(pixels) * samples * iterations / min_worker_iterations_per_second};
+        return std::max(std::chrono::duration_cast<std::chrono::milliseconds>(worst_case), std::chrono::milliseconds{min_worker_job_timeout});
+    }
+
+    // A worker process computed the chunk into pixels, which are copied unless they already are the buffer of this chunk
+    void complete_remotely(WorkerResult const& result, std::span<Color const> pixels)
+    {
+        if (pixels.data() != m_buffer.data()) {
+            std::copy(pixels.begin(), pixels.end(), m_buffer.begin());
+        }
+        m_iteration_count = result.iteration_count;
+        m_max_iterations_local = result.max_iterations;
+        m_bounded_count = result.bounded_count;
+        m_ready = true;
+        trace_instant("publish", m_trace_id);
+    }
+
+    // Computing the chunk failed repeatedly
+    void abandon()
+    {
+        std::fill(m_buffer.begin(), m_buffer.end(), default_color);
+        m_ready = true;
+    }
+
+    // time is a counter of the owner of the cache, chunks with the lowest one are evicted first
+    void update_last_access_time(std::size_t time)
+    {
+        m_last_access_time = time;
+    }
+
+    [[nodiscard]] std::size_t last_access_time() const
+    {
+        return m_last_access_time;
+    }
+
+private:
+    // Surface of the distance estimate at a pixel. The normal points away from the set, its xy components are the
+    // direction of z / dz, so it needs no neighbouring pixels. Both are 0 inside the set.
+    struct SurfaceSample {
+        float normal_x;
+        float normal_y;
+        float distance; // Exterior distance estimate to the set in complex units
+        float log_z_abs; // log |z| at the escape, for the fractional escape count
+    };
+
+    enum class MirrorSource {
+        NONE,
+        COLORS,
+        ITERATIONS,
+    };
+
+    // A sample that was still bounded at the iteration limit, extend_iterations() resumes it from here
+    struct BoundedSample {
+        int64_t buffer_position;
+        Complex z;
+        Complex dz;
+        Complex c;
+    };
+
+    bool m_ready{false};
+    bool m_is_started{false};
+    MirrorSource m_mirrored{MirrorSource::NONE};
+    Chunk* m_mirror{nullptr};
+    std::vector<SurfaceSample> m_surface; // Only while computing a chunk that computes_surface()
+    std::vector<BoundedSample> m_bounded_samples; // Only while computing an adaptive chunk
+    bool m_keeps_field{false};
+    std::vector<FieldSample> m_field;
+    Complex m_position{0, 0};
+    double m_complex_size{0};
+    std::vector<Color> m_storage;
+    std::span<Color> m_buffer; // Either m_storage or memory owned by someone else, moving the vector keeps it valid
+    std::size_t m_last_access_time{0};
+    std::size_t m_formula{0};
+    int64_t m_max_iterations_local{0};
+    int64_t m_color_iterations{0}; // Iterations that span the color range
+    bool m_adaptive_iterations{false};
+    uint64_t m_bounded_count{0};
+    std::size_t m_color_function{0};
+    int64_t m_sample_step{1};
+    int64_t m_antialiasing_samples{0};
+    uint64_t m_iteration_count{0};
+    uint64_t m_trace_id{next_trace_id.fetch_add(1, std::memory_order_relaxed)};
+
+    static inline std::atomic<uint64_t> next_trace_id{0};
+
+    Chunk(Complex position, double complex_size, std::size_t formula, int64_t max_iterations_local, std::size_t color_function, int64_t sample_step, int64_t antialiasing_samples, std::span<Color> pixels)
+        : m_position{position}
+        , m_complex_size{complex_size}
+        , m_storage(pixels.empty() ? chunk_size * chunk_size : 0)
+        , m_buffer{pixels.empty() ? std::span<Color>{m_storage} : pixels}
+        , m_formula{formula}
+        , m_max_iterations_local{max_iterations_local == auto_iterations ? auto_max_iterations(complex_size / chunk_size) : max_iterations_local}
+        , m_color_iterations{m_max_iterations_local}
+        , m_adaptive_iterations{max_iterations_local == auto_iterations}
+        , m_color_function{color_function}
+        , m_sample_step{sample_step}
+        , m_antialiasing_samples{antialiasing_samples}
+    { }
+
+    // With WITH_SURFACE, the surface of the pixel is written to surface
+    template <typename Formula, bool WITH_SURFACE = false>
+    [[nodiscard]] uint32_t iterate_double(Complex pixel, SurfaceSample* surface = nullptr) const
+    {
+        Complex z;
+        Complex c;
+        Formula::start(pixel.real, pixel.imag, z.real, z.imag, c.real, c.imag);
+        Complex dz = {Formula::DERIVATIVE_START, 0};
+        return resume_double<Formula, WITH_SURFACE>(z, dz, c, 0, surface);
+    }
+
+    // Iterates z, which has already been iterated first_iteration times. If it stays bounded, z and dz are left at the
+    // state after m_max_iterations_local iterations.
+    template <typename Formula, bool WITH_SURFACE = false>
+    [[nodiscard]] uint32_t resume_double(Complex& z, Complex& dz, Complex c, int64_t first_iteration, SurfaceSample* surface = nullptr) const
+    {
+        Complex z2 = {z.real * z.real, z.imag * z.imag};
+
+        int64_t iteration = first_iteration;
+        for (; iteration < m_max_iterations_local; ++iteration) {
+            auto abs = z2.real + z2.imag;
+            if (abs >= 4) {
+                if constexpr (WITH_SURFACE) {
+                    *surface = surface_sample(z, dz);
+                }
+                break;
+            }
+            if constexpr (WITH_SURFACE) {
+                Formula::derivative_step(z.real, z.imag, dz.real, dz.imag);
+            }
+            Formula::step(z.real, z.imag, z2.real, z2.imag, c.real, c.imag);
+            z2.real = z.real * z.real;
+            z2.imag = z.imag * z.imag;
+        }
+        return iteration;
+    }
+
+    // Only every m_sample_step-th pixel in each direction is computed, scale() fills in the rest
+    template <typename Formula, bool WITH_SURFACE = false>
+    void compute_double()
+    {
+        double const pixel_delta = m_complex_size / chunk_size * m_sample_step;
+
+        Complex pixel = m_position;
+        for (int64_t y = 0; y < chunk_size; y += m_sample_step) {
+            pixel.real = m_position.real;
+
+            for (int64_t x = 0; x < chunk_size; x += m_sample_step) {
+                auto const buffer_position = y * chunk_size + x;
+                auto sample = BoundedSample{.buffer_position = buffer_position, .dz = {Formula::DERIVATIVE_START, 0}};
+                Formula::start(pixel.real, pixel.imag, sample.z.real, sample.z.imag, sample.c.real, sample.c.imag);
+                auto const iterations = resume_double<Formula, WITH_SURFACE>(sample.z, sample.dz, sample.c, 0, WITH_SURFACE ? &m_surface[buffer_position] : nullptr);
+                m_buffer[buffer_position].color = iterations;
+                if (m_adaptive_iterations && iterations == m_max_iterations_local) {
+                    m_bounded_samples.push_back(sample);
+                }
+                pixel.real += pixel_delta;
+            }
+
+            pixel.imag += pixel_delta;
+        }
+    }
+
+    // GROUPS independent vectors of 4 pixels are iterated in one loop, so the multiply and add chains of one group
+    // execute while the others wait for their results.
+    // With WITH_SURFACE, dz is iterated alongside z and the surface of every lane is taken when it escapes.
+    template <typename Formula, bool WITH_SURFACE, int GROUPS>
+    void compute_avx_double()
+    {
+        auto const pixel_delta_single = m_complex_size / chunk_size * m_sample_step;
+
+        auto const pixel_delta_imag = _mm256_set1_pd(pixel_delta_single);
+        auto const pixel_delta_real = _mm256_set1_pd(pixel_delta_single * 4);
+
+        // Why do they have to be ordered like this?
+        auto const pixel_real_start = _mm256_set_pd(
+            m_position.real + pixel_delta_single * 3,
+            m_position.real + pixel_delta_single * 2,
+            m_position.real + pixel_delta_single * 1,
+            m_position.real + pixel_delta_single * 0);
+
+        auto pixel_imag = _mm256_set1_pd(m_position.imag);
+
+        auto const const_4 = _mm256_set1_pd(4);
+        auto const all_lanes = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+
+        // chunk_size is a multiple of 16, so every row has a whole number of vectors
+        auto const vector_width = 4 * m_sample_step;
+        auto const vectors_per_row = chunk_size / vector_width;
+
+        {
+            Color color_max_iterations;
+            color_max_iterations.color = m_max_iterations_local;
+            std::fill(m_buffer.begin(), m_buffer.end(), color_max_iterations);
+        }
+
+        for (int64_t y = 0; y < chunk_size; y += m_sample_step) {
+            auto pixel_real = pixel_real_start;
+
+            for (int64_t first_vector = 0; first_vector < vectors_per_row; first_vector += GROUPS) {
+                __m256d z_real[GROUPS];
+                __m256d z_imag[GROUPS];
+                __m256d c_real[GROUPS];
+                __m256d c_imag[GROUPS];
+                __m256d z_real2[GROUPS];
+                __m256d z_imag2[GROUPS];
+                __m256d dz_real[GROUPS];
+                __m256d dz_imag[GROUPS];
+                __m256d escaped[GROUPS]; // Lanes that escaped in an earlier iteration
+
+                for (int group = 0; group < GROUPS; ++group) {
+                    Formula::start(pixel_real, pixel_imag, z_real[group], z_imag[group], c_real[group], c_imag[group]);
+                    z_real2[group] = _mm256_mul_pd(z_real[group], z_real[group]);
+                    z_imag2[group] = _mm256_mul_pd(z_imag[group], z_imag[group]);
+                    dz_real[group] = _mm256_set1_pd(Formula::DERIVATIVE_START);
+                    dz_imag[group] = _mm256_set1_pd(0);
+                    // Groups past the end of the row are never recorded
+                    escaped[group] = first_vector + group < vectors_per_row ? _mm256_setzero_pd() : all_lanes;
+                    pixel_real = _mm256_add_pd(pixel_real, pixel_delta_real);
+                }
+
+                for (int32_t iteration = 0; iteration < m_max_iterations_local; ++iteration) {
+                    auto all_escaped = all_lanes;
+                    for (int group = 0; group < GROUPS; ++group) {
+                        auto const abs = _mm256_add_pd(z_real2[group], z_imag2[group]);
+                        auto const newly_escaped = _mm256_andnot_pd(escaped[group], _mm256_cmp_pd(abs, const_4, _CMP_GE_OS));
+                        if (!_mm256_testz_pd(newly_escaped, newly_escaped)) [[unlikely]] {
+                            record_escaped<WITH_SURFACE>(_mm256_movemask_pd(newly_escaped),
+                                y * chunk_size + (first_vector + group) * vector_width, iteration,
+                                z_real[group], z_imag[group], dz_real[group], dz_imag[group]);
+                            escaped[group] = _mm256_or_pd(escaped[group], newly_escaped);
+                        }
+                        all_escaped = _mm256_and_pd(all_escaped, escaped[group]);
+                    }
+
+                    // Compares the sign bits only, which are set in every escaped lane
+                    if (_mm256_testc_pd(all_escaped, all_lanes)) {
+                        break;
+                    }
+
+                    for (int group = 0; group < GROUPS; ++group) {
+                        if constexpr (WITH_SURFACE) {
+                            Formula::derivative_step(z_real[group], z_imag[group], dz_real[group], dz_imag[group]);
+                        }
+                        Formula::step(z_real[group], z_imag[group], z_real2[group], z_imag2[group], c_real[group], c_imag[group]);
+
+                        z_real2[group] = _mm256_mul_pd(z_real[group], z_real[group]);
+                        z_imag2[group] = _mm256_mul_pd(z_imag[group], z_imag[group]);
+                    }
+                }
+
+                if (m_adaptive_iterations) {
+                    for (int group = 0; group < GROUPS; ++group) {
+                        auto const bounded_lanes = ~_mm256_movemask_pd(escaped[group]) & 0xf;
+                        if (bounded_lanes != 0) {
+                            record_bounded(bounded_lanes, y * chunk_size + (first_vector + group) * vector_width,
+                                z_real[group], z_imag[group], dz_real[group], dz_imag[group], c_real[group], c_imag[group]);
+                        }
+                    }
+                }
+            }
+
+            pixel_imag = _mm256_add_pd(pixel_imag, pixel_delta_imag);
+        }
+    }
+
+    // Stores the iteration count, and with WITH_SURFACE the surface, of the lanes in lane_mask of the vector at
+    // buffer_position
+    template <bool WITH_SURFACE>
+    void record_escaped(int lane_mask, int64_t buffer_position, int32_t iteration, __m256d z_real, __m256d z_imag, __m256d dz_real, __m256d dz_imag)
+    {
+        alignas(32) std::array<double, 4> lane_z_real;
+        alignas(32) std::array<double, 4> lane_z_imag;
+        alignas(32) std::array<double, 4> lane_dz_real;
+        alignas(32) std::array<double, 4> lane_dz_imag;
+        if constexpr (WITH_SURFACE) {
+            _mm256_store_pd(lane_z_real.data(), z_real);
+            _mm256_store_pd(lane_z_imag.data(), z_imag);
+            _mm256_store_pd(lane_dz_real.data(), dz_real);
+            _mm256_store_pd(lane_dz_imag.data(), dz_imag);
+        }
+
+        for (int lane = 0; lane < 4; ++lane) {
+            if (lane_mask & (1 << lane)) {
+                auto const position = buffer_position + lane * m_sample_step;
+                m_buffer[position].color = iteration;
+                if constexpr (WITH_SURFACE) {
+                    m_surface[position] = surface_sample(Complex{lane_z_real[lane], lane_z_imag[lane]}, Complex{lane_dz_real[lane], lane_dz_imag[lane]});
+                }
+            }
+        }
+    }
+
+    // Keeps the state of the lanes in lane_mask of the vector at buffer_position for extend_iterations()
+    void record_bounded(int lane_mask, int64_t buffer_position, __m256d z_real, __m256d z_imag, __m256d dz_real, __m256d dz_imag, __m256d c_real, __m256d c_imag)
+    {
+        alignas(32) std::array<std::array<double, 4>, 6> lanes;
+        _mm256_store_pd(lanes[0].data(), z_real);
+        _mm256_store_pd(lanes[1].data(), z_imag);
+        _mm256_store_pd(lanes[2].data(), dz_real);
+        _mm256_store_pd(lanes[3].data(), dz_imag);
+        _mm256_store_pd(lanes[4].data(), c_real);
+        _mm256_store_pd(lanes[5].data(), c_imag);
+
+        for (int lane = 0; lane < 4; ++lane) {
+            if (lane_mask & (1 << lane)) {
+                m_bounded_samples.push_back(BoundedSample{
+                    .buffer_position = buffer_position + lane * m_sample_step,
+                    .z = {lanes[0][lane], lanes[1][lane]},
+                    .dz = {lanes[2][lane], lanes[3][lane]},
+                    .c = {lanes[4][lane], lanes[5][lane]},
+                });
+            }
+        }
+    }
+
+    // Resumes batches of 4 bounded samples from first_iteration, like resume_double() without the surface
+    template <typename Formula>
+    void resume_avx_double(std::span<BoundedSample> samples, int64_t first_iteration, std::span<uint32_t> iterations) const
+    {
+        auto const const_1 = _mm256_set1_pd(1);
+        auto const const_4 = _mm256_set1_pd(4);
+
+        for (std::size_t i = 0; i < samples.size(); i += 4) {
+            // The last batch is padded with copies of the last sample
+            std::array<BoundedSample*, 4> batch;
+            for (std::size_t lane = 0; lane < 4; ++lane) {
+                batch[lane] = &samples[std::min(i + lane, samples.size() - 1)];
+            }
+
+            auto z_real = _mm256_set_pd(batch[3]->z.real, batch[2]->z.real, batch[1]->z.real, batch[0]->z.real);
+            auto z_imag = _mm256_set_pd(batch[3]->z.imag, batch[2]->z.imag, batch[1]->z.imag, batch[0]->z.imag);
+            auto const c_real = _mm256_set_pd(batch[3]->c.real, batch[2]->c.real, batch[1]->c.real, batch[0]->c.real);
+            auto const c_imag = _mm256_set_pd(batch[3]->c.imag, batch[2]->c.imag, batch[1]->c.imag, batch[0]->c.imag);
+            auto z_real2 = _mm256_mul_pd(z_real, z_real);
+            auto z_imag2 = _mm256_mul_pd(z_imag, z_imag);
+            auto counts = _mm256_set1_pd(static_cast<double>(first_iteration));
+            auto active = _mm256_cmp_pd(const_1, const_1, _CMP_EQ_OQ);
+
+            for (int64_t iteration = first_iteration; iteration < m_max_iterations_local; ++iteration) {
+                auto const abs = _mm256_add_pd(z_real2, z_imag2);
+                active = _mm256_and_pd(active, _mm256_cmp_pd(abs, const_4, _CMP_LT_OQ));
+                if (_mm256_testz_pd(active, active)) {
+                    break;
+                }
+                counts = _mm256_add_pd(counts, _mm256_and_pd(active, const_1));
+
+                Formula::step(z_real, z_imag, z_real2, z_imag2, c_real, c_imag);
+
+                z_real2 = _mm256_mul_pd(z_real, z_real);
+                z_imag2 = _mm256_mul_pd(z_imag, z_imag);
+            }
+
+            // Lanes that are still bounded were stepped in every iteration, so their z is the state at the new limit
+            alignas(32) std::array<double, 4> lane_counts;
+            alignas(32) std::array<double, 4> lane_z_real;
+            alignas(32) std::array<double, 4> lane_z_imag;
+            _mm256_store_pd(lane_counts.data(), counts);
+            _mm256_store_pd(lane_z_real.data(), z_real);
+            _mm256_store_pd(lane_z_imag.data(), z_imag);
+            for (std::size_t lane = 0; lane < 4 && i + lane < samples.size(); ++lane) {
+                iterations[i + lane] = static_cast<uint32_t>(lane_counts[lane]);
+                batch[lane]->z = Complex{lane_z_real[lane], lane_z_imag[lane]};
+            }
+        }
+    }
+
+    // Iteration counts of arbitrary points, used for the anti-aliasing samples
+    template <typename Formula>
+    void compute_points_double(std::span<Complex const> points, std::span<uint32_t> iterations) const
+    {
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            iterations[i] = iterate_double<Formula>(points[i]);
+        }
+    }
+
+    template <typename Formula>
+    void compute_points_avx_double(std::span<Complex const> points, std::span<uint32_t> iterations) const
+    {
+        auto const const_0 = _mm256_set1_pd(0);
+        auto const const_1 = _mm256_set1_pd(1);
+        auto const const_4 = _mm256_set1_pd(4);
+
+        for (std::size_t i = 0; i < points.size(); i += 4) {
+            // The last batch is padded with copies of the last point
+            std::array<Complex, 4> batch;
+            for (std::size_t lane = 0; lane < 4; ++lane) {
+                batch[lane] = points[std::min(i + lane, points.size() - 1)];
+            }
+
+            auto const pixel_real = _mm256_set_pd(batch[3].real, batch[2].real, batch[1].real, batch[0].real);
+            auto const pixel_imag = _mm256_set_pd(batch[3].imag, batch[2].imag, batch[1].imag, batch[0].imag);
+
+            __m256d z_real;
+            __m256d z_imag;
+            __m256d c_real;
+            __m256d c_imag;
+            Formula::start(pixel_real, pixel_imag, z_real, z_imag, c_real, c_imag);
+            auto z_real2 = _mm256_mul_pd(z_real, z_real);
+            auto z_imag2 = _mm256_mul_pd(z_imag, z_imag);
+            auto counts = const_0;
+            auto active = _mm256_cmp_pd(const_0, const_0, _CMP_EQ_OQ);
+
+            // Counts the iterations of each lane until it escapes, like iterate_double()
+            for (int64_t iteration = 0; iteration < m_max_iterations_local; ++iteration) {
+                auto const abs = _mm256_add_pd(z_real2, z_imag2);
+                active = _mm256_and_pd(active, _mm256_cmp_pd(abs, const_4, _CMP_LT_OQ));
+                if (_mm256_testz_pd(active, active)) {
+                    break;
+                }
+                counts = _mm256_add_pd(counts, _mm256_and_pd(active, const_1));
+
+                Formula::step(z_real, z_imag, z_real2, z_imag2, c_real, c_imag);
+
+                z_real2 = _mm256_mul_pd(z_real, z_real);
+                z_imag2 = _mm256_mul_pd(z_imag, z_imag);
+            }
+
+            alignas(32) std::array<double, 4> lane_counts;
+            _mm256_store_pd(lane_counts.data(), counts);
+            for (std::size_t lane = 0; lane < 4 && i + lane < points.size(); ++lane) {
+                iterations[i + lane] = static_cast<uint32_t>(lane_counts[lane]);
+            }
+        }
+    }
+
+    // Iteration counts of row 0, for mirrored chunks
+    std::vector<uint32_t> compute_first_row()
+    {
+        auto const pixel_delta = m_complex_size / chunk_size;
+        std::vector<Complex> points(chunk_size);
+        for (int64_t x = 0; x < chunk_size; ++x) {
+            points[x] = Complex{.real = m_position.real + x * pixel_delta, .imag = m_position.imag};
+        }
+
+        std::vector<uint32_t> iterations(chunk_size);
+        with_formula(m_formula, [&]<typename Formula>() {
+#ifdef __AVX__
+            compute_points_avx_double<Formula>(points, iterations);
+#else
+            compute_points_double<Formula>(points, iterations);
+#endif
+        });
+        m_iteration_count += std::accumulate(iterations.begin(), iterations.end(), uint64_t{0});
+        return iterations;
+    }
+
+    // Row 0 of a chunk whose other rows have mirrored iteration counts and surfaces, computed into m_buffer and m_surface
+    void compute_first_row_with_surface()
+    {
+        auto const pixel_delta = m_complex_size / chunk_size;
+        with_formula(m_formula, [&]<typename Formula>() {
+            for (int64_t x = 0; x < chunk_size; ++x) {
+                auto const pixel = Complex{.real = m_position.real + x * pixel_delta, .imag = m_position.imag};
+                m_buffer[x].color = iterate_double<Formula, true>(pixel, &m_surface[x]);
+                m_iteration_count += m_buffer[x].color;
+            }
+        });
+    }
+
+    // The other rows already have their final colors. Without the rows below, the boundary pixels are not known, so the
+    // whole row is anti-aliased.
+    void compute_mirrored_first_row()
+    {
+        auto const iterations = compute_first_row();
+        for (int64_t x = 0; x < chunk_size; ++x) {
+            m_buffer[x] = sample_color(iterations[x], 1.0f);
+        }
+
+        if (m_antialiasing_samples > 0) {
+            std::vector<uint32_t> first_row(chunk_size);
+            std::iota(first_row.begin(), first_row.end(), 0);
+            supersample(first_row);
+        }
+    }
+
+    void count_iterations()
+    {
+        for (int64_t y = 0; y < chunk_size; y += m_sample_step) {
+            for (int64_t x = 0; x < chunk_size; x += m_sample_step) {
+                auto const iterations = m_buffer[y * chunk_size + x].color;
+                m_iteration_count += iterations;
+                m_bounded_count += iterations == m_max_iterations_local;
+            }
+        }
+    }
+
+    // While a noticeable share of the samples escapes in the upper half of the limit, more of the bounded samples would
+    // escape with more iterations. The limit is then doubled and only the bounded samples are iterated further, resuming
+    // from the state the previous limit left them in.
+    template <typename Formula>
+    void extend_iterations()
+    {
+        auto const highest_limit = m_color_iterations * max_adaptive_iterations_factor;
+        while (m_max_iterations_local < highest_limit && !m_bounded_samples.empty()) {
+            int64_t late_escapes = 0;
+            int64_t sample_count = 0;
+            for (int64_t y = 0; y < chunk_size; y += m_sample_step) {
+                for (int64_t x = 0; x < chunk_size; x += m_sample_step) {
+                    auto const iterations = m_buffer[y * chunk_size + x].color;
+                    if (iterations != m_max_iterations_local && iterations * 2 >= m_max_iterations_local) {
+                        ++late_escapes;
+                    }
+                    ++sample_count;
+                }
+            }
+            if (late_escapes < adaptive_late_escape_fraction * sample_count || late_escapes < adaptive_late_escape_yield * m_bounded_samples.size()) {
+                break;
+            }
+
+            auto const previous_limit = m_max_iterations_local;
+            m_max_iterations_local = std::min(m_max_iterations_local * 2, highest_limit);
+
+            std::vector<uint32_t> iterations(m_bounded_samples.size());
+            if (computes_surface()) {
+                for (std::size_t i = 0; i < m_bounded_samples.size(); ++i) {
+                    auto& sample = m_bounded_samples[i];
+                    iterations[i] = resume_double<Formula, true>(sample.z, sample.dz, sample.c, previous_limit, &m_surface[sample.buffer_position]);
+                }
+            } else {
+#ifdef __AVX__
+                resume_avx_double<Formula>(m_bounded_samples, previous_limit, iterations);
+#else
+                for (std::size_t i = 0; i < m_bounded_samples.size(); ++i) {
+                    auto& sample = m_bounded_samples[i];
+                    iterations[i] = resume_double<Formula>(sample.z, sample.dz, sample.c, previous_limit);
+                }
+#endif
+            }
+
+            // The iterations up to the previous limit were already counted
+            std::size_t still_bounded = 0;
+            for (std::size_t i = 0; i < m_bounded_samples.size(); ++i) {
+                m_buffer[m_bounded_samples[i].buffer_position].color = iterations[i];
+                m_iteration_count += iterations[i] - previous_limit;
+                if (iterations[i] == m_max_iterations_local) {
+                    m_bounded_samples[still_bounded++] = m_bounded_samples[i];
+                }
+            }
+            m_bounded_samples.resize(still_bounded);
+            m_bounded_count = still_bounded;
+        }
+        m_bounded_samples = {};
+    }
+
+    // Nearest neighbour upscale of the sparsely computed samples to the full chunk
+    template <typename T>
+    void scale(std::span<T> samples)
+    {
+        for (int32_t buffer_position = samples.size() - 1; buffer_position > 0; --buffer_position) {
+            auto target_x = buffer_position % chunk_size;
+            auto target_y = buffer_position / chunk_size;
+            auto source_x = target_x - target_x % m_sample_step;
+            auto source_y = target_y - target_y % m_sample_step;
+            auto source_buffer_position = source_x + source_y * chunk_size;
+            samples[buffer_position] = samples[source_buffer_position];
+        }
+    }
+
+    // Color of a single sample. shade is the diffuse lighting factor of the pixel the sample belongs to, only used by Phong shading.
+    // Adaptive chunks iterate past the color range of their zoom level, the colors then repeat
+    template <typename T>
+    [[nodiscard]] static T wrap_color_ratio(T ratio)
+    {
+        return ratio > 1 ? ratio - std::floor(ratio) : ratio;
+    }
+
+    [[nodiscard]] Color sample_color(uint32_t iterations, float shade) const
+    {
+        return iteration_color(m_color_function, iterations, m_color_iterations, iterations == m_max_iterations_local, shade);
+    }
+
+    void colorize(std::span<uint32_t const> iterations)
+    {
+        for (std::size_t buffer_position = 0; buffer_position < m_buffer.size(); ++buffer_position) {
+            auto const shade = uses_surface() ? phong_shade(buffer_position) : 1.0f;
+            m_buffer[buffer_position] = sample_color(iterations[buffer_position], shade);
+        }
+    }
+
+    struct Vec3 {
+        float x;
+        float y;
+
+        // Positive in direction towards viewer
+        float z;
+
+        float operator*(Vec3 const& other) const
+        {
+            return x * other.x + y * other.y + z * other.z;
+        };
+
+        [[nodiscard]] Vec3 normalize() const
+        {
+            auto length = sqrt(x * x + y * y + z * z);
+            return Vec3{
+                .x = x / length,
+                .y = y / length,
+                .z = z / length,
+            };
+        }
+    };
+
+    [[nodiscard]] float phong_shade(std::size_t buffer_position) const
+    {
+        return phong_shade(m_surface[buffer_position].normal_x, m_surface[buffer_position].normal_y);
+    }
+
+    [[nodiscard]] static SurfaceSample surface_sample(Complex z, Complex dz)
+    {
+        // z / dz has the direction of z * conj(dz), both are normalized first because dz grows quickly
+        auto const z_abs = std::hypot(z.real, z.imag);
+        auto const dz_abs = std::hypot(dz.real, dz.imag);
+        auto const direction_real = (z.real * dz.real + z.imag * dz.imag) / (z_abs * dz_abs);
+        auto const direction_imag = (z.imag * dz.real - z.real * dz.imag) / (z_abs * dz_abs);
+        auto const log_z_abs = std::log(z_abs);
+        auto const distance = 2 * z_abs * log_z_abs / dz_abs;
+        if (!std::isfinite(direction_real) || !std::isfinite(direction_imag) || !std::isfinite(distance)) {
+            return SurfaceSample{.normal_x = 0, .normal_y = 0, .distance = 0, .log_z_abs = static_cast<float>(log_z_abs)};
+        }
+
+        return SurfaceSample{
+            .normal_x = static_cast<float>(direction_real),
+            .normal_y = static_cast<float>(direction_imag),
+            .distance = static_cast<float>(distance),
+            .log_z_abs = static_cast<float>(log_z_abs),
+        };
+    }
+
+    // Every escape count n is spread over [n, n + 1] by how far |z| got past the escape radius 2, which grows to the
+    // power of the degree in every iteration. Neighbouring pixels that escape one iteration apart then meet at the same
+    // value, so palettes of the field have no bands.
+    template <typename Formula>
+    void store_field()
+    {
+        m_field.resize(m_buffer.size());
+        auto const log_escape_radius = std::log(2.0f);
+        auto const log_degree = std::log(static_cast<float>(Formula::DEGREE));
+        for (std::size_t buffer_position = 0; buffer_position < m_buffer.size(); ++buffer_position) {
+            auto const iterations = m_buffer[buffer_position].color;
+            auto const& surface = m_surface[buffer_position];
+            if (iterations == m_max_iterations_local) {
+                m_field[buffer_position] = FieldSample{.iterations = std::numeric_limits<float>::infinity(), .distance = 0, .normal_x = 0, .normal_y = 0};
+                continue;
+            }
+
+            auto const fraction = std::clamp(1.0f - std::log(surface.log_z_abs / log_escape_radius) / log_degree, 0.0f, 1.0f);
+            m_field[buffer_position] = FieldSample{
+                .iterations = static_cast<float>(iterations) + fraction,
+                .distance = surface.distance,
+                .normal_x = surface.normal_x,
+                .normal_y = surface.normal_y,
+            };
+        }
+    }
+
+    // Adaptive supersampling: only boundary pixels, whose iteration count differs from a neighbour by more than
+    // antialiasing_threshold, get m_antialiasing_samples extra jittered samples. So the cost grows with the length of the
+    // boundaries instead of the chunk area. The samples are averaged with the base sample in linear color.
+    // With distance estimates, exterior pixels within antialiasing_distance pixels of the set are boundary pixels too,
+    // which catches filaments that are thinner than a pixel and missed by all samples.
+    void antialias(std::span<uint32_t const> iterations)
+    {
+        std::vector<bool> is_boundary(m_buffer.size());
+        auto const compare = [&](std::size_t a, std::size_t b) {
+            auto const difference = iterations[a] > iterations[b] ? iterations[a] - iterations[b] : iterations[b] - iterations[a];
+            if (difference > antialiasing_threshold) {
+                is_boundary[a] = true;
+                is_boundary[b] = true;
+            }
+        };
+
+        for (int64_t y = 0; y < chunk_size; ++y) {
+            for (int64_t x = 0; x < chunk_size; ++x) {
+                auto const buffer_position = y * chunk_size + x;
+                if (x < chunk_size - 1) {
+                    compare(buffer_position, buffer_position + 1);
+                }
+                if (y < chunk_size - 1) {
+                    compare(buffer_position, buffer_position + chunk_size);
+                }
+            }
+        }
+
+        if (uses_surface()) {
+            auto const max_distance = static_cast<float>(antialiasing_distance * m_complex_size / chunk_size);
+            for (std::size_t buffer_position = 0; buffer_position < m_surface.size(); ++buffer_position) {
+                auto const distance = m_surface[buffer_position].distance;
+                if (distance > 0 && distance < max_distance) {
+                    is_boundary[buffer_position] = true;
+                }
+            }
+        }
+
+        std::vector<uint32_t> boundary_pixels;
+        for (uint32_t buffer_position = 0; buffer_position < m_buffer.size(); ++buffer_position) {
+            if (is_boundary[buffer_position]) {
+                boundary_pixels.push_back(buffer_position);
+            }
+        }
+
+        supersample(boundary_pixels);
+    }
+
+    // Averages m_antialiasing_samples jittered samples into each of the pixels
+    void supersample(std::span<uint32_t const> boundary_pixels)
+    {
+        if (boundary_pixels.empty()) {
+            return;
+        }
+
+        // The offsets follow the R2 low discrepancy sequence, rotated by a hash of the pixel so neighbouring pixels do not share one pattern
+        auto const pixel_delta = m_complex_size / chunk_size;
+        auto const fraction = [](double value) { return value - std::floor(value); };
+        std::vector<Complex> points;
+        points.reserve(boundary_pixels.size() * m_antialiasing_samples);
+        for (auto const buffer_position : boundary_pixels) {
+            auto hash = buffer_position * 0x9e3779b9u;
+            hash = (hash ^ (hash >> 16)) * 0x85ebca6bu;
+            hash ^= hash >> 13;
+            auto const rotation_x = (hash & 0xffff) / 65536.0;
+            auto const rotation_y = (hash >> 16) / 65536.0;
+
+            auto const x = static_cast<double>(buffer_position % chunk_size);
+            auto const y = static_cast<double>(buffer_position / chunk_size);
+            for (int64_t sample = 1; sample <= m_antialiasing_samples; ++sample) {
+                points.push_back(Complex{
+                    .real = m_position.real + (x + fraction(rotation_x + sample * 0.7548776662466927)) * pixel_delta,
+                    .imag = m_position.imag + (y + fraction(rotation_y + sample * 0.5698402909980532)) * pixel_delta,
+                });
+            }
+        }
+
+        std::vector<uint32_t> sample_iterations(points.size());
+        with_formula(m_formula, [&]<typename Formula>() {
+#ifdef __AVX__
+            compute_points_avx_double<Formula>(points, sample_iterations);
+#else
+            compute_points_double<Formula>(points, sample_iterations);
+#endif
+        });
+        m_iteration_count += std::accumulate(sample_iterations.begin(), sample_iterations.end(), uint64_t{0});
+
+        auto const sample_count = static_cast<float>(m_antialiasing_samples + 1);
+        for (std::size_t i = 0; i < boundary_pixels.size(); ++i) {
+            auto const buffer_position = boundary_pixels[i];
+            auto const shade = uses_surface() ? phong_shade(buffer_position) : 1.0f;
+
+            auto const& base_color = m_buffer[buffer_position];
+            auto r = srgb_to_linear(base_color.r);
+            auto g = srgb_to_linear(base_color.g);
+            auto b = srgb_to_linear(base_color.b);
+            for (int64_t sample = 0; sample < m_antialiasing_samples; ++sample) {
+                auto const color = sample_color(sample_iterations[i * m_antialiasing_samples + sample], shade);
+                r += srgb_to_linear(color.r);
+                g += srgb_to_linear(color.g);
+                b += srgb_to_linear(color.b);
+            }
+
+            m_buffer[buffer_position] = Color{
+                linear_to_srgb(r / sample_count),
+                linear_to_srgb(g / sample_count),
+                linear_to_srgb(b / sample_count),
+            };
+        }
+    }
+};
+Complex screen_space_to_mandelbrot_space(ScreenPosition screen_position, double chunk_resolution);
+ScreenPosition mandelbrot_space_to_screen_space(Complex mandelbrot_position, double chunk_resolution);
+
+// Width and height of a chunk in mandelbrot space at the given zoom level, each level zooms in by a factor of 1 / 0.9.
+// The size of a pixel only depends on the zoom level, so views look the same with every chunk_size.
+double zoom_level_to_chunk_resolution(double zoom_level);
+// Iteration limits of the chunks drawn by the last render(). Iterations are saved compared to computing all drawn chunks
+// with the highest limit among them, which only costs more for the samples that never escape.
+struct ViewIterations {
+    int64_t highest_limit{0};
+    uint64_t computed_iterations{0};
+    uint64_t saved_iterations{0};
+};
+
+// Counters for the performance HUD. The atomic ones are written by the worker threads, the others under the cache lock.
+struct RenderStatistics {
+    std::atomic<uint64_t> computed_chunks{0};
+    std::atomic<uint64_t> computed_iterations{0};
+    std::atomic<int32_t> busy_workers{0};
+    uint64_t cache_hits{0};
+    uint64_t cache_misses{0};
+    uint64_t evicted_chunks{0};
+};
+
+// What a view or request renders, everything else about a chunk is its position in the grid
+struct RenderParameters {
+    std::size_t formula = 0;
+    int64_t max_iterations = 1000;
+    std::size_t color_function = 3;
+    int64_t antialiasing_samples = default_antialiasing_samples;
+
+    // The limit chunks start with, which is derived from the zoom level with auto_iterations
+    [[nodiscard]] int64_t base_max_iterations(double chunk_resolution) const
+    {
+        return max_iterations == auto_iterations ? auto_max_iterations(chunk_resolution / chunk_size) : max_iterations;
+    }
+};
+
+// An image of width * height pixels of pixel_size each, starting at top_left in mandelbrot space. Posters, fields and
+// viewport requests are described by one.
+struct ViewportParameters {
+    int64_t width;
+    int64_t height;
+    Complex top_left;
+    double pixel_size;
+    std::size_t formula;
+    int64_t max_iterations;
+    std::size_t color_function;
+    int64_t antialiasing_samples;
+
+    static ViewportParameters from_center(Complex center, double real_span, int64_t width, int64_t height, std::size_t formula, int64_t max_iterations, std::size_t color_function, int64_t antialiasing_samples)
+    {
+        auto const pixel_size = real_span / width;
+        return ViewportParameters{
+            .width = width,
+            .height = height,
+            .top_left = Complex{
+                .real = center.real - pixel_size * width / 2,
+                .imag = center.imag - pixel_size * height / 2,
+            },
+            .pixel_size = pixel_size,
+            .formula = formula,
+            .max_iterations = max_iterations,
+            .color_function = color_function,
+            .antialiasing_samples = antialiasing_samples,
+        };
+    }
+
+    [[nodiscard]] RenderParameters render_parameters() const
+    {
+        return RenderParameters{
+            .formula = formula,
+            .max_iterations = max_iterations,
+            .color_function = color_function,
+            .antialiasing_samples = antialiasing_samples,
+        };
+    }
+};
+
+// The chunks that cover an image, in bands of one row of chunks
+struct BandLayout {
+    double chunk_resolution;
+    ChunkGridPosition top_left_chunk_position;
+    ScreenPosition chunk_offset; // Of the top left chunk relative to the image
+    int64_t chunk_x_count;
+    int64_t band_count;
+
+    static BandLayout create(ViewportParameters const& parameters)
+    {
+        auto const top_left_global = ScreenPosition{
+            .x = std::llround(parameters.top_left.real / parameters.pixel_size),
+            .y = std::llround(parameters.top_left.imag / parameters.pixel_size),
+        };
+        auto const top_left_chunk_position = ChunkGridPosition{
+            static_cast<int64_t>(std::floor(static_cast<double>(top_left_global.x) / chunk_size)),
+            static_cast<int64_t>(std::floor(static_cast<double>(top_left_global.y) / chunk_size)),
+        };
+        auto const chunk_offset = ScreenPosition{
+            .x = top_left_chunk_position.real * chunk_size - top_left_global.x,
+            .y = top_left_chunk_position.imag * chunk_size - top_left_global.y,
+        };
+        return BandLayout{
+            .chunk_resolution = parameters.pixel_size * chunk_size,
+            .top_left_chunk_position = top_left_chunk_position,
+            .chunk_offset = chunk_offset,
+            .chunk_x_count = (parameters.width - chunk_offset.x + chunk_size - 1) / chunk_size,
+            .band_count = (parameters.height - chunk_offset.y + chunk_size - 1) / chunk_size,
+        };
+    }
+
+    // Image row of the top of the band, which may be above the image for the first band
+    [[nodiscard]] int64_t band_top(int64_t band_index) const
+    {
+        return band_index * chunk_size + chunk_offset.y;
+    }
+};
+
+// The image of a viewport or tile request. A cancelled request delivers the chunks that were ready until then.
+struct RenderResult {
+    Buffer image;
+    bool cancelled{false};
+};
+
+// Called on a pool thread, or on the requesting thread if every chunk was cached. It must not call back into the Mandelbrot.
+using RenderCallback = std::function<void(RenderResult const&)>;
+
+struct RenderTicket {
+    uint64_t id;
+    std::future<RenderResult> result; // Ready after the callback returned
+};
+
+struct Mandelbrot {
+    Mandelbrot() = default;
+    // The pool threads refer to the engine, so it can neither be copied nor moved
+    Mandelbrot(Mandelbrot const&) = delete;
+    Mandelbrot& operator=(Mandelbrot const&) = delete;
+    // Joins the thread pool if it is still running
+    ~Mandelbrot();
+
+    // Draws the chunks at top_left_global of the chunk grid with chunk_resolution into buffer, and enqueues the missing ones.
+    // Chunks that are not ready at sample_step are replaced by reduced ones or default_color. Thread safe, so several
+    // views can be rendered from one cache. Returns true if every visible chunk was ready at full resolution.
+    bool render(Buffer& buffer, ScreenPosition top_left_global, double chunk_resolution, int64_t sample_step, RenderParameters const& parameters);
+
+    // Asynchronous requests for a full resolution image, which is delivered to callback and to the returned future once
+    // all of its chunks are computed. The chunks go through the cache, so they are shared with render() and other requests.
+    // The whole image is kept in memory, exports larger than the cache use the background queue instead, see
+    // enqueue_background().
+    RenderTicket request_viewport(ViewportParameters const& viewport, RenderCallback callback = {});
+
+    // A single chunk of the grid
+    RenderTicket request_tile(double chunk_resolution, ChunkGridPosition position, RenderParameters const& parameters, RenderCallback callback = {});
+
+    // Delivers the request with cancelled set, unless it is already finished. Its chunks are still computed and cached.
+    void cancel(uint64_t request_id);
+
+    void create_thread_pool();
+    void destroy_thread_pool();
+
+    // Evicts the least recently used chunks while the cache is larger than max_chunk_memory
+    void invalidate_cache();
+
+    // Drops all chunks and cancels the pending requests
+    void clear_cache();
+
+    // Low priority work outside of the chunk cache, only picked up when no chunks for the view are queued.
+    // The caller owns the chunks and has to keep them alive until wait_for_chunks() returned.
+    void enqueue_background(std::span<Chunk> chunks);
+
+    // Work that is not a chunk. Tasks should be short, since queued chunks wait for the running ones. Queued tasks are
+    // dropped when the pool is destroyed, so they must not own anything the caller waits for.
+    void enqueue_task(std::function<void()> task);
+
+    void wait_for_chunks(std::span<Chunk const> chunks);
+
+    [[nodiscard]] RenderStatistics const& statistics() const
+    {
+        return m_statistics;
+    }
+
+    // Only valid on the thread that calls render()
+    [[nodiscard]] ViewIterations const& view_iterations() const
+    {
+        return m_view_iterations;
+    }
+
+    [[nodiscard]] std::size_t thread_pool_size() const
+    {
+        return m_threads.size();
+    }
+
+    [[nodiscard]] std::size_t queue_size()
+    {
+        std::lock_guard<std::mutex> lock{m_queue_mutex};
+        return m_chunk_queue.size();
+    }
+
+    [[nodiscard]] std::size_t resident_chunk_count() const
+    {
+        return m_chunks.size();
+    }
+
+private:
+    struct ChunkIdentifier {
+        double chunk_resolution;
+        ChunkGridPosition chunk_grid_position;
+        std::size_t formula;
+        int64_t max_iterations;
+        std::size_t color_function;
+        int64_t sample_step;
+        int64_t antialiasing_samples;
+
+        static ChunkIdentifier create(double chunk_resolution, ChunkGridPosition position, RenderParameters const& parameters, int64_t sample_step)
+        {
+            return ChunkIdentifier{
+                .chunk_resolution = chunk_resolution,
+                .chunk_grid_position = position,
+                .formula = parameters.formula,
+                .max_iterations = parameters.max_iterations,
+                .color_function = parameters.color_function,
+                .sample_step = sample_step,
+                .antialiasing_samples = parameters.antialiasing_samples,
+            };
+        }
+
+        bool operator==(ChunkIdentifier const& other) const = default;
+    };
+
+    struct HashChunkIdentifier {
+        std::size_t operator()(ChunkIdentifier const& id) const
+        {
+            return ((((std::hash<double>()(id.chunk_resolution)
+                          ^ (std::hash<ChunkGridPosition>()(id.chunk_grid_position) << 1))
+                         >> 1)
+                        ^ (std::hash<int64_t>()(id.max_iterations) << 1))
+                       >> 1)
+                ^ (std::hash<std::size_t>()(id.color_function) << 1)
+                ^ (std::hash<int64_t>()(id.sample_step) << 2)
+                ^ (std::hash<int64_t>()(id.antialiasing_samples) << 3)
+                ^ (std::hash<std::size_t>()(id.formula) << 4);
+        }
+    };
+
+    struct ChunkCacheListItem {
+        ChunkIdentifier identifier;
+        Chunk const* chunk;
+    };
+
+    struct PendingRequest {
+        Buffer image;
+        std::size_t remaining_chunks{0};
+        std::vector<uint64_t> waited_chunks; // Trace ids
+        std::promise<RenderResult> promise;
+        RenderCallback callback;
+    };
+
+    // The requests a chunk is blitted into once it is ready. Chunks with waiters are not evicted.
+    struct ChunkWaiters {
+        Chunk const* chunk;
+        std::vector<std::pair<uint64_t, ScreenPosition>> requests; // Request id and position of the chunk in its image
+    };
+
+    // Shared with the worker processes and referenced by cached chunks, so it has to outlive m_chunks
+    std::optional<SharedChunkArena> m_arena;
+    std::vector<std::size_t> m_scratch_slots; // One per worker process, for chunks that do not live in the arena
+
+    std::unordered_map<ChunkIdentifier, Chunk, HashChunkIdentifier> m_chunks;
+    std::size_t m_access_time{0}; // Incremented by every render() and request, guarded by m_cache_mutex
+
+    std::queue<std::reference_wrapper<Chunk>> m_chunk_queue;
+    std::queue<std::reference_wrapper<Chunk>> m_background_queue;
+    std::queue<std::function<void()>> m_task_queue;
+    std::mutex m_queue_mutex;
+    std::condition_variable m_queue_convar;
+    std::mutex m_done_mutex;
+    std::condition_variable m_done_convar;
+    std::vector<std::thread> m_threads;
+    bool m_threads_running{true};
+
+    // Locked before m_queue_mutex and m_request_mutex, which are never held together
+    std::mutex m_cache_mutex;
+
+    std::unordered_map<uint64_t, PendingRequest> m_requests; // By request id, guarded by m_request_mutex
+    std::unordered_map<uint64_t, ChunkWaiters> m_chunk_waiters; // By trace id, guarded by m_request_mutex
+    uint64_t m_next_request_id{0};
+    std::mutex m_request_mutex;
+
+    std::unordered_map<uint64_t, int32_t> m_failed_attempts; // By trace id, guarded by m_queue_mutex
+    RenderStatistics m_statistics;
+    ViewIterations m_view_iterations;
+
+    void create_arena();
+    void release_arena_slot(Chunk const& chunk);
+    void evict_chunks();
+
+    RenderTicket submit(Buffer image, BandLayout const& layout, RenderParameters const& parameters, RenderCallback callback);
+    void complete_requests(uint64_t trace_id);
+    static void deliver(PendingRequest& request, bool cancelled);
+
+    // A chunk that waits for this one is copied from it before either is published, so the source is not evicted meanwhile
+    void compute_with_mirror(Chunk& chunk);
+
+    // Chunks in the arena are written in place, all others go through the scratch slot of the worker
+    bool compute_remotely(RemoteWorker& remote_worker, Chunk& chunk, std::size_t scratch_slot);
+
+    // A worker process crashed or hung on the chunk, give it to another one unless it keeps failing
+    void retry_or_abandon(std::reference_wrapper<Chunk> chunk, std::queue<std::reference_wrapper<Chunk>>& queue);
+
+    // Returns the best ready chunk with at most interaction_sample_step, and enqueues the chunk at the requested sample step if it is not ready yet
+    Chunk* get_or_create_chunk(double chunk_resolution, ChunkGridPosition position, int64_t sample_step, RenderParameters const& parameters);
+
+    bool enqueue_chunk(ChunkIdentifier identifier);
+    Chunk& insert_and_queue_chunk(ChunkIdentifier identifier);
+
+    // The cached chunk on the other side of the real axis, if the formula is symmetric. Only full resolution chunks are
+    // mirrored, because the rows of the reduced ones would not line up. Chunks of worker processes are never mirrored,
+    // their iteration counts stay in the worker.
+    Chunk* find_mirror(ChunkIdentifier identifier);
+};
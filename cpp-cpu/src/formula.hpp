@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <immintrin.h>
+#include <string_view>
+
+// Fractal formulas as policy types. The kernels in Chunk are instantiated once per formula and per vector type,
+// so there is no branching on the formula inside the iteration loop.
+//
+// Every formula provides, for T = double and T = __m256d:
+//   start(pixel, z, c): the initial z and the constant c for the pixel
+//   step(z, z², c): one iteration, z² is the component-wise square of z, which the kernel already needs for the escape check
+//   derivative_step(z, dz): advances dz = dz_n/dc (dz_n/dz_0 for Julia sets) from z_n, before step() advances z.
+//     dz starts at DERIVATIVE_START, it is used for distance estimation and analytic normals.
+// and CONJUGATE_SYMMETRIC, which is true if the iteration count at conj(pixel) always equals the one at pixel, and DEGREE,
+// the power of z in step(), which sets how fast |z| grows after the escape for fractional escape counts.
+
+template <typename T>
+T splat(double value);
+
+template <>
+inline double splat<double>(double value)
+{
+    return value;
+}
+
+template <>
+inline __m256d splat<__m256d>(double value)
+{
+    return _mm256_set1_pd(value);
+}
+
+inline double absolute(double value)
+{
+    return std::abs(value);
+}
+
+inline __m256d absolute(__m256d value)
+{
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.0), value);
+}
+
+// value with its sign flipped where sign_source is negative
+inline double multiply_sign(double value, double sign_source)
+{
+    return std::signbit(sign_source) ? -value : value;
+}
+
+inline __m256d multiply_sign(__m256d value, __m256d sign_source)
+{
+    return _mm256_xor_pd(value, _mm256_and_pd(_mm256_set1_pd(-0.0), sign_source));
+}
+
+// z^Degree + c, starting at z = 0 with c = pixel. Degree 2 is the Mandelbrot set.
+template <int Degree>
+struct MultibrotFormula {
+    static_assert(Degree >= 2 && Degree <= 4, "Add a name for the degree");
+
+    static constexpr std::string_view NAME = Degree == 2 ? "mandelbrot" : Degree == 3 ? "multibrot z^3" : "multibrot z^4";
+    static constexpr bool CONJUGATE_SYMMETRIC = true;
+    static constexpr double DERIVATIVE_START = 0;
+    static constexpr int DEGREE = Degree;
+
+    template <typename T>
+    static void start(T pixel_real, T pixel_imag, T& z_real, T& z_imag, T& c_real, T& c_imag)
+    {
+        z_real = splat<T>(0);
+        z_imag = splat<T>(0);
+        c_real = pixel_real;
+        c_imag = pixel_imag;
+    }
+
+    // Degree * z^(Degree - 1) * dz + 1
+    template <typename T>
+    static void derivative_step(T z_real, T z_imag, T& dz_real, T& dz_imag)
+    {
+        auto power_real = z_real;
+        auto power_imag = z_imag;
+        for (int i = 2; i < Degree; ++i) {
+            auto const next_real = power_real * z_real - power_imag * z_imag;
+            power_imag = power_real * z_imag + power_imag * z_real;
+            power_real = next_real;
+        }
+        auto const next_real = splat<T>(Degree) * (power_real * dz_real - power_imag * dz_imag) + splat<T>(1);
+        dz_imag = splat<T>(Degree) * (power_real * dz_imag + power_imag * dz_real);
+        dz_real = next_real;
+    }
+
+    template <typename T>
+    static void step(T& z_real, T& z_imag, T z_real2, T z_imag2, T c_real, T c_imag)
+    {
+        if constexpr (Degree == 2) {
+            z_imag = 2 * (z_real * z_imag) + c_imag;
+            z_real = z_real2 - z_imag2 + c_real;
+        } else {
+            auto power_real = z_real;
+            auto power_imag = z_imag;
+            for (int i = 1; i < Degree; ++i) {
+                auto const next_real = power_real * z_real - power_imag * z_imag;
+                power_imag = power_real * z_imag + power_imag * z_real;
+                power_real = next_real;
+            }
+            z_real = power_real + c_real;
+            z_imag = power_imag + c_imag;
+        }
+    }
+};
+
+// z^2 + c with a fixed c, starting at z = pixel
+template <double Real, double Imag>
+struct JuliaFormula {
+    static constexpr std::string_view NAME = "julia";
+    static constexpr bool CONJUGATE_SYMMETRIC = Imag == 0;
+    static constexpr double DERIVATIVE_START = 1;
+    static constexpr int DEGREE = 2;
+
+    template <typename T>
+    static void start(T pixel_real, T pixel_imag, T& z_real, T& z_imag, T& c_real, T& c_imag)
+    {
+        z_real = pixel_real;
+        z_imag = pixel_imag;
+        c_real = splat<T>(Real);
+        c_imag = splat<T>(Imag);
+    }
+
+    // 2 * z * dz, c does not depend on the pixel
+    template <typename T>
+    static void derivative_step(T z_real, T z_imag, T& dz_real, T& dz_imag)
+    {
+        auto const next_real = splat<T>(2) * (z_real * dz_real - z_imag * dz_imag);
+        dz_imag = splat<T>(2) * (z_real * dz_imag + z_imag * dz_real);
+        dz_real = next_real;
+    }
+
+    template <typename T>
+    static void step(T& z_real, T& z_imag, T z_real2, T z_imag2, T c_real, T c_imag)
+    {
+        z_imag = 2 * (z_real * z_imag) + c_imag;
+        z_real = z_real2 - z_imag2 + c_real;
+    }
+};
+
+// (|Re z| + i|Im z|)^2 + c, starting at z = 0 with c = pixel
+struct BurningShipFormula {
+    static constexpr std::string_view NAME = "burning ship";
+    static constexpr bool CONJUGATE_SYMMETRIC = false; // The absolute values break the symmetry
+    static constexpr double DERIVATIVE_START = 0;
+    static constexpr int DEGREE = 2;
+
+    template <typename T>
+    static void start(T pixel_real, T pixel_imag, T& z_real, T& z_imag, T& c_real, T& c_imag)
+    {
+        MultibrotFormula<2>::start(pixel_real, pixel_imag, z_real, z_imag, c_real, c_imag);
+    }
+
+    // The step is not holomorphic, so this is the Jacobian applied to the direction of the real axis: the imaginary part
+    // of the derivative takes the sign of Re z * Im z
+    template <typename T>
+    static void derivative_step(T z_real, T z_imag, T& dz_real, T& dz_imag)
+    {
+        auto const next_real = splat<T>(2) * (z_real * dz_real - z_imag * dz_imag) + splat<T>(1);
+        dz_imag = multiply_sign(splat<T>(2) * (z_real * dz_imag + z_imag * dz_real), z_real * z_imag);
+        dz_real = next_real;
+    }
+
+    template <typename T>
+    static void step(T& z_real, T& z_imag, T z_real2, T z_imag2, T c_real, T c_imag)
+    {
+        z_imag = 2 * absolute(z_real * z_imag) + c_imag;
+        z_real = z_real2 - z_imag2 + c_real;
+    }
+};
+
+std::size_t constexpr formula_amount = 5;
+
+// Calls function.template operator()<Formula>() with the formula selected by the runtime key
+template <typename Function>
+decltype(auto) with_formula(std::size_t formula, Function&& function)
+{
+    switch (formula) {
+    case 1:
+        return function.template operator()<MultibrotFormula<3>>();
+    case 2:
+        return function.template operator()<MultibrotFormula<4>>();
+    case 3:
+        return function.template operator()<JuliaFormula<-0.8, 0.156>>();
+    case 4:
+        return function.template operator()<BurningShipFormula>();
+    default:
+        return function.template operator()<MultibrotFormula<2>>();
+    }
+}
+
+inline bool is_conjugate_symmetric(std::size_t formula)
+{
+    return with_formula(formula, []<typename Formula>() { return Formula::CONJUGATE_SYMMETRIC; });
+}
@@ -0,0 +1,220 @@
+#include "http_server.hpp"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cctype>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+int32_t constexpr max_connections = 64;
+std::size_t constexpr max_header_size = 8 * 1024;
+int constexpr idle_timeout_seconds = 30;
+
+HttpResponse HttpResponse::text(int status, std::string_view text)
+{
+    return HttpResponse{
+        .status = status,
+        .content_type = "text/plain",
+        .cache_control = "no-store",
+        .body = std::vector<uint8_t>(text.begin(), text.end()),
+    };
+}
+
+std::optional<std::string_view> query_parameter(std::string_view query, std::string_view name)
+{
+    while (!query.empty()) {
+        auto const end = query.find('&');
+        auto const pair = query.substr(0, end);
+        if (pair.size() > name.size() && pair.starts_with(name) && pair[name.size()] == '=') {
+            return pair.substr(name.size() + 1);
+        }
+        query = end == std::string_view::npos ? std::string_view{} : query.substr(end + 1);
+    }
+    return {};
+}
+
+char const* status_text(int status)
+{
+    switch (status) {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Internal Server Error";
+    }
+}
+
+bool send_all(int socket, void const* data, std::size_t size)
+{
+    auto const* bytes = static_cast<uint8_t const*>(data);
+    while (size > 0) {
+        auto const sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool send_response(int socket, HttpResponse const& response, bool keep_alive)
+{
+    // The tile viewer may be opened from a file or another server
+    auto header = "HTTP/1.1 " + std::to_string(response.status) + " " + status_text(response.status) + "\r\n"
+        + "Content-Type: " + response.content_type + "\r\n"
+        + "Content-Length: " + std::to_string(response.body.size()) + "\r\n"
+        + "Cache-Control: " + response.cache_control + "\r\n"
+        + "Access-Control-Allow-Origin: *\r\n"
+        + (keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n")
+        + "\r\n";
+    return send_all(socket, header.data(), header.size()) && send_all(socket, response.body.data(), response.body.size());
+}
+
+// Returns false if the header is malformed
+bool parse_request(std::string_view header, HttpRequest& request, bool& keep_alive, bool& has_body)
+{
+    auto const request_line_end = header.find("\r\n");
+    auto const request_line = header.substr(0, request_line_end);
+    auto const method_end = request_line.find(' ');
+    auto const target_end = request_line.find(' ', method_end + 1);
+    if (method_end == std::string_view::npos || target_end == std::string_view::npos) {
+        return false;
+    }
+
+    request.method = request_line.substr(0, method_end);
+    auto const target = request_line.substr(method_end + 1, target_end - method_end - 1);
+    auto const query_start = target.find('?');
+    request.path = target.substr(0, query_start);
+    request.query = query_start == std::string_view::npos ? std::string_view{} : target.substr(query_start + 1);
+
+    auto const version = request_line.substr(target_end + 1);
+    keep_alive = version == "HTTP/1.1";
+    has_body = false;
+
+    // Header names are case insensitive, only the two that matter are looked at
+    auto fields = header.substr(request_line_end + 2);
+    while (!fields.empty()) {
+        auto const line_end = fields.find("\r\n");
+        auto const line = fields.substr(0, line_end);
+        auto lower = std::string{line};
+        for (auto& character : lower) {
+            character = static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+        }
+
+        if (lower.starts_with("connection:")) {
+            if (lower.find("close") != std::string::npos) {
+                keep_alive = false;
+            } else if (lower.find("keep-alive") != std::string::npos) {
+                keep_alive = true;
+            }
+        } else if ((lower.starts_with("content-length:") && lower.find_first_not_of(" 0", 15) != std::string::npos) || lower.starts_with("transfer-encoding:")) {
+            has_body = true;
+        }
+
+        fields = line_end == std::string_view::npos ? std::string_view{} : fields.substr(line_end + 2);
+    }
+    return true;
+}
+
+void handle_connection(int socket, HttpHandler const& handler)
+{
+    auto const timeout = timeval{.tv_sec = idle_timeout_seconds, .tv_usec = 0};
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string buffer;
+    char input[4096];
+    auto keep_alive = true;
+    while (keep_alive) {
+        // Pipelined requests may already be in the buffer
+        auto header_end = buffer.find("\r\n\r\n");
+        while (header_end == std::string::npos) {
+            if (buffer.size() > max_header_size) {
+                send_response(socket, HttpResponse::text(400, "Header too large\n"), false);
+                return;
+            }
+            auto const received = recv(socket, input, sizeof(input), 0);
+            if (received <= 0) {
+                return;
+            }
+            buffer.append(input, received);
+            header_end = buffer.find("\r\n\r\n");
+        }
+
+        HttpRequest request;
+        auto has_body = false;
+        if (!parse_request(std::string_view{buffer}.substr(0, header_end + 2), request, keep_alive, has_body)) {
+            send_response(socket, HttpResponse::text(400, "Malformed request\n"), false);
+            return;
+        }
+        buffer.erase(0, header_end + 4);
+
+        if (request.method != "GET" || has_body) {
+            send_response(socket, HttpResponse::text(405, "Only GET is supported\n"), false);
+            return;
+        }
+
+        if (!send_response(socket, handler(request), keep_alive)) {
+            return;
+        }
+    }
+}
+
+int serve_http(uint16_t port, HttpHandler const& handler)
+{
+    auto const listen_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_socket < 0) {
+        std::cerr << "Failed to create the server socket\n";
+        return 1;
+    }
+
+    int const reuse_address = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_address, sizeof(reuse_address));
+
+    auto address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_socket, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0 || listen(listen_socket, SOMAXCONN) != 0) {
+        std::cerr << "Failed to listen on 127.0.0.1:" << port << "\n";
+        close(listen_socket);
+        return 1;
+    }
+
+    std::cout << "Serving on http://127.0.0.1:" << port << "\n";
+
+    std::atomic<int32_t> connection_count{0};
+    while (true) {
+        auto const connection = accept4(listen_socket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            continue;
+        }
+
+        if (connection_count.load() >= max_connections) {
+            send_response(connection, HttpResponse::text(503, "Too many connections\n"), false);
+            close(connection);
+            continue;
+        }
+
+        // The threads only reference the handler and the counter, which live until the process exits
+        ++connection_count;
+        std::thread{[connection, &handler, &connection_count]() {
+            handle_connection(connection, handler);
+            close(connection);
+            --connection_count;
+        }}.detach();
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A minimal HTTP/1.1 server for the tile server mode, only GET requests without a body are supported.
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::string query; // Without the '?'
+};
+
+struct HttpResponse {
+    int status = 200;
+    std::string content_type = "text/plain";
+    std::string cache_control = "no-store";
+    std::vector<uint8_t> body;
+
+    static HttpResponse text(int status, std::string_view text);
+};
+
+using HttpHandler = std::function<HttpResponse(HttpRequest const&)>;
+
+// Serves on 127.0.0.1:port until the process is stopped. Every connection is handled by its own thread, so the handler
+// has to be thread safe and a slow response does not block other requests. Returns 1 if the port can not be bound.
+int serve_http(uint16_t port, HttpHandler const& handler);
+
+// The value of name in a query string like "a=1&b=2", values are not percent-decoded
+std::optional<std::string_view> query_parameter(std::string_view query, std::string_view name);
@@ -0,0 +1,151 @@
+#include "input_log.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+std::array<char const*, 5> const input_event_type_names = {
+    "resize",
+    "motion",
+    "button",
+    "axis",
+    "key",
+};
+
+struct InputRecorder {
+    FILE* out_file;
+    std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+
+    ~InputRecorder()
+    {
+        fclose(out_file);
+    }
+
+    void write(InputEventType type, int64_t a, int64_t b)
+    {
+        auto const time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        fprintf(out_file, "%ld %s %ld %ld\n", time, input_event_type_names[static_cast<std::size_t>(type)], a, b);
+        fflush(out_file);
+    }
+};
+
+bool record_input(Window& window, char const* filepath)
+{
+    FILE* out_file = fopen(filepath, "w");
+    if (!out_file) {
+        return false;
+    }
+
+    auto recorder = std::make_shared<InputRecorder>(out_file);
+
+    window.callback_window_resize = [recorder, callback = window.callback_window_resize](int width, int height) {
+        recorder->write(InputEventType::RESIZE, width, height);
+        callback(width, height);
+    };
+
+    window.callback_pointer_motion = [recorder, callback = window.callback_pointer_motion](int x, int y) {
+        recorder->write(InputEventType::POINTER_MOTION, x, y);
+        callback(x, y);
+    };
+
+    window.callback_pointer_button = [recorder, callback = window.callback_pointer_button](uint32_t button, wl_pointer_button_state state) {
+        recorder->write(InputEventType::POINTER_BUTTON, button, state);
+        callback(button, state);
+    };
+
+    window.callback_pointer_axis = [recorder, callback = window.callback_pointer_axis](wl_pointer_axis axis, int value) {
+        recorder->write(InputEventType::POINTER_AXIS, axis, value);
+        callback(axis, value);
+    };
+
+    window.callback_keyboard_key = [recorder, callback = window.callback_keyboard_key](Scancodes scancode, wl_keyboard_key_state state) {
+        recorder->write(InputEventType::KEYBOARD_KEY, static_cast<int64_t>(scancode), state);
+        callback(scancode, state);
+    };
+
+    return true;
+}
+
+std::optional<std::vector<InputEvent>> load_input_log(char const* filepath)
+{
+    FILE* in_file = fopen(filepath, "r");
+    if (!in_file) {
+        return {};
+    }
+
+    std::vector<InputEvent> events;
+    char line[256];
+    for (int line_number = 1; fgets(line, sizeof(line), in_file); ++line_number) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+
+        uint32_t time;
+        char type_name[16];
+        int64_t a;
+        int64_t b;
+        if (sscanf(line, "%u %15s %ld %ld", &time, type_name, &a, &b) != 4) {
+            std::cerr << filepath << ":" << line_number << ": invalid input event\n";
+            fclose(in_file);
+            return {};
+        }
+
+        auto const type = std::find_if(input_event_type_names.begin(), input_event_type_names.end(), [&](char const* name) {
+            return std::strcmp(name, type_name) == 0;
+        });
+        if (type == input_event_type_names.end()) {
+            std::cerr << filepath << ":" << line_number << ": unknown input event type '" << type_name << "'\n";
+            fclose(in_file);
+            return {};
+        }
+
+        events.push_back(InputEvent{
+            .time = time,
+            .type = static_cast<InputEventType>(type - input_event_type_names.begin()),
+            .a = a,
+            .b = b,
+        });
+    }
+
+    fclose(in_file);
+
+    std::stable_sort(events.begin(), events.end(), [](auto const& lhs, auto const& rhs) { return lhs.time < rhs.time; });
+    return events;
+}
+
+void dispatch_input_event(Window& window, InputEvent const& event)
+{
+    switch (event.type) {
+    case InputEventType::RESIZE:
+        window.width = event.a;
+        window.height = event.b;
+        if (window.callback_window_resize) {
+            window.callback_window_resize(event.a, event.b);
+        }
+        break;
+    case InputEventType::POINTER_MOTION:
+        if (window.callback_pointer_motion) {
+            window.callback_pointer_motion(event.a, event.b);
+        }
+        break;
+    case InputEventType::POINTER_BUTTON:
+        if (window.callback_pointer_button) {
+            window.callback_pointer_button(event.a, static_cast<wl_pointer_button_state>(event.b));
+        }
+        break;
+    case InputEventType::POINTER_AXIS:
+        if (window.callback_pointer_axis) {
+            window.callback_pointer_axis(static_cast<wl_pointer_axis>(event.a), event.b);
+        }
+        break;
+    case InputEventType::KEYBOARD_KEY:
+        if (window.callback_keyboard_key) {
+            window.callback_keyboard_key(static_cast<Scancodes>(event.a), static_cast<wl_keyboard_key_state>(event.b));
+        }
+        break;
+    }
+}
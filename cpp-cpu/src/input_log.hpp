@@ -0,0 +1,33 @@
+#pragma once
+
+#include "wayland.hpp"
+
+#include <optional>
+#include <vector>
+
+// Input logs are text files with one event per line: "<time in ms> <type> <a> <b>".
+// The arguments are the raw values passed to the corresponding Window callback.
+// Lines starting with '#' are comments.
+
+enum class InputEventType {
+    RESIZE,
+    POINTER_MOTION,
+    POINTER_BUTTON,
+    POINTER_AXIS,
+    KEYBOARD_KEY,
+};
+
+struct InputEvent {
+    uint32_t time; // ms since the start of the recording
+    InputEventType type;
+    int64_t a;
+    int64_t b;
+};
+
+// Wraps the input callbacks of the window, so every event is appended to the log at filepath before it is handled
+bool record_input(Window& window, char const* filepath);
+
+std::optional<std::vector<InputEvent>> load_input_log(char const* filepath);
+
+// Feeds the event into the same callback the Wayland event handlers would call
+void dispatch_input_event(Window& window, InputEvent const& event);
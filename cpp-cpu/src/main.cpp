@@ -1,14 +1,32 @@
+#include "color.hpp"
+#include "engine.hpp"
+#include "formula.hpp"
+#include "http_server.hpp"
+#include "input_log.hpp"
+#include "npy.hpp"
+#include "qoi.hpp"
+#include "settings.hpp"
+#include "trace.hpp"
 #include "wayland.hpp"
+#include "worker.hpp"
 
 #include "../vendor/font8x8_basic.h"
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
 #include <cmath>
 #include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <filesystem>
+#include <functional>
 #include <immintrin.h>
 #include <iostream>
+#include <limits>
+#include <list>
 #include <map>
+#include <numeric>
 #include <optional>
 #include <queue>
 #include <span>
@@ -17,959 +35,2161 @@
 #include <vector>
 
 // TODO: Smooth shading: https://linas.org/art-gallery/escape/smooth.html
-// TODO: Anti-Aliasing
 // TODO: Vulkan compute: https://bakedbits.dev/posts/vulkan-compute-example
 // TODO: wayland: use wp_cursor_shape_manager_v1 instead of wayland-cursor
 
-struct Color {
-    union {
-        uint32_t color;
-        struct {
-            uint8_t b;
-            uint8_t g;
-            uint8_t r;
-            uint8_t a;
-        };
-    };
-
-    Color(uint8_t r = 0, uint8_t g = 0, uint8_t b = 0)
-        : b{b}
-        , g{g}
-        , r{r}
-        , a{255}
-    { }
-
-    bool operator==(Color const& other) const
-    {
-        return color == other.color;
-    }
-};
-
 // Parameters
-int64_t constexpr chunk_size = 32 * 8;
-int64_t max_iterations = 1000;
-int32_t constexpr thread_count = 8;
-int32_t constexpr max_queue_size = thread_count;
-std::size_t constexpr max_chunk_memory = 1024 * 1024 * 1024; // 1GiB
-std::size_t color_function_amount = 4;
-std::size_t color_function = 3;
-Color const default_color{100, 100, 100};
+auto constexpr interaction_settle_time = std::chrono::milliseconds{150};
 int64_t constexpr text_scale = 2;
+int64_t constexpr poster_scale = 16; // Poster size relative to the window when exporting from the viewer
+int64_t screenshot_scale = 2; // Screenshot size relative to the window, set with --screenshot-scale
+std::size_t constexpr poster_bands_in_flight = 3;
+std::size_t constexpr sequence_frames_in_flight = 4; // Composed frames waiting for the encoder
+std::size_t constexpr frame_time_history_length = 120;
 uint32_t const message_display_duration = 4000; // ms
+int64_t constexpr buddhabrot_sampling_grid_size = 256; // Cells per side of the grid the starting points are drawn from
+uint64_t constexpr buddhabrot_batch_size = 1024; // Starting points per task
+auto constexpr buddhabrot_merge_interval = std::chrono::milliseconds{250}; // Shortest interval between merging the histogram of a shard
+int64_t constexpr buddhabrot_preview_min_iterations = 20;
+
+int32_t constexpr max_tile_zoom = 48;
+int64_t constexpr max_tile_iterations = 1'000'000;
 
-// Global variables
-bool info_text_visible = true;
-bool help_text_visible = true;
+// Global variables, only accessed by the render thread
 uint32_t last_message_time = 0;
 std::string last_message;
 uint32_t global_time = 0;
 
 std::size_t frame_number = 0;
 
-struct QOIImage {
-    static int encode_to_file(char const* filepath, Color* data, int width, int height)
+// Lock-free single producer, single consumer triple buffer.
+// The producer always has a slot to write into and the consumer always sees the latest published slot, so neither side ever waits for the other.
+template <typename T>
+struct TripleBuffer {
+    // Producer side
+    T& back()
     {
-        FILE* out_file = fopen(filepath, "w");
-        if (!out_file) {
-            return 0;
+        return m_slots[m_back];
+    }
+
+    void publish()
+    {
+        m_back = m_middle.exchange(m_back | DIRTY_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Consumer side, returns true if a new slot has been published since the last call
+    bool update()
+    {
+        if (!(m_middle.load(std::memory_order_relaxed) & DIRTY_BIT)) {
+            return false;
         }
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    T& front()
+    {
+        return m_slots[m_front];
+    }
 
-        struct Header header = {
-            .magic = {'q', 'o', 'i', 'f'},
-            .width = htobe32(width),
-            .height = htobe32(height),
-            .channels = 3,
-            .colorspace = 0,
+private:
+    static uint8_t constexpr DIRTY_BIT = 0b100;
+    static uint8_t constexpr INDEX_MASK = 0b011;
+
+    std::array<T, 3> m_slots{};
+    uint8_t m_back{0};
+    std::atomic<uint8_t> m_middle{1};
+    uint8_t m_front{2};
+};
+
+// Everything the render thread needs to compose a frame.
+// Owned by the Wayland thread, which publishes a copy after every input event.
+struct ViewState {
+    ScreenPosition top_left_global = ScreenPosition{-100, -100};
+    int32_t zoom_level = 1;
+    std::size_t formula = 0;
+    int64_t max_iterations = 1000;
+    std::size_t color_function = 3;
+    int64_t antialiasing_samples = default_antialiasing_samples;
+    int64_t width = 0;
+    int64_t height = 0;
+    bool info_text_visible = true;
+    bool help_text_visible = true;
+    uint32_t screenshot_requests = 0;
+    uint32_t poster_requests = 0;
+    uint32_t field_requests = 0;
+    uint64_t sequence = 0; // Incremented every time the view is published
+    bool perf_hud_visible = false;
+    bool buddhabrot_visible = false;
+    bool is_dragging = false;
+    std::chrono::steady_clock::time_point last_interaction_time{};
+
+    [[nodiscard]] double get_chunk_resolution() const
+    {
+        return zoom_level_to_chunk_resolution(zoom_level);
+    }
+
+    [[nodiscard]] bool is_interacting() const
+    {
+        return is_dragging || std::chrono::steady_clock::now() - last_interaction_time < interaction_settle_time;
+    }
+
+    [[nodiscard]] RenderParameters render_parameters() const
+    {
+        return RenderParameters{
+            .formula = formula,
+            .max_iterations = max_iterations,
+            .color_function = color_function,
+            .antialiasing_samples = antialiasing_samples,
         };
+    }
 
-        fwrite(&header, 1, 14, out_file);
+    // The limit chunks start with, which is derived from the zoom level with auto_iterations
+    [[nodiscard]] int64_t base_max_iterations() const
+    {
+        return render_parameters().base_max_iterations(get_chunk_resolution());
+    }
+};
 
-        uint8_t op_buffer[5];
-        Color prev_pixels[64];
-        for (auto& pixel : prev_pixels) {
-            pixel.color = 0;
-        }
-        Color last_pixel;
+// Returns true if every visible chunk was ready at full resolution
+bool render_view(Mandelbrot& mandelbrot, Buffer& buffer, ViewState const& view)
+{
+    auto const sample_step = view.is_interacting() ? interaction_sample_step : 1;
+    return mandelbrot.render(buffer, view.top_left_global, view.get_chunk_resolution(), sample_step, view.render_parameters());
+}
 
-        int run_length = 0;
-        for (int pixel_index = 0; pixel_index < width * height; ++pixel_index) {
-            if (data[pixel_index] == last_pixel && run_length < 62 && pixel_index < width * height - 1) {
-                ++run_length;
-            } else {
-                if (run_length > 0) {
-                    // Generate QOI_OP_RUN
-                    op_buffer[0] = 192 | (run_length - 1);
-                    fwrite(&op_buffer, 1, 1, out_file);
-                    run_length = 0;
-                }
+// font8x8_basic pre-scaled by text_scale, so drawing a glyph is a masked copy of whole rows
+struct GlyphAtlas {
+    static int64_t constexpr GLYPH_SIZE = 8 * text_scale;
 
-                if (data[pixel_index] == prev_pixels[index_position(data[pixel_index])]) {
-                    // Generate QOI_OP_INDEX
-                    op_buffer[0] = index_position(data[pixel_index]);
-                    fwrite(&op_buffer, 1, 1, out_file);
-                    goto loop_end;
+    GlyphAtlas()
+    {
+        for (std::size_t character = 0; character < 128; ++character) {
+            for (int64_t y = 0; y < GLYPH_SIZE; ++y) {
+                for (int64_t x = 0; x < GLYPH_SIZE; ++x) {
+                    auto const is_set = (font8x8_basic[character][y / text_scale] >> (x / text_scale)) & 1;
+                    m_glyphs[character][y * GLYPH_SIZE + x] = is_set ? 0xffffffff : 0;
                 }
+            }
+        }
+        m_glyphs[FALLBACK_GLYPH].fill(0);
+    }
 
-                auto dr = data[pixel_index].r - last_pixel.r;
-                auto dg = data[pixel_index].g - last_pixel.g;
-                auto db = data[pixel_index].b - last_pixel.b;
-                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
-                    // Generate QOI_OP_DIFF
-                    op_buffer[0] = 64 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
-                    fwrite(&op_buffer, 1, 1, out_file);
-                    goto loop_end;
-                }
+    [[nodiscard]] uint32_t const* glyph(uint8_t character) const
+    {
+        return m_glyphs[character < 128 ? character : FALLBACK_GLYPH].data();
+    }
 
-                auto diff_dr_dg = dr - dg;
-                auto diff_db_dg = db - dg;
-                if (dg >= -32 && dg <= 31 && diff_dr_dg >= -8 && diff_dr_dg <= 7 && diff_db_dg >= -8 && diff_db_dg <= 7) {
-                    // Generate QOI_OP_LUMA
-                    op_buffer[0] = 128 | (dg + 32);
-                    op_buffer[1] = ((diff_dr_dg + 8) << 4) | (diff_db_dg + 8);
-                    fwrite(&op_buffer, 1, 2, out_file);
-                    goto loop_end;
-                }
+private:
+    static std::size_t constexpr FALLBACK_GLYPH = 128;
 
-                // Generate QOI_OP_RGB
-                op_buffer[0] = 254;
-                op_buffer[1] = data[pixel_index].r;
-                op_buffer[2] = data[pixel_index].g;
-                op_buffer[3] = data[pixel_index].b;
-                fwrite(&op_buffer, 1, 4, out_file);
+    std::array<std::array<uint32_t, GLYPH_SIZE * GLYPH_SIZE>, 129> m_glyphs;
+};
+
+GlyphAtlas const glyph_atlas;
+
+void render_text_to_buffer(Buffer* buffer, ScreenPosition position, std::string_view text, Color color = Color(255, 255, 255))
+{
+    auto const glyph_size = GlyphAtlas::GLYPH_SIZE;
+    auto const data = buffer->buffer();
+
+    auto const y_start = std::clamp(position.y, 0l, buffer->height()) - position.y;
+    auto const y_end = std::clamp(position.y + glyph_size, 0l, buffer->height()) - position.y;
+
+    for (size_t n = 0; n < text.length(); ++n) {
+        auto const glyph_x = position.x + static_cast<int64_t>(n) * glyph_size;
+        auto const x_start = std::clamp(glyph_x, 0l, buffer->width()) - glyph_x;
+        auto const x_end = std::clamp(glyph_x + glyph_size, 0l, buffer->width()) - glyph_x;
+
+        auto const* glyph = glyph_atlas.glyph(text[n]);
+        for (int64_t y = y_start; y < y_end; ++y) {
+            auto* dest = reinterpret_cast<uint32_t*>(&data[(position.y + y) * buffer->width() + glyph_x]);
+            auto const* mask = &glyph[y * glyph_size];
+            for (int64_t x = x_start; x < x_end; ++x) {
+                dest[x] = (dest[x] & ~mask[x]) | (color.color & mask[x]);
             }
+        }
+    }
+}
 
-        loop_end:
-            last_pixel = data[pixel_index];
-            prev_pixels[index_position(data[pixel_index])] = data[pixel_index];
+std::string format_si(double value)
+{
+    char const* const suffixes[] = {"", "k", "M", "G", "T"};
+    std::size_t suffix = 0;
+    while (value >= 1000 && suffix < std::size(suffixes) - 1) {
+        value /= 1000;
+        ++suffix;
+    }
+
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.2f%s", value, suffixes[suffix]);
+    return text;
+}
+
+// Frame timings and per-second rates derived from the RenderStatistics counters. Only accessed by the render thread.
+struct PerformanceHud {
+    using Clock = std::chrono::steady_clock;
+
+    static int64_t constexpr GRAPH_HEIGHT = 64;
+
+    void record_frame(Clock::duration frame_time, Clock::duration compose_time)
+    {
+        m_frame_times[m_frame_time_index] = std::chrono::duration<float, std::milli>(frame_time).count();
+        m_frame_time_index = (m_frame_time_index + 1) % m_frame_times.size();
+        m_compose_time = std::chrono::duration<float, std::milli>(compose_time).count();
+    }
+
+    void update_rates(RenderStatistics const& statistics)
+    {
+        auto const now = Clock::now();
+        auto const elapsed = std::chrono::duration<double>(now - m_rate_window_start).count();
+        if (elapsed < 1.0) {
+            return;
         }
 
-        fclose(out_file);
+        auto const computed_chunks = statistics.computed_chunks.load(std::memory_order_relaxed);
+        auto const computed_iterations = statistics.computed_iterations.load(std::memory_order_relaxed);
+        auto const cache_lookups = statistics.cache_hits + statistics.cache_misses - m_cache_hits - m_cache_misses;
+
+        m_chunks_per_second = (computed_chunks - m_computed_chunks) / elapsed;
+        m_iterations_per_second = (computed_iterations - m_computed_iterations) / elapsed;
+        m_evictions_per_second = (statistics.evicted_chunks - m_evicted_chunks) / elapsed;
+        m_cache_hit_rate = cache_lookups > 0 ? static_cast<double>(statistics.cache_hits - m_cache_hits) / cache_lookups : 1.0;
+
+        m_computed_chunks = computed_chunks;
+        m_computed_iterations = computed_iterations;
+        m_evicted_chunks = statistics.evicted_chunks;
+        m_cache_hits = statistics.cache_hits;
+        m_cache_misses = statistics.cache_misses;
+        m_rate_window_start = now;
+    }
 
-        return 1;
+    template <typename F>
+    void render_lines(Mandelbrot& mandelbrot, F&& render_next_line) const
+    {
+        auto const& statistics = mandelbrot.statistics();
+        auto const last_frame_time = m_frame_times[(m_frame_time_index + m_frame_times.size() - 1) % m_frame_times.size()];
+        auto const resident_chunks = mandelbrot.resident_chunk_count();
+
+        render_next_line("frame: " + format_si(last_frame_time) + "ms, compose: " + format_si(m_compose_time) + "ms");
+        render_next_line("queue: " + std::to_string(mandelbrot.queue_size()) + ", busy workers: " + std::to_string(statistics.busy_workers.load(std::memory_order_relaxed)) + "/" + std::to_string(thread_count));
+        render_next_line("chunks/s: " + format_si(m_chunks_per_second) + ", iterations/s: " + format_si(m_iterations_per_second));
+        render_next_line("cache hit rate: " + std::to_string(static_cast<int>(m_cache_hit_rate * 100)) + "%, evictions/s: " + format_si(m_evictions_per_second));
+        render_next_line("resident chunks: " + std::to_string(resident_chunks) + " (" + std::to_string(resident_chunks * single_chunk_memory() / (1024 * 1024)) + "/" + std::to_string(max_chunk_memory / (1024 * 1024)) + " MiB)");
+    }
+
+    // Bar graph of the frame time history, the line marks 60fps
+    void render_graph(Buffer& buffer, ScreenPosition position) const
+    {
+        int64_t constexpr bar_width = 2;
+        float constexpr pixels_per_ms = 2;
+        float constexpr frame_budget = 1000.0f / 60.0f;
+
+        buffer.fill_rect(position, m_frame_times.size() * bar_width, GRAPH_HEIGHT, Color{});
+        for (std::size_t i = 0; i < m_frame_times.size(); ++i) {
+            auto const frame_time = m_frame_times[(m_frame_time_index + i) % m_frame_times.size()];
+            auto const bar_height = std::min<int64_t>(frame_time * pixels_per_ms, GRAPH_HEIGHT);
+            auto const bar_color = frame_time <= frame_budget ? Color{80, 200, 80} : Color{220, 60, 60};
+            buffer.fill_rect(ScreenPosition{position.x + static_cast<int64_t>(i) * bar_width, position.y + GRAPH_HEIGHT - bar_height}, bar_width, bar_height, bar_color);
+        }
+        buffer.fill_rect(ScreenPosition{position.x, position.y + GRAPH_HEIGHT - static_cast<int64_t>(frame_budget * pixels_per_ms)}, m_frame_times.size() * bar_width, 1, Color{255, 255, 255});
     }
 
 private:
-    struct Header {
-        char magic[4];
-        uint32_t width;
-        uint32_t height;
-        uint8_t channels;
-        uint8_t colorspace;
+    std::array<float, frame_time_history_length> m_frame_times{};
+    std::size_t m_frame_time_index{0};
+    float m_compose_time{0};
+
+    Clock::time_point m_rate_window_start{Clock::now()};
+    uint64_t m_computed_chunks{0};
+    uint64_t m_computed_iterations{0};
+    uint64_t m_evicted_chunks{0};
+    uint64_t m_cache_hits{0};
+    uint64_t m_cache_misses{0};
+    double m_chunks_per_second{0};
+    double m_iterations_per_second{0};
+    double m_evictions_per_second{0};
+    double m_cache_hit_rate{1.0};
+};
+
+struct PosterProgress {
+    std::atomic<int64_t> completed_bands{0};
+    std::atomic<int64_t> band_count{0};
+    std::atomic<bool> cancel{false};
+};
+
+// The progress file next to the output holds the parameters, the number of completed bands and the file offset after them.
+// Doubles are stored as hex floats, so they compare equal after reading them back.
+bool save_poster_progress(std::filesystem::path const& path, ViewportParameters const& parameters, int64_t completed_bands, long file_offset)
+{
+    auto const temporary_path = std::filesystem::path{path}.concat(".tmp");
+    FILE* out_file = fopen(temporary_path.c_str(), "w");
+    if (!out_file) {
+        return false;
+    }
+
+    fprintf(out_file, "%ld %ld %a %a %a %zu %ld %zu %ld\n%ld %ld\n",
+        parameters.width, parameters.height, parameters.top_left.real, parameters.top_left.imag, parameters.pixel_size, parameters.formula,
+        parameters.max_iterations, parameters.color_function, parameters.antialiasing_samples, completed_bands, file_offset);
+    fclose(out_file);
+
+    std::error_code error;
+    std::filesystem::rename(temporary_path, path, error);
+    return !error;
+}
+
+// Returns the completed bands and the file offset, if the progress file belongs to a poster with the same parameters
+std::optional<std::pair<int64_t, long>> load_poster_progress(std::filesystem::path const& path, ViewportParameters const& parameters)
+{
+    FILE* in_file = fopen(path.c_str(), "r");
+    if (!in_file) {
+        return {};
+    }
+
+    ViewportParameters saved;
+    int64_t completed_bands;
+    long file_offset;
+    auto const fields = fscanf(in_file, "%ld %ld %la %la %la %zu %ld %zu %ld %ld %ld",
+        &saved.width, &saved.height, &saved.top_left.real, &saved.top_left.imag, &saved.pixel_size, &saved.formula,
+        &saved.max_iterations, &saved.color_function, &saved.antialiasing_samples, &completed_bands, &file_offset);
+    fclose(in_file);
+
+    if (fields != 11 || saved.width != parameters.width || saved.height != parameters.height
+        || saved.top_left.real != parameters.top_left.real || saved.top_left.imag != parameters.top_left.imag
+        || saved.pixel_size != parameters.pixel_size || saved.formula != parameters.formula || saved.max_iterations != parameters.max_iterations
+        || saved.color_function != parameters.color_function || saved.antialiasing_samples != parameters.antialiasing_samples) {
+        return {};
+    }
+
+    return std::make_pair(completed_bands, file_offset);
+}
+
+// Computes the bands from first_band on, up to poster_bands_in_flight at a time on the background queue of the pool, and
+// calls write_band(band_index, chunks) for each of them in order. So memory use does not depend on the image height.
+// With keep_field, the chunks keep their raw field instead of colors. Returns false if write_band failed or
+// progress.cancel was set.
+template <typename Function>
+bool render_bands(Mandelbrot& mandelbrot, ViewportParameters const& parameters, BandLayout const& layout, int64_t first_band, bool keep_field, PosterProgress& progress, bool print_progress, Function&& write_band)
+{
+    using Clock = std::chrono::steady_clock;
+
+    progress.band_count = layout.band_count;
+    progress.completed_bands = first_band;
+
+    struct Band {
+        int64_t index;
+        std::vector<Chunk> chunks;
+    };
+    std::deque<Band> bands;
+    auto next_band = first_band;
+
+    auto const enqueue_band = [&](int64_t band_index) {
+        auto band = Band{band_index, {}};
+        band.chunks.reserve(layout.chunk_x_count);
+        for (int64_t chunk_x = 0; chunk_x < layout.chunk_x_count; ++chunk_x) {
+            auto const position = Complex{
+                .real = (layout.top_left_chunk_position.real + chunk_x) * layout.chunk_resolution,
+                .imag = (layout.top_left_chunk_position.imag + band_index) * layout.chunk_resolution,
+            };
+            auto& chunk = band.chunks.emplace_back(Chunk::create(position, layout.chunk_resolution, parameters.formula, parameters.max_iterations, parameters.color_function, 1, keep_field ? 0 : parameters.antialiasing_samples));
+            if (keep_field) {
+                chunk.keep_field();
+            }
+        }
+        mandelbrot.enqueue_background(band.chunks);
+        bands.push_back(std::move(band));
+    };
+
+    auto const start = Clock::now();
+    while (progress.completed_bands < layout.band_count) {
+        while (next_band < layout.band_count && bands.size() < poster_bands_in_flight) {
+            enqueue_band(next_band++);
+        }
+
+        auto const band = std::move(bands.front());
+        bands.pop_front();
+        mandelbrot.wait_for_chunks(band.chunks);
+
+        auto const span = TraceSpan{"poster band", static_cast<uint64_t>(band.index)};
+        if (!write_band(band.index, std::span<Chunk const>{band.chunks})) {
+            progress.cancel = true;
+        } else {
+            progress.completed_bands = band.index + 1;
+        }
+
+        if (print_progress) {
+            auto const completed = progress.completed_bands - first_band;
+            auto const bands_per_second = completed / std::chrono::duration<double>(Clock::now() - start).count();
+            std::printf("\rband %ld/%ld (%.1f%%), %.2f bands/s, %.0fs remaining ",
+                progress.completed_bands.load(), layout.band_count, 100.0 * progress.completed_bands / layout.band_count,
+                bands_per_second, (layout.band_count - progress.completed_bands) / bands_per_second);
+            std::fflush(stdout);
+        }
+
+        if (progress.cancel) {
+            // The pool still references the chunks of the bands in flight
+            for (auto const& remaining_band : bands) {
+                mandelbrot.wait_for_chunks(remaining_band.chunks);
+            }
+            return false;
+        }
+    }
+
+    if (print_progress) {
+        std::printf("\n");
+    }
+    return true;
+}
+
+// Renders the poster band by band and streams it into the QOI file. Progress is saved after every band, calling this again
+// with the same parameters resumes from there.
+bool export_poster(Mandelbrot& mandelbrot, ViewportParameters const& parameters, std::filesystem::path const& filepath, PosterProgress& progress, bool print_progress)
+{
+    auto const layout = BandLayout::create(parameters);
+
+    auto const progress_path = std::filesystem::path{filepath}.concat(".progress");
+    int64_t first_band = 0;
+    long resume_offset = 0;
+    if (auto const saved_progress = load_poster_progress(progress_path, parameters)) {
+        std::tie(first_band, resume_offset) = *saved_progress;
+        std::cout << "Resuming " << filepath.string() << " at band " << first_band << "/" << layout.band_count << "\n";
+    }
+
+    auto writer = QOIFileWriter::open(filepath.c_str(), parameters.width, parameters.height, resume_offset);
+    if (!writer) {
+        std::cerr << "Failed to open " << filepath.string() << "\n";
+        return false;
+    }
+
+    auto band_buffer = Buffer{};
+    auto const write_band = [&](int64_t band_index, std::span<Chunk const> chunks) {
+        auto const band_top = layout.band_top(band_index);
+        auto const row_start = std::max<int64_t>(band_top, 0);
+        auto const row_end = std::min<int64_t>(band_top + chunk_size, parameters.height);
+
+        band_buffer.resize(parameters.width, row_end - row_start);
+        for (int64_t chunk_x = 0; chunk_x < layout.chunk_x_count; ++chunk_x) {
+            band_buffer.blit(chunks[chunk_x], ScreenPosition{layout.chunk_offset.x + chunk_x * chunk_size, band_top - row_start});
+        }
+
+        if (!writer->write_rows(reinterpret_cast<Color const*>(band_buffer.buffer().data()), row_end - row_start)) {
+            std::cerr << "Failed to write " << filepath.string() << "\n";
+            return false;
+        }
+        auto const file_offset = writer->sync();
+        if (file_offset < 0) {
+            std::cerr << "Failed to write " << filepath.string() << "\n";
+            return false;
+        }
+        save_poster_progress(progress_path, parameters, band_index + 1, file_offset);
+        return true;
     };
 
-    static uint8_t index_position(Color color)
+    if (!render_bands(mandelbrot, parameters, layout, first_band, false, progress, print_progress, write_band)) {
+        return false;
+    }
+
+    if (!writer->finish()) {
+        std::cerr << "Failed to write " << filepath.string() << "\n";
+        return false;
+    }
+
+    std::filesystem::remove(progress_path);
+    return true;
+}
+
+// Writes the raw iteration field of the view into a .npy file, straight from the chunks band by band. Only the formula,
+// the position and max_iterations of the parameters are used, every pixel is sampled once at its corner like in posters.
+bool export_field(Mandelbrot& mandelbrot, ViewportParameters const& parameters, std::filesystem::path const& filepath, PosterProgress& progress, bool print_progress)
+{
+    auto const layout = BandLayout::create(parameters);
+    auto writer = FieldFileWriter::open(filepath.c_str(), parameters.width, parameters.height);
+    if (!writer) {
+        std::cerr << "Failed to open " << filepath.string() << "\n";
+        return false;
+    }
+
+    std::vector<FieldSample> band_field;
+    auto const write_band = [&](int64_t band_index, std::span<Chunk const> chunks) {
+        auto const band_top = layout.band_top(band_index);
+        auto const row_start = std::max<int64_t>(band_top, 0);
+        auto const row_end = std::min<int64_t>(band_top + chunk_size, parameters.height);
+
+        band_field.resize(parameters.width * (row_end - row_start));
+        for (int64_t chunk_x = 0; chunk_x < layout.chunk_x_count; ++chunk_x) {
+            auto const chunk_left = layout.chunk_offset.x + chunk_x * chunk_size;
+            auto const column_start = std::max<int64_t>(chunk_left, 0);
+            auto const column_end = std::min<int64_t>(chunk_left + chunk_size, parameters.width);
+            auto const field = chunks[chunk_x].field();
+            for (auto row = row_start; row < row_end; ++row) {
+                auto const source = field.begin() + (row - band_top) * chunk_size + (column_start - chunk_left);
+                std::copy(source, source + (column_end - column_start), band_field.begin() + (row - row_start) * parameters.width + column_start);
+            }
+        }
+
+        if (!writer->write_rows(band_field.data(), row_end - row_start)) {
+            std::cerr << "Failed to write " << filepath.string() << "\n";
+            return false;
+        }
+        return true;
+    };
+
+    if (!render_bands(mandelbrot, parameters, layout, 0, true, progress, print_progress, write_band)) {
+        return false;
+    }
+
+    if (!writer->finish()) {
+        std::cerr << "Failed to write " << filepath.string() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Colors a field exported by export_field() into a QOI image, band by band from the mapped file. Fractional escape counts
+// give smooth gradients, which the viewer does not have.
+bool recolor_field(std::filesystem::path const& input, std::filesystem::path const& output, std::size_t color_function, int64_t color_iterations)
+{
+    std::string error;
+    auto const field = FieldFile::open(input.c_str(), error);
+    if (!field) {
+        std::cerr << "Failed to read " << input.string() << ": " << error << "\n";
+        return false;
+    }
+
+    auto writer = QOIFileWriter::open(output.c_str(), field->width(), field->height());
+    if (!writer) {
+        std::cerr << "Failed to open " << output.string() << "\n";
+        return false;
+    }
+
+    std::vector<Color> band(field->width() * chunk_size);
+    for (int64_t row_start = 0; row_start < field->height(); row_start += chunk_size) {
+        auto const row_count = std::min<int64_t>(chunk_size, field->height() - row_start);
+        auto const samples = field->rows(row_start, row_count);
+        for (std::size_t i = 0; i < samples.size(); ++i) {
+            auto const& sample = samples[i];
+            auto const is_inside = std::isinf(sample.iterations);
+            auto const shade = color_function == 3 ? Chunk::phong_shade(sample.normal_x, sample.normal_y) : 1.0f;
+            // Inside the set the viewer colors the iteration limit, which is the end of the color range
+            band[i] = Chunk::iteration_color(color_function, is_inside ? color_iterations : sample.iterations, color_iterations, is_inside, shade);
+        }
+
+        if (!writer->write_rows(band.data(), row_count)) {
+            std::cerr << "Failed to write " << output.string() << "\n";
+            return false;
+        }
+    }
+
+    if (!writer->finish()) {
+        std::cerr << "Failed to write " << output.string() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// A zoom animation towards center, from start_zoom to end_zoom with frames_per_zoom_level frames per zoom level
+struct SequenceParameters {
+    int64_t width;
+    int64_t height;
+    Complex center;
+    double start_zoom;
+    double end_zoom;
+    int64_t frames_per_zoom_level;
+    std::size_t formula;
+    int64_t max_iterations;
+    std::size_t color_function;
+    int64_t antialiasing_samples;
+
+    [[nodiscard]] int64_t frame_count() const
     {
-        return (color.r * 3 + color.g * 5 + color.b * 7 + color.a * 11) % 64;
+        return std::llround(std::abs(end_zoom - start_zoom) * frames_per_zoom_level) + 1;
     }
-};
 
-#define CONCAT(a, b) a##b
+    [[nodiscard]] double zoom(int64_t frame) const
+    {
+        return start_zoom + (end_zoom - start_zoom) * frame / std::max<int64_t>(frame_count() - 1, 1);
+    }
 
-struct ScreenPosition {
-    int64_t x;
-    int64_t y;
+    // Frames between two zoom levels are resampled from the chunks of the next deeper level, so they never need to be magnified
+    [[nodiscard]] int32_t source_level(int64_t frame) const
+    {
+        return static_cast<int32_t>(std::ceil(zoom(frame)));
+    }
 };
 
-struct Complex {
-    double real;
-    double imag;
+// All chunks of one integer zoom level that any frame of the sequence reads from, composed into one image once they are ready
+struct SequenceLevel {
+    ChunkGridPosition first_chunk;
+    std::vector<Chunk> chunks;
+    Buffer image;
 };
 
-struct ChunkGridPosition {
-    int64_t real;
-    int64_t imag;
+// Renders a zoom animation. Every integer zoom level is computed once and shared by all frames between it and the previous level,
+// the next level is computed on the background queue of the pool while the frames of the current one are composed, and a separate
+// encoder thread writes the composed frames. With output "-", raw BGRA frames are streamed to stdout for an external encoder,
+// otherwise output is a directory that receives numbered QOI files.
+bool render_sequence(Mandelbrot& mandelbrot, SequenceParameters const& parameters, std::filesystem::path const& output, bool print_progress)
+{
+    using Clock = std::chrono::steady_clock;
+
+    auto const to_stdout = output == "-";
+    if (!to_stdout) {
+        std::error_code error;
+        std::filesystem::create_directories(output, error);
+        if (error) {
+            std::cerr << "Failed to create " << output.string() << "\n";
+            return false;
+        }
+    }
 
-    bool operator==(ChunkGridPosition const& other) const = default;
-};
+    auto const frame_count = parameters.frame_count();
+    auto const create_level = [&](int32_t level) {
+        // The widest frame reading from this level is the one right after the previous level, which is 1 / 0.9 times wider.
+        // One pixel of margin on each side for the bilinear filter.
+        auto const chunk_resolution = zoom_level_to_chunk_resolution(level);
+        auto const pixel_size = chunk_resolution / chunk_size;
+        auto const half_width = parameters.width / 0.9 / 2 + 1;
+        auto const half_height = parameters.height / 0.9 / 2 + 1;
+        auto const center_x = parameters.center.real / pixel_size;
+        auto const center_y = parameters.center.imag / pixel_size;
+
+        auto const first_chunk = ChunkGridPosition{
+            static_cast<int64_t>(std::floor((center_x - half_width) / chunk_size)),
+            static_cast<int64_t>(std::floor((center_y - half_height) / chunk_size)),
+        };
+        auto const chunk_x_count = static_cast<int64_t>(std::floor((center_x + half_width) / chunk_size)) - first_chunk.real + 1;
+        auto const chunk_y_count = static_cast<int64_t>(std::floor((center_y + half_height) / chunk_size)) - first_chunk.imag + 1;
+
+        auto new_level = SequenceLevel{first_chunk, {}, Buffer::init(chunk_x_count * chunk_size, chunk_y_count * chunk_size)};
+        new_level.chunks.reserve(chunk_x_count * chunk_y_count);
+        for (int64_t chunk_y = 0; chunk_y < chunk_y_count; ++chunk_y) {
+            for (int64_t chunk_x = 0; chunk_x < chunk_x_count; ++chunk_x) {
+                auto const position = Complex{
+                    .real = (first_chunk.real + chunk_x) * chunk_resolution,
+                    .imag = (first_chunk.imag + chunk_y) * chunk_resolution,
+                };
+                new_level.chunks.push_back(Chunk::create(position, chunk_resolution, parameters.formula, parameters.max_iterations, parameters.color_function, 1, parameters.antialiasing_samples));
+            }
+        }
+        mandelbrot.enqueue_background(new_level.chunks);
+        return new_level;
+    };
+
+    // Waits for the chunks of the level and blits them into its image, the chunks are not needed afterwards
+    auto const resolve_level = [&](SequenceLevel& level) {
+        if (level.chunks.empty()) {
+            return;
+        }
+
+        mandelbrot.wait_for_chunks(level.chunks);
+        auto const chunk_x_count = level.image.width() / chunk_size;
+        for (std::size_t i = 0; i < level.chunks.size(); ++i) {
+            level.image.blit(level.chunks[i], ScreenPosition{static_cast<int64_t>(i % chunk_x_count) * chunk_size, static_cast<int64_t>(i / chunk_x_count) * chunk_size});
+        }
+        level.chunks.clear();
+        level.chunks.shrink_to_fit();
+    };
+
+    // Bilinear resampling of the frame from the level image. The source pixels are at most 1 / 0.9 times smaller than the output
+    // pixels, so no source pixel is skipped.
+    auto const compose_frame = [&](SequenceLevel const& level, int32_t level_index, double zoom, Buffer& frame) {
+        auto const source_pixel_size = zoom_level_to_chunk_resolution(level_index) / chunk_size;
+        auto const scale = zoom_level_to_chunk_resolution(zoom) / chunk_size / source_pixel_size;
+        auto const origin_x = parameters.center.real / source_pixel_size - level.first_chunk.real * chunk_size - parameters.width / 2.0 * scale;
+        auto const origin_y = parameters.center.imag / source_pixel_size - level.first_chunk.imag * chunk_size - parameters.height / 2.0 * scale;
+
+        struct Sample {
+            int64_t index;
+            uint32_t weight; // Of the second pixel, out of 256
+        };
+        auto const sample_at = [](double position, int64_t limit) {
+            auto const index = std::clamp<int64_t>(static_cast<int64_t>(std::floor(position)), 0, limit - 2);
+            auto const weight = std::clamp<double>(position - index, 0, 1);
+            return Sample{index, static_cast<uint32_t>(weight * 256)};
+        };
+
+        std::vector<Sample> columns(parameters.width);
+        for (int64_t x = 0; x < parameters.width; ++x) {
+            columns[x] = sample_at(origin_x + x * scale, level.image.width());
+        }
+
+        auto const source = std::span<int32_t const>{level.image.buffer()};
+        auto const lerp = [](Color a, Color b, uint32_t weight) {
+            return Color{
+                static_cast<uint8_t>((a.r * (256 - weight) + b.r * weight) >> 8),
+                static_cast<uint8_t>((a.g * (256 - weight) + b.g * weight) >> 8),
+                static_cast<uint8_t>((a.b * (256 - weight) + b.b * weight) >> 8),
+            };
+        };
+        auto const color_at = [&](int64_t position) {
+            auto color = Color{};
+            color.color = source[position];
+            return color;
+        };
+
+        frame.resize(parameters.width, parameters.height);
+        for (int64_t y = 0; y < parameters.height; ++y) {
+            auto const row = sample_at(origin_y + y * scale, level.image.height());
+            auto const top = row.index * level.image.width();
+            auto const bottom = top + level.image.width();
+            for (int64_t x = 0; x < parameters.width; ++x) {
+                auto const column = columns[x];
+                auto const upper = lerp(color_at(top + column.index), color_at(top + column.index + 1), column.weight);
+                auto const lower = lerp(color_at(bottom + column.index), color_at(bottom + column.index + 1), column.weight);
+                frame.set(ScreenPosition{x, y}, lerp(upper, lower, row.weight));
+            }
+        }
+    };
+
+    // Encoder stage
+    struct EncodeJob {
+        int64_t index;
+        Buffer frame;
+    };
+    std::deque<EncodeJob> encode_queue;
+    std::mutex encode_mutex;
+    std::condition_variable encode_convar;
+    auto encoding_finished = false;
+    auto encoding_failed = false;
+
+    auto encoder = std::thread{[&]() {
+        trace_set_thread_name("sequence encoder");
+        while (true) {
+            std::unique_lock<std::mutex> lock{encode_mutex};
+            encode_convar.wait(lock, [&]() { return !encode_queue.empty() || encoding_finished; });
+            if (encode_queue.empty()) {
+                return;
+            }
+            auto job = std::move(encode_queue.front());
+            encode_queue.pop_front();
+            lock.unlock();
+            encode_convar.notify_all();
+
+            auto const span = TraceSpan{"encode frame", static_cast<uint64_t>(job.index)};
+            auto const* pixels = reinterpret_cast<Color const*>(job.frame.buffer().data());
+            auto succeeded = false;
+            if (to_stdout) {
+                succeeded = std::fwrite(pixels, sizeof(Color), job.frame.buffer().size(), stdout) == job.frame.buffer().size();
+            } else {
+                char filename[32];
+                std::snprintf(filename, sizeof(filename), "frame-%06ld.qoi", job.index);
+                succeeded = QOIImage::encode_to_file((output / filename).c_str(), pixels, job.frame.width(), job.frame.height());
+            }
+
+            if (!succeeded) {
+                lock.lock();
+                encoding_failed = true;
+                encode_queue.clear();
+                lock.unlock();
+                encode_convar.notify_all();
+                return;
+            }
+        }
+    }};
+
+    if (to_stdout) {
+        std::fprintf(stderr, "Streaming %ld frames, encode with: ffmpeg -f rawvideo -pix_fmt bgra -s %ldx%ld -r 30 -i - output.mp4\n",
+            frame_count, parameters.width, parameters.height);
+    }
+
+    std::map<int32_t, SequenceLevel> levels;
+    auto const start = Clock::now();
+    for (int64_t frame_index = 0; frame_index < frame_count; ++frame_index) {
+        // Keep the levels of the next frames_per_zoom_level frames, which is at most the current and the next one
+        auto const last_prefetched_frame = std::min(frame_index + parameters.frames_per_zoom_level, frame_count - 1);
+        for (auto frame = frame_index; frame <= last_prefetched_frame; ++frame) {
+            auto const level = parameters.source_level(frame);
+            if (!levels.contains(level)) {
+                levels.emplace(level, create_level(level));
+            }
+        }
+        auto const current_level = parameters.source_level(frame_index);
+        auto const last_prefetched_level = parameters.source_level(last_prefetched_frame);
+        auto const [lowest_level, highest_level] = std::minmax(current_level, last_prefetched_level);
+        std::erase_if(levels, [&](auto const& item) { return item.first < lowest_level || item.first > highest_level; });
+
+        auto& level = levels.at(current_level);
+        resolve_level(level);
+
+        auto frame = Buffer{};
+        {
+            auto const span = TraceSpan{"compose frame", static_cast<uint64_t>(frame_index)};
+            compose_frame(level, current_level, parameters.zoom(frame_index), frame);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock{encode_mutex};
+            encode_convar.wait(lock, [&]() { return encode_queue.size() < sequence_frames_in_flight || encoding_failed; });
+            if (encoding_failed) {
+                break;
+            }
+            encode_queue.push_back(EncodeJob{frame_index, std::move(frame)});
+        }
+        encode_convar.notify_all();
+
+        if (print_progress) {
+            auto const frames_per_minute = (frame_index + 1) / std::chrono::duration<double, std::ratio<60>>(Clock::now() - start).count();
+            std::fprintf(stderr, "\rframe %ld/%ld, zoom %.2f, %.1f frames/min ", frame_index + 1, frame_count, parameters.zoom(frame_index), frames_per_minute);
+        }
+    }
 
-template <>
-struct std::hash<ChunkGridPosition> {
-    std::size_t operator()(ChunkGridPosition const& value) const
     {
-        return (hash<int64_t>()(value.real) ^ hash<int64_t>()(value.imag));
+        std::lock_guard<std::mutex> lock{encode_mutex};
+        encoding_finished = true;
+    }
+    encode_convar.notify_all();
+    encoder.join();
+
+    // The pool may still reference the chunks of a prefetched level
+    for (auto const& [level_index, level] : levels) {
+        mandelbrot.wait_for_chunks(level.chunks);
+    }
+
+    if (encoding_failed) {
+        std::cerr << "\nFailed to write " << (to_stdout ? "stdout" : output.string()) << "\n";
+        return false;
+    }
+
+    if (print_progress) {
+        auto const elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        std::fprintf(stderr, "\n%ld frames of %ldx%ld in %.2fs, %.1f frames/min\n", frame_count, parameters.width, parameters.height, elapsed, frame_count / elapsed * 60);
+    }
+
+    if (to_stdout) {
+        std::fflush(stdout);
+    }
+    return true;
+}
+
+// Small and fast pseudo random generator, https://prng.di.unimi.it/splitmix64.c
+struct SplitMix64 {
+    uint64_t state;
+
+    uint64_t next()
+    {
+        auto z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    // In [0, 1)
+    double uniform()
+    {
+        return (next() >> 11) * 0x1.0p-53;
     }
 };
 
-struct HSLColor {
-    uint16_t hue; // 0-359
-    uint8_t saturation; // 0-100
-    uint8_t lightness; // 0-100
+// Iterations until the orbit of point escapes, max_iterations if it does not
+template <typename Formula>
+int64_t escape_count(Complex point, int64_t max_iterations)
+{
+    double z_real;
+    double z_imag;
+    double c_real;
+    double c_imag;
+    Formula::start(point.real, point.imag, z_real, z_imag, c_real, c_imag);
+    auto z_real2 = z_real * z_real;
+    auto z_imag2 = z_imag * z_imag;
+
+    int64_t iteration = 0;
+    for (; iteration < max_iterations && z_real2 + z_imag2 < 4; ++iteration) {
+        Formula::step(z_real, z_imag, z_real2, z_imag2, c_real, c_imag);
+        z_real2 = z_real * z_real;
+        z_imag2 = z_imag * z_imag;
+    }
+    return iteration;
+}
 
-    [[nodiscard]] Color to_rgb() const
+// Starting points for the Buddhabrot are drawn from the cells of a coarse grid over [-2, 2] x [-2, 2] that are near the
+// boundary. Orbits from inside the set never escape and orbits from far outside escape before min_iterations, so neither
+// is counted. A cell is kept if one of its corners escapes late enough, or if its corners are partly inside the set, and
+// then also its neighbours, so thin filaments between the corners are not lost.
+struct BuddhabrotSampler {
+    std::size_t formula;
+    int64_t min_iterations;
+    int64_t max_iterations;
+    std::vector<uint32_t> cells; // y * buddhabrot_sampling_grid_size + x
+
+    static std::shared_ptr<BuddhabrotSampler const> create(std::size_t formula, int64_t min_iterations, int64_t max_iterations)
     {
-        if (saturation == 0) {
-            return Color{
-                lightness,
-                lightness,
-                lightness,
-            };
+        auto constexpr grid_size = buddhabrot_sampling_grid_size;
+        auto constexpr corner_count = grid_size + 1;
+        auto const cell_size = 4.0 / grid_size;
+
+        std::vector<int64_t> corners(corner_count * corner_count);
+        with_formula(formula, [&]<typename Formula>() {
+            for (int64_t y = 0; y < corner_count; ++y) {
+                for (int64_t x = 0; x < corner_count; ++x) {
+                    corners[y * corner_count + x] = escape_count<Formula>(Complex{-2 + x * cell_size, -2 + y * cell_size}, max_iterations);
+                }
+            }
+        });
+
+        std::vector<bool> is_useful(grid_size * grid_size);
+        for (int64_t y = 0; y < grid_size; ++y) {
+            for (int64_t x = 0; x < grid_size; ++x) {
+                auto has_late_escape = false;
+                auto has_inside = false;
+                auto has_outside = false;
+                for (auto const corner : {y * corner_count + x, y * corner_count + x + 1, (y + 1) * corner_count + x, (y + 1) * corner_count + x + 1}) {
+                    has_late_escape = has_late_escape || (corners[corner] >= min_iterations && corners[corner] < max_iterations);
+                    has_inside = has_inside || corners[corner] == max_iterations;
+                    has_outside = has_outside || corners[corner] < max_iterations;
+                }
+                is_useful[y * grid_size + x] = has_late_escape || (has_inside && has_outside);
+            }
         }
 
-        auto const h = std::clamp<uint16_t>(hue, 0, 359);
-        auto const s = std::clamp<uint8_t>(saturation, 0, 100) / 100.0;
-        auto const l = std::clamp<uint8_t>(lightness, 0, 100) / 100.0;
-
-        auto const chroma = (1 - std::abs(2 * l - 1)) * s;
-        auto const h1 = h / 60.0;
-        auto const x = chroma * (1.0 - std::abs(std::fmod(h1, 2.0) - 1));
-
-        auto const [r1, g1, b1] = ([&]() {
-            switch (static_cast<int32_t>(std::floor(h1))) {
-            case 0:
-                return std::make_tuple(chroma, x, 0.0);
-            case 1:
-                return std::make_tuple(x, chroma, 0.0);
-            case 2:
-                return std::make_tuple(0.0, chroma, x);
-            case 3:
-                return std::make_tuple(0.0, x, chroma);
-            case 4:
-                return std::make_tuple(x, 0.0, chroma);
-            case 5:
-                return std::make_tuple(chroma, 0.0, x);
-            default:
-                return std::make_tuple(0.0, 0.0, 0.0);
+        auto sampler = std::make_shared<BuddhabrotSampler>(BuddhabrotSampler{formula, min_iterations, max_iterations, {}});
+        for (int64_t y = 0; y < grid_size; ++y) {
+            for (int64_t x = 0; x < grid_size; ++x) {
+                auto is_near_useful = false;
+                for (int64_t neighbour_y = std::max<int64_t>(y - 1, 0); neighbour_y <= std::min(y + 1, grid_size - 1); ++neighbour_y) {
+                    for (int64_t neighbour_x = std::max<int64_t>(x - 1, 0); neighbour_x <= std::min(x + 1, grid_size - 1); ++neighbour_x) {
+                        is_near_useful = is_near_useful || is_useful[neighbour_y * grid_size + neighbour_x];
+                    }
+                }
+                if (is_near_useful) {
+                    sampler->cells.push_back(y * grid_size + x);
+                }
             }
-        })();
+        }
 
-        auto const m = l - (chroma / 2.0);
+        // E.g. a min_iterations above max_iterations, nothing is counted anyway
+        if (sampler->cells.empty()) {
+            sampler->cells.resize(grid_size * grid_size);
+            std::iota(sampler->cells.begin(), sampler->cells.end(), 0);
+        }
+        return sampler;
+    }
 
-        auto const r = r1 + m;
-        auto const g = g1 + m;
-        auto const b = b1 + m;
+    [[nodiscard]] bool matches(std::size_t other_formula, int64_t other_min_iterations, int64_t other_max_iterations) const
+    {
+        return formula == other_formula && min_iterations == other_min_iterations && max_iterations == other_max_iterations;
+    }
 
-        return Color{
-            static_cast<uint8_t>(r * 255),
-            static_cast<uint8_t>(g * 255),
-            static_cast<uint8_t>(b * 255),
+    [[nodiscard]] Complex sample(SplitMix64& random) const
+    {
+        auto const cell = cells[random.next() % cells.size()];
+        auto const cell_size = 4.0 / buddhabrot_sampling_grid_size;
+        return Complex{
+            .real = -2 + (cell % buddhabrot_sampling_grid_size + random.uniform()) * cell_size,
+            .imag = -2 + (cell / buddhabrot_sampling_grid_size + random.uniform()) * cell_size,
         };
     }
 };
 
-struct Chunk;
-
-struct Buffer {
-    static Buffer init(int64_t width, int64_t height)
+struct BuddhabrotParameters {
+    int64_t width;
+    int64_t height;
+    Complex top_left;
+    double pixel_size;
+    std::size_t formula;
+    int64_t min_iterations; // Shorter orbits are not counted, they only add a haze around the set
+    int64_t max_iterations;
+    uint64_t samples; // Starting points to trace, 0 traces until the Buddhabrot is destroyed
+
+    static BuddhabrotParameters from_center(Complex center, double real_span, int64_t width, int64_t height, std::size_t formula, int64_t min_iterations, int64_t max_iterations, uint64_t samples)
     {
-        return Buffer{
-            width,
-            height,
-            std::vector<int32_t>(width * height),
+        auto const pixel_size = real_span / width;
+        return BuddhabrotParameters{
+            .width = width,
+            .height = height,
+            .top_left = Complex{
+                .real = center.real - pixel_size * width / 2,
+                .imag = center.imag - pixel_size * height / 2,
+            },
+            .pixel_size = pixel_size,
+            .formula = formula,
+            .min_iterations = min_iterations,
+            .max_iterations = max_iterations,
+            .samples = samples,
         };
     }
 
-    Buffer(int64_t width, int64_t height, std::vector<int32_t> buffer)
-        : m_width{width}
-        , m_height{height}
-        , m_buffer{buffer}
-    { }
+    bool operator==(BuddhabrotParameters const& other) const = default;
+};
 
-    void set(ScreenPosition position, Color color)
+// Orbit density rendering. Every point of every orbit that escapes after min_iterations to max_iterations iterations is
+// counted in a histogram of the image.
+// The orbits are traced in batches by tasks on the thread pool. Every task owns a shard with its own histogram, which is
+// added to the shared histogram under a lock from time to time, so tracing never writes to memory shared between threads.
+struct Buddhabrot {
+    Buddhabrot(Mandelbrot& mandelbrot, BuddhabrotParameters const& parameters, std::shared_ptr<BuddhabrotSampler const> sampler)
+        : m_state{std::make_shared<State>()}
     {
-        m_buffer[position.y * m_width + position.x] = color.color;
+        auto& state = *m_state;
+        state.parameters = parameters;
+        state.sampler = std::move(sampler);
+        state.histogram.resize(parameters.width * parameters.height);
+        state.start_time = Clock::now();
+
+        // Every shard holds a histogram of the whole image, so print resolutions get fewer shards than pool threads
+        auto const histogram_memory = state.histogram.size() * sizeof(uint32_t);
+        auto const shard_count = std::clamp<std::size_t>(max_chunk_memory / histogram_memory, 1, mandelbrot.thread_pool_size());
+
+        // Merging takes about a nanosecond per bin, the interval keeps the lock free most of the time
+        state.merge_interval = std::max<Clock::duration>(buddhabrot_merge_interval, std::chrono::nanoseconds{8 * histogram_memory * shard_count / sizeof(uint32_t)});
+
+        state.shards.resize(shard_count);
+        for (std::size_t i = 0; i < shard_count; ++i) {
+            auto& shard = state.shards[i];
+            shard.random = SplitMix64{i};
+            shard.remaining_samples = parameters.samples == 0 ? UINT64_MAX : (parameters.samples + shard_count - 1 - i) / shard_count;
+            shard.last_merge_time = state.start_time;
+        }
+
+        for (std::size_t i = 0; i < shard_count; ++i) {
+            mandelbrot.enqueue_task([&mandelbrot, state = m_state, i]() { run_batch(mandelbrot, state, i); });
+        }
     }
 
-    void set(int64_t position, Color color)
+    Buddhabrot(Buddhabrot const&) = delete;
+    Buddhabrot& operator=(Buddhabrot const&) = delete;
+
+    // Queued tasks keep the state alive and return as soon as they run
+    ~Buddhabrot()
     {
-        m_buffer[position] = color.color;
+        m_state->cancel = true;
     }
 
-    std::span<int32_t> buffer()
+    // Returns true once all samples are traced, never if the samples are unlimited
+    bool wait(std::chrono::milliseconds timeout) const
     {
-        return m_buffer;
+        std::unique_lock<std::mutex> lock{m_state->mutex};
+        return m_state->done_convar.wait_for(lock, timeout, [&]() { return m_state->finished_shards == m_state->shards.size(); });
     }
 
-    [[nodiscard]] int64_t width() const
+    [[nodiscard]] BuddhabrotParameters const& parameters() const
     {
-        return m_width;
+        return m_state->parameters;
     }
 
-    [[nodiscard]] int64_t height() const
+    // Samples in the shared histogram
+    [[nodiscard]] uint64_t samples() const
     {
-        return m_height;
+        std::lock_guard<std::mutex> lock{m_state->mutex};
+        return m_state->merged_samples;
     }
 
-    void resize(int64_t width, int64_t height)
+    // Per thread that traced orbits, the figure to compare between machines and versions
+    [[nodiscard]] double samples_per_second_per_core() const
     {
-        m_width = width;
-        m_height = height;
-        m_buffer.resize(width * height);
+        std::lock_guard<std::mutex> lock{m_state->mutex};
+        return m_state->busy_seconds > 0 ? m_state->merged_samples / m_state->busy_seconds : 0;
     }
 
-    void fill(Color color)
+    // The shared histogram, buffer has to have the size of the image
+    void render(Buffer& buffer) const
     {
-        std::fill(m_buffer.begin(), m_buffer.end(), color.color);
+        std::lock_guard<std::mutex> lock{m_state->mutex};
+        auto const& histogram = m_state->histogram;
+        auto const max_count = *std::max_element(histogram.begin(), histogram.end());
+        for (std::size_t i = 0; i < histogram.size(); ++i) {
+            buffer.set(i, color(histogram[i], max_count));
+        }
     }
 
-    void blit(Chunk const&, ScreenPosition);
+    // Streams the shared histogram into a QOI file, a band of rows at a time
+    bool export_qoi(std::filesystem::path const& filepath) const
+    {
+        auto const& parameters = m_state->parameters;
+        auto writer = QOIFileWriter::open(filepath.c_str(), parameters.width, parameters.height);
+        if (!writer) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock{m_state->mutex};
+        auto const& histogram = m_state->histogram;
+        auto const max_count = *std::max_element(histogram.begin(), histogram.end());
+        int64_t constexpr band_height = 64;
+        std::vector<Color> band(parameters.width * band_height);
+        for (int64_t y = 0; y < parameters.height; y += band_height) {
+            auto const row_count = std::min(band_height, parameters.height - y);
+            for (int64_t i = 0; i < row_count * parameters.width; ++i) {
+                band[i] = color(histogram[y * parameters.width + i], max_count);
+            }
+            if (!writer->write_rows(band.data(), row_count)) {
+                return false;
+            }
+        }
+        return writer->finish();
+    }
 
 private:
-    int64_t m_width;
-    int64_t m_height;
-    std::vector<int32_t> m_buffer;
-};
+    using Clock = std::chrono::steady_clock;
+
+    // Only accessed by the tasks of the shard, one at a time
+    struct Shard {
+        std::vector<uint32_t> histogram;
+        SplitMix64 random{0};
+        uint64_t remaining_samples{0};
+        uint64_t unmerged_samples{0};
+        double unmerged_seconds{0};
+        Clock::time_point last_merge_time;
+    };
 
-struct Chunk {
-    static Chunk create(Complex position, double complex_size, int64_t max_iterations_local)
-    {
-        return Chunk{
-            position,
-            complex_size,
-            max_iterations_local,
-        };
+    struct State {
+        BuddhabrotParameters parameters;
+        std::shared_ptr<BuddhabrotSampler const> sampler;
+        std::vector<Shard> shards;
+        Clock::time_point start_time;
+        Clock::duration merge_interval;
+        std::atomic<bool> cancel{false};
+
+        std::mutex mutex; // Guards everything below
+        std::condition_variable done_convar;
+        std::vector<uint32_t> histogram;
+        uint64_t merged_samples{0};
+        double busy_seconds{0};
+        std::size_t finished_shards{0};
     };
 
-    static Chunk create_dummy()
+    std::shared_ptr<State> m_state;
+
+    // Square root of the density, so the faint orbits far from the set stay visible
+    [[nodiscard]] static Color color(uint32_t count, uint32_t max_count)
     {
-        return Chunk{};
+        auto const value = static_cast<uint8_t>(std::sqrt(static_cast<double>(count) / std::max<uint32_t>(max_count, 1)) * 255);
+        return Color{value, value, value};
     }
 
-    void compute()
+    static void run_batch(Mandelbrot& mandelbrot, std::shared_ptr<State> const& state, std::size_t shard_index)
     {
-        if (m_ready) {
+        if (state->cancel) {
             return;
         }
 
-#ifdef __AVX__
-        compute_avx_double();
-#else
-        compute_double();
-#endif
+        auto& shard = state->shards[shard_index];
+        if (shard.histogram.empty()) {
+            shard.histogram.resize(state->histogram.size());
+        }
 
-        switch (color_function) {
-        case 0:
-            colorize_black_white();
-            break;
-        case 1:
-            colorize_hsl();
-            break;
-        case 2:
-            colorize_hsl_multicolor();
-            break;
-        case 3:
-            colorize_phong();
-            break;
+        auto const start = Clock::now();
+        auto const samples = std::min<uint64_t>(buddhabrot_batch_size, shard.remaining_samples);
+        with_formula(state->parameters.formula, [&]<typename Formula>() {
+            trace_orbits<Formula>(*state, shard, samples);
+        });
+        auto const end = Clock::now();
+
+        shard.remaining_samples -= samples;
+        shard.unmerged_samples += samples;
+        shard.unmerged_seconds += std::chrono::duration<double>(end - start).count();
+
+        auto const is_finished = shard.remaining_samples == 0;
+        if (is_finished || end - shard.last_merge_time >= state->merge_interval) {
+            std::lock_guard<std::mutex> lock{state->mutex};
+            for (std::size_t i = 0; i < shard.histogram.size(); ++i) {
+                state->histogram[i] += shard.histogram[i];
+            }
+            state->merged_samples += shard.unmerged_samples;
+            state->busy_seconds += shard.unmerged_seconds;
+            state->finished_shards += is_finished;
+
+            std::fill(shard.histogram.begin(), shard.histogram.end(), 0);
+            shard.unmerged_samples = 0;
+            shard.unmerged_seconds = 0;
+            shard.last_merge_time = end;
         }
 
-        m_ready = true;
-    }
+        if (is_finished) {
+            shard.histogram = {};
+            state->done_convar.notify_all();
+            return;
+        }
 
-    [[nodiscard]] Color const* buffer() const
-    {
-        return m_buffer.data();
+        mandelbrot.enqueue_task([&mandelbrot, state, shard_index]() { run_batch(mandelbrot, state, shard_index); });
     }
 
-    [[nodiscard]] bool is_ready() const
+    // Traces samples starting points, rounded up to whole vectors. The escape count is found first and only orbits that are
+    // counted are iterated again to record them. For conjugate symmetric formulas, the orbit of conj(point) is conj(orbit),
+    // so it is recorded as well.
+    template <typename Formula>
+    static void trace_orbits(State const& state, Shard& shard, uint64_t samples)
     {
-        return m_ready;
-    }
+        auto const& parameters = state.parameters;
+        auto const inverse_pixel_size = 1 / parameters.pixel_size;
+        auto const record = [&](double real, double imag) {
+            auto const x = (real - parameters.top_left.real) * inverse_pixel_size;
+            if (x < 0 || x >= parameters.width) {
+                return;
+            }
+            auto const y = (imag - parameters.top_left.imag) * inverse_pixel_size;
+            if (y >= 0 && y < parameters.height) {
+                ++shard.histogram[static_cast<int64_t>(y) * parameters.width + static_cast<int64_t>(x)];
+            }
+            if constexpr (Formula::CONJUGATE_SYMMETRIC) {
+                auto const mirrored_y = (-imag - parameters.top_left.imag) * inverse_pixel_size;
+                if (mirrored_y >= 0 && mirrored_y < parameters.height) {
+                    ++shard.histogram[static_cast<int64_t>(mirrored_y) * parameters.width + static_cast<int64_t>(x)];
+                }
+            }
+        };
 
-    [[nodiscard]] double complex_size() const
-    {
-        return m_complex_size;
-    }
+        for (uint64_t sample = 0; sample < samples; sample += 4) {
+            std::array<Complex, 4> points;
+            for (auto& point : points) {
+                point = state.sampler->sample(shard.random);
+            }
 
-    void update_last_access_time()
-    {
-        m_last_access_time = frame_number;
+#ifdef __AVX__
+            auto const const_1 = _mm256_set1_pd(1);
+            auto const const_4 = _mm256_set1_pd(4);
+            auto const pixel_real = _mm256_set_pd(points[3].real, points[2].real, points[1].real, points[0].real);
+            auto const pixel_imag = _mm256_set_pd(points[3].imag, points[2].imag, points[1].imag, points[0].imag);
+
+            __m256d z_real;
+            __m256d z_imag;
+            __m256d c_real;
+            __m256d c_imag;
+            Formula::start(pixel_real, pixel_imag, z_real, z_imag, c_real, c_imag);
+            auto z_real2 = _mm256_mul_pd(z_real, z_real);
+            auto z_imag2 = _mm256_mul_pd(z_imag, z_imag);
+            auto active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+            auto counts = _mm256_setzero_pd();
+
+            // Like compute_points_avx_double()
+            for (int64_t iteration = 0; iteration < parameters.max_iterations; ++iteration) {
+                active = _mm256_and_pd(active, _mm256_cmp_pd(_mm256_add_pd(z_real2, z_imag2), const_4, _CMP_LT_OQ));
+                if (_mm256_testz_pd(active, active)) {
+                    break;
+                }
+                counts = _mm256_add_pd(counts, _mm256_and_pd(active, const_1));
+                Formula::step(z_real, z_imag, z_real2, z_imag2, c_real, c_imag);
+                z_real2 = _mm256_mul_pd(z_real, z_real);
+                z_imag2 = _mm256_mul_pd(z_imag, z_imag);
+            }
+
+            alignas(32) std::array<double, 4> lane_counts;
+            _mm256_store_pd(lane_counts.data(), counts);
+            int64_t longest_orbit = 0;
+            for (auto& count : lane_counts) {
+                if (count < parameters.min_iterations || count >= parameters.max_iterations) {
+                    count = 0;
+                }
+                longest_orbit = std::max(longest_orbit, static_cast<int64_t>(count));
+            }
+
+            Formula::start(pixel_real, pixel_imag, z_real, z_imag, c_real, c_imag);
+            z_real2 = _mm256_mul_pd(z_real, z_real);
+            z_imag2 = _mm256_mul_pd(z_imag, z_imag);
+            for (int64_t iteration = 1; iteration <= longest_orbit; ++iteration) {
+                Formula::step(z_real, z_imag, z_real2, z_imag2, c_real, c_imag);
+                z_real2 = _mm256_mul_pd(z_real, z_real);
+                z_imag2 = _mm256_mul_pd(z_imag, z_imag);
+
+                alignas(32) std::array<double, 4> lane_real;
+                alignas(32) std::array<double, 4> lane_imag;
+                _mm256_store_pd(lane_real.data(), z_real);
+                _mm256_store_pd(lane_imag.data(), z_imag);
+                for (std::size_t lane = 0; lane < 4; ++lane) {
+                    if (iteration <= lane_counts[lane]) {
+                        record(lane_real[lane], lane_imag[lane]);
+                    }
+                }
+            }
+#else
+            for (auto const& point : points) {
+                auto const count = escape_count<Formula>(point, parameters.max_iterations);
+                if (count < parameters.min_iterations || count >= parameters.max_iterations) {
+                    continue;
+                }
+
+                double z_real;
+                double z_imag;
+                double c_real;
+                double c_imag;
+                Formula::start(point.real, point.imag, z_real, z_imag, c_real, c_imag);
+                auto z_real2 = z_real * z_real;
+                auto z_imag2 = z_imag * z_imag;
+                for (int64_t iteration = 1; iteration <= count; ++iteration) {
+                    Formula::step(z_real, z_imag, z_real2, z_imag2, c_real, c_imag);
+                    z_real2 = z_real * z_real;
+                    z_imag2 = z_imag * z_imag;
+                    record(z_real, z_imag);
+                }
+            }
+#endif
+        }
     }
+};
 
-    [[nodiscard]] std::size_t last_access_time() const
-    {
-        return m_last_access_time;
+// Traces the Buddhabrot, printing the progress, and writes it to filepath
+bool export_buddhabrot(Mandelbrot& mandelbrot, BuddhabrotParameters const& parameters, std::filesystem::path const& filepath)
+{
+    auto const sampler = BuddhabrotSampler::create(parameters.formula, parameters.min_iterations, parameters.max_iterations);
+    auto const buddhabrot = Buddhabrot{mandelbrot, parameters, sampler};
+    while (!buddhabrot.wait(std::chrono::seconds{1})) {
+        auto const samples = buddhabrot.samples();
+        std::fprintf(stderr, "\r%s/%s samples (%.1f%%), %s samples/s per core ", format_si(samples).c_str(), format_si(parameters.samples).c_str(),
+            100.0 * samples / parameters.samples, format_si(buddhabrot.samples_per_second_per_core()).c_str());
     }
+    std::fprintf(stderr, "\r%s samples, %s samples/s per core\n", format_si(buddhabrot.samples()).c_str(), format_si(buddhabrot.samples_per_second_per_core()).c_str());
 
-private:
-    bool m_ready{false};
-    Complex m_position{0, 0};
-    double m_complex_size{0};
-    std::array<Color, chunk_size * chunk_size> m_buffer;
-    std::size_t m_last_access_time{0};
-    int64_t m_max_iterations_local{0};
-
-    Chunk(Complex position, double complex_size, int64_t max_iterations_local)
-        : m_position{position}
-        , m_complex_size{complex_size}
-        , m_max_iterations_local{max_iterations_local}
-    { }
-
-    Chunk()
-        : m_ready{true}
-    {
-        m_buffer.fill(default_color);
+    if (!buddhabrot.export_qoi(filepath)) {
+        std::cerr << "Failed to write " << filepath.string() << "\n";
+        return false;
     }
+    return true;
+}
 
-    void compute_double()
-    {
-        Complex c = m_position;
-        double const pixel_delta = m_complex_size / chunk_size;
+// A composed frame and the view it was composed from
+struct Frame {
+    Buffer buffer;
+    uint64_t view_sequence{0};
+    uint64_t frame_number{0};
+    bool is_resolved{false};
+};
 
-        for (int64_t buffer_position = 0; buffer_position < static_cast<int64_t>(m_buffer.size()); ++buffer_position) {
-            if (buffer_position > 0 && buffer_position % chunk_size == 0) {
-                c.real = m_position.real;
-                c.imag += pixel_delta;
-            }
+auto mandelbrot = Mandelbrot{};
+auto performance_hud = PerformanceHud{};
+
+// Input state, only accessed by the Wayland thread
+auto view = ViewState{};
+auto cursor_position = ScreenPosition{0, 0};
+auto cursor_start_local_position = ScreenPosition{0, 0};
+auto cursor_start_global_position = ScreenPosition{0, 0};
+auto lmb_pressed = false;
 
-            Complex z = {0, 0};
-            Complex z2 = {0, 0};
+// Shared between the Wayland thread and the render thread
+TripleBuffer<ViewState> published_view;
+TripleBuffer<Frame> frames;
+std::atomic<uint64_t> requested_frame_count{0};
+std::atomic<uint32_t> requested_frame_time{0};
+std::atomic<bool> render_thread_running{true};
+
+// Progressive Buddhabrot of the view, only accessed by the render thread. It starts over whenever the view changes.
+std::unique_ptr<Buddhabrot> buddhabrot_preview;
+std::shared_ptr<BuddhabrotSampler const> buddhabrot_sampler;
+
+// Posters and screenshots exported from the viewer, the threads are started and joined by the render thread
+struct ExportJob {
+    char const* kind; // For the messages
+    std::filesystem::path path;
+    bool resumable; // Unfinished exports that cannot be resumed are deleted on exit
+    PosterProgress progress;
+    std::atomic<bool> finished{false};
+    std::atomic<bool> succeeded{false};
+    std::thread thread;
+};
+std::list<ExportJob> export_jobs;
 
-            int32_t iteration = 0;
-            for (; iteration < m_max_iterations_local; ++iteration) {
-                auto abs = z2.real + z2.imag;
-                if (abs >= 4)
-                    break;
-                z.imag = 2 * z.real * z.imag + c.imag;
-                z.real = z2.real - z2.imag + c.real;
-                z2.real = z.real * z.real;
-                z2.imag = z.imag * z.imag;
-            }
-            m_buffer[buffer_position].color = iteration;
+void publish_view()
+{
+    ++view.sequence;
+    published_view.back() = view;
+    published_view.publish();
+}
 
-            c.real += pixel_delta;
+// The first unused "<prefix>-<n><extension>", exports that have not created their file yet count as used
+std::filesystem::path next_export_path(std::string_view prefix, std::string_view extension = ".qoi")
+{
+    for (int image_number = 0;; ++image_number) {
+        auto const path = std::filesystem::path{std::string{prefix} + "-" + std::to_string(image_number) + std::string{extension}};
+        auto const is_exporting = std::any_of(export_jobs.begin(), export_jobs.end(), [&](ExportJob const& job) { return job.path == path; });
+        if (!is_exporting && !std::filesystem::exists(path)) {
+            return path;
         }
     }
+}
 
-    void compute_avx_double()
-    {
-        auto const pixel_delta_single = m_complex_size / chunk_size;
-
-        auto const pixel_delta_imag = _mm256_set_pd(
-            pixel_delta_single,
-            pixel_delta_single,
-            pixel_delta_single,
-            pixel_delta_single);
-
-        auto const pixel_delta_real = _mm256_set_pd(
-            pixel_delta_single * 4,
-            pixel_delta_single * 4,
-            pixel_delta_single * 4,
-            pixel_delta_single * 4);
-
-        // Why do they have to be ordered like this?
-        auto const c_real_start = _mm256_set_pd(
-            m_position.real + pixel_delta_single * 3,
-            m_position.real + pixel_delta_single * 2,
-            m_position.real + pixel_delta_single * 1,
-            m_position.real + pixel_delta_single * 0);
-
-        auto c_real = c_real_start;
-
-        auto c_imag = _mm256_set_pd(
-            m_position.imag,
-            m_position.imag,
-            m_position.imag,
-            m_position.imag);
-
-        auto const const_0 = _mm256_set_pd(0, 0, 0, 0);
-        auto const const_2 = _mm256_set_pd(2, 2, 2, 2);
-        auto const const_4 = _mm256_set_pd(4, 4, 4, 4);
+// The view without the overlay, scale times larger
+ViewportParameters export_parameters(ViewState const& view_snapshot, int64_t scale)
+{
+    auto const pixel_size = view_snapshot.get_chunk_resolution() / chunk_size;
+    auto const top_left = screen_space_to_mandelbrot_space(view_snapshot.top_left_global, view_snapshot.get_chunk_resolution());
+    auto const center = Complex{
+        .real = top_left.real + pixel_size * view_snapshot.width / 2,
+        .imag = top_left.imag + pixel_size * view_snapshot.height / 2,
+    };
+    return ViewportParameters::from_center(center, pixel_size * view_snapshot.width, view_snapshot.width * scale, view_snapshot.height * scale,
+        view_snapshot.formula, view_snapshot.max_iterations, view_snapshot.color_function, view_snapshot.antialiasing_samples);
+}
 
-        {
-            Color color_max_iterations;
-            color_max_iterations.color = m_max_iterations_local;
-            m_buffer.fill(color_max_iterations);
-        }
+// The chunks are computed on the background queue of the pool, so the viewer keeps its frame rate, and encoded on the
+// thread of the job
+using ExportFunction = bool (*)(Mandelbrot&, ViewportParameters const&, std::filesystem::path const&, PosterProgress&, bool);
 
-        for (int64_t buffer_position = 0; buffer_position < static_cast<int64_t>(m_buffer.size()); buffer_position += 4) {
-            if (buffer_position > 0 && buffer_position % chunk_size == 0) {
-                c_real = c_real_start;
-                c_imag = _mm256_add_pd(c_imag, pixel_delta_imag);
-            }
+void start_export(char const* kind, std::filesystem::path path, bool resumable, ViewportParameters const& parameters, ExportFunction export_function)
+{
+    auto& job = export_jobs.emplace_back();
+    job.kind = kind;
+    job.path = std::move(path);
+    job.resumable = resumable;
+    job.thread = std::thread{[&job, parameters, export_function]() {
+        trace_set_thread_name("export");
+        job.succeeded = export_function(mandelbrot, parameters, job.path, job.progress, false);
+        job.finished = true;
+    }};
+}
 
-            auto z_real = const_0;
-            auto z_imag = const_0;
-            auto z_real2 = const_0;
-            auto z_imag2 = const_0;
-
-            for (int32_t iteration = 0; iteration < m_max_iterations_local; ++iteration) {
-                auto abs = _mm256_add_pd(z_real2, z_imag2);
-                auto comparison_mask = reinterpret_cast<__m256i>(_mm256_cmp_pd(abs, const_4, _CMP_GE_OS));
-                int32_t done_count = 0;
-
-#define CHECK_FIELD_64(N)                                                          \
-    {                                                                              \
-        auto CONCAT(field_is_done_, N) = _mm256_extract_epi64(comparison_mask, N); \
-        if (CONCAT(field_is_done_, N)) {                                           \
-            if (m_buffer[buffer_position + N].color == m_max_iterations_local) {   \
-                m_buffer[buffer_position + N].color = iteration;                   \
-            }                                                                      \
-            ++done_count;                                                          \
-        }                                                                          \
-    }
-                CHECK_FIELD_64(0)
-                CHECK_FIELD_64(1)
-                CHECK_FIELD_64(2)
-                CHECK_FIELD_64(3)
-
-                if (done_count == 4) {
-                    break;
-                }
+void start_screenshot(ViewState const& view_snapshot)
+{
+    start_export("screenshot", next_export_path("mandelbrot"), false, export_parameters(view_snapshot, screenshot_scale), export_poster);
+}
 
-                z_imag = _mm256_add_pd(_mm256_mul_pd(const_2, _mm256_mul_pd(z_real, z_imag)), c_imag);
-                z_real = _mm256_add_pd(_mm256_sub_pd(z_real2, z_imag2), c_real);
+// The raw field of what a screenshot would show, the color function and anti-aliasing do not apply
+void start_field_export(ViewState const& view_snapshot)
+{
+    auto const path = next_export_path("mandelbrot-field", ".npy");
+    auto const parameters = export_parameters(view_snapshot, screenshot_scale);
 
-                z_real2 = _mm256_mul_pd(z_real, z_real);
-                z_imag2 = _mm256_mul_pd(z_imag, z_imag);
-            }
+    auto const real_span = parameters.pixel_size * parameters.width;
+    std::printf("Exporting field, equivalent command: Mandelbrot --formula %zu --field %s %ld %ld %.17g %.17g %.17g %ld\n",
+        parameters.formula, path.c_str(), parameters.width, parameters.height,
+        parameters.top_left.real + real_span / 2, parameters.top_left.imag + parameters.pixel_size * parameters.height / 2, real_span,
+        parameters.max_iterations);
+
+    start_export("field", path, false, parameters, export_field);
+}
+
+void start_poster_export(ViewState const& view_snapshot)
+{
+    auto const path = next_export_path("mandelbrot-poster");
+    auto const parameters = export_parameters(view_snapshot, poster_scale);
+
+    // The same command resumes the export if the viewer is closed before it finishes
+    auto const real_span = parameters.pixel_size * parameters.width;
+    std::printf("Exporting poster, equivalent command: Mandelbrot --formula %zu --antialiasing %ld --poster %s %ld %ld %.17g %.17g %.17g %ld %zu\n",
+        parameters.formula, parameters.antialiasing_samples, path.c_str(), parameters.width, parameters.height,
+        parameters.top_left.real + real_span / 2, parameters.top_left.imag + parameters.pixel_size * parameters.height / 2, real_span,
+        parameters.max_iterations, parameters.color_function);
+
+    start_export("poster", path, true, parameters, export_poster);
+}
 
-            c_real = _mm256_add_pd(c_real, pixel_delta_real);
+void update_exports()
+{
+    for (auto job = export_jobs.begin(); job != export_jobs.end();) {
+        if (!job->finished) {
+            ++job;
+            continue;
         }
+
+        job->thread.join();
+        last_message = job->succeeded ? std::string{"Saved "} + job->kind + " to " + std::filesystem::absolute(job->path).string() : std::string{"Failed to export "} + job->kind;
+        last_message_time = global_time;
+        job = export_jobs.erase(job);
     }
+}
 
-    void scale()
-    {
-        for (int32_t buffer_position = m_buffer.size() - 1; buffer_position > 0; --buffer_position) {
-            auto target_x = buffer_position % chunk_size;
-            auto target_y = buffer_position / chunk_size;
-            auto source_x = target_x;
-            auto source_y = target_y;
-            auto source_buffer_position = source_x + source_y * chunk_size;
-            m_buffer[buffer_position] = m_buffer[source_buffer_position];
+// Unfinished posters can be resumed with the printed command, other unfinished exports are deleted
+void cancel_exports()
+{
+    for (auto& job : export_jobs) {
+        job.progress.cancel = true;
+        job.thread.join();
+        if (!job.succeeded && !job.resumable) {
+            std::error_code error;
+            std::filesystem::remove(job.path, error);
+            std::filesystem::remove(std::filesystem::path{job.path}.concat(".progress"), error);
         }
     }
+    export_jobs.clear();
+}
 
-    void colorize_black_white()
-    {
-        for (uint32_t buffer_position = 0; buffer_position < m_buffer.size(); ++buffer_position) {
-            auto const iterations = m_buffer[buffer_position].color;
-            if (iterations == m_max_iterations_local) {
-                m_buffer[buffer_position] = Color{};
-            } else {
-                m_buffer[buffer_position] = Color{
-                    255,
-                    255,
-                    255,
-                };
-            }
-        }
+void update_buddhabrot_preview(ViewState const& view_snapshot)
+{
+    auto const chunk_resolution = view_snapshot.get_chunk_resolution();
+    auto const parameters = BuddhabrotParameters{
+        .width = view_snapshot.width,
+        .height = view_snapshot.height,
+        .top_left = screen_space_to_mandelbrot_space(view_snapshot.top_left_global, chunk_resolution),
+        .pixel_size = chunk_resolution / chunk_size,
+        .formula = view_snapshot.formula,
+        .min_iterations = buddhabrot_preview_min_iterations,
+        .max_iterations = view_snapshot.base_max_iterations(),
+        .samples = 0,
+    };
+    if (buddhabrot_preview && buddhabrot_preview->parameters() == parameters) {
+        return;
     }
 
-    void colorize_hsl()
-    {
-        for (uint32_t buffer_position = 0; buffer_position < m_buffer.size(); ++buffer_position) {
-            auto const iterations = m_buffer[buffer_position].color;
-            auto const iterations_ratio = static_cast<double>(iterations) / static_cast<double>(m_max_iterations_local);
-            if (iterations == m_max_iterations_local) {
-                m_buffer[buffer_position] = Color{};
-            } else {
-                m_buffer[buffer_position] = HSLColor{
-                    100,
-                    static_cast<uint8_t>(iterations_ratio * 100),
-                    std::clamp<uint8_t>(static_cast<uint8_t>(iterations_ratio * 100), 20, 80),
-                } /* wtf, clang-format? */
-                                                .to_rgb();
-            }
-        }
+    if (!buddhabrot_sampler || !buddhabrot_sampler->matches(parameters.formula, parameters.min_iterations, parameters.max_iterations)) {
+        buddhabrot_sampler = BuddhabrotSampler::create(parameters.formula, parameters.min_iterations, parameters.max_iterations);
     }
+    buddhabrot_preview.reset();
+    buddhabrot_preview = std::make_unique<Buddhabrot>(mandelbrot, parameters, buddhabrot_sampler);
+}
 
-    void colorize_hsl_multicolor()
-    {
-        for (uint32_t buffer_position = 0; buffer_position < m_buffer.size(); ++buffer_position) {
-            auto const iterations = m_buffer[buffer_position].color;
-            auto const iterations_ratio = static_cast<double>(iterations) / static_cast<double>(m_max_iterations_local);
-            if (iterations == m_max_iterations_local) {
-                m_buffer[buffer_position] = Color{};
-            } else {
-                m_buffer[buffer_position] = HSLColor{
-                    .hue = static_cast<uint16_t>((iterations_ratio) * 360),
-                    .saturation = 50,
-                    .lightness = 50,
-                }
-                                                .to_rgb();
-            }
+void render_overlay(Buffer& buffer, ViewState const& view_snapshot)
+{
+    int line = 0;
+    auto render_next_line = [&](auto text) {
+        auto position = ScreenPosition{
+            .x = 10,
+            .y = 10 + line++ * 8 * text_scale,
+        };
+        render_text_to_buffer(&buffer, position, text);
+    };
+
+    if (view_snapshot.info_text_visible) {
+        render_next_line("formula: " + with_formula(view_snapshot.formula, []<typename Formula>() { return std::string{Formula::NAME}; }));
+        if (view_snapshot.max_iterations == auto_iterations) {
+            auto const& view_iterations = mandelbrot.view_iterations();
+            auto const total_iterations = view_iterations.computed_iterations + view_iterations.saved_iterations;
+            render_next_line("max iterations: auto, " + std::to_string(view_snapshot.base_max_iterations()) + " (chunks up to " + std::to_string(view_iterations.highest_limit) + ")");
+            render_next_line("iterations saved: " + format_si(view_iterations.saved_iterations) + " (" + std::to_string(total_iterations > 0 ? view_iterations.saved_iterations * 100 / total_iterations : 0) + "%)");
+        } else {
+            render_next_line("max iterations: " + std::to_string(view_snapshot.max_iterations));
         }
+        render_next_line("zoom: " + std::to_string(view_snapshot.zoom_level));
+        if (buddhabrot_preview) {
+            render_next_line("buddhabrot: " + format_si(buddhabrot_preview->samples()) + " samples, " + format_si(buddhabrot_preview->samples_per_second_per_core()) + " samples/s per core");
+        }
+        render_next_line("anti-aliasing: " + (view_snapshot.antialiasing_samples > 0 ? std::to_string(view_snapshot.antialiasing_samples) + " samples" : std::string{"off"}));
+        auto const top_left_mandelbrot_space = screen_space_to_mandelbrot_space(view_snapshot.top_left_global, view_snapshot.get_chunk_resolution());
+        render_next_line("mandelbrot real: " + std::to_string(top_left_mandelbrot_space.real));
+        render_next_line("mandelbrot imag: " + std::to_string(top_left_mandelbrot_space.imag));
+        ++line;
     }
 
-    struct Vec3 {
-        float x;
-        float y;
+    if (view_snapshot.perf_hud_visible) {
+        performance_hud.render_lines(mandelbrot, render_next_line);
+        performance_hud.render_graph(buffer, ScreenPosition{.x = 10, .y = 10 + line * 8 * text_scale});
+        line += PerformanceHud::GRAPH_HEIGHT / (8 * text_scale) + 1;
+        ++line;
+    }
 
-        // Positive in direction towards viewer
-        float z;
+    if (view_snapshot.help_text_visible) {
+        render_next_line("Keybindings:");
+        render_next_line("H: Toggle this help text");
+        render_next_line("I: Toggle informations");
+        render_next_line("P: Toggle performance HUD");
+        render_next_line("S: Screenshot");
+        render_next_line("E: Export poster");
+        render_next_line("R: Export raw iteration field");
+        render_next_line("+: Increase max iterations");
+        render_next_line("-: Decrease max iterations");
+        render_next_line("M: Toggle automatic max iterations");
+        render_next_line("B: Toggle Buddhabrot");
+        render_next_line("C: Change colors");
+        render_next_line("F: Change formula");
+        render_next_line("A: Change anti-aliasing samples");
+        ++line;
+    }
 
-        Vec3 operator-(Vec3 const& other) const
-        {
-            return Vec3{
-                .x = x - other.x,
-                .y = y - other.y,
-                .z = z - other.z,
-            };
-        };
+    for (auto const& job : export_jobs) {
+        render_next_line(std::string{"Exporting "} + job.kind + ": band " + std::to_string(job.progress.completed_bands) + "/" + std::to_string(job.progress.band_count));
+    }
 
-        float operator*(Vec3 const& other) const
-        {
-            return x * other.x + y * other.y + z * other.z;
-        };
+    if (last_message_time + message_display_duration >= global_time) {
+        render_next_line(last_message);
+    }
+}
 
-        [[nodiscard]] Vec3 normalize() const
-        {
-            auto length = sqrt(x * x + y * y + z * z);
-            return Vec3{
-                .x = x / length,
-                .y = y / length,
-                .z = z / length,
-            };
+// Composes frames from the latest published view state whenever the Wayland thread asks for one,
+// so slow frames and cache eviction never delay input handling.
+void render_thread_main()
+{
+    trace_set_thread_name("render");
+
+    auto view_snapshot = ViewState{};
+    auto active_color_function = view_snapshot.color_function;
+    auto active_formula = view_snapshot.formula;
+    uint32_t handled_screenshot_requests = 0;
+    uint32_t handled_poster_requests = 0;
+    uint32_t handled_field_requests = 0;
+    uint64_t handled_frame_count = 0;
+    auto last_frame_start = PerformanceHud::Clock::now();
+
+    while (true) {
+        requested_frame_count.wait(handled_frame_count, std::memory_order_acquire);
+        if (!render_thread_running) {
+            break;
         }
-    };
+        handled_frame_count = requested_frame_count.load(std::memory_order_acquire);
+        global_time = requested_frame_time.load(std::memory_order_relaxed);
 
-    void colorize_phong()
-    {
-        // auto base_color = Color{255, 127, 80};
-        auto light_direction = Vec3{.x = 1.0f, .y = 1.0f, .z = 1.0f}.normalize();
-
-        for (uint32_t buffer_position = 0; buffer_position < m_buffer.size(); ++buffer_position) {
-            auto x = buffer_position % chunk_size;
-            auto y = buffer_position / chunk_size;
-
-            auto z = m_buffer[buffer_position].color;
-            auto z_right = x < chunk_size - 1 ? m_buffer[buffer_position + 1].color : std::lerp(m_buffer[buffer_position - 1].color, m_buffer[buffer_position].color, 1.5f);
-            auto z_below = y < chunk_size - 1 ? m_buffer[buffer_position + chunk_size].color : std::lerp(m_buffer[buffer_position - chunk_size].color, m_buffer[buffer_position].color, 1.5f);
-
-            // Calculate normal from the point, one to the right and one below
-            auto current = Vec3{
-                .x = static_cast<float>(x),
-                .y = static_cast<float>(y),
-                .z = static_cast<float>(z),
-            };
-
-            auto right = Vec3{
-                .x = static_cast<float>(x + 1),
-                .y = static_cast<float>(y),
-                .z = static_cast<float>(z_right),
-            };
+        if (published_view.update()) {
+            view_snapshot = published_view.front();
+        }
 
-            auto below = Vec3{
-                .x = static_cast<float>(x),
-                .y = static_cast<float>(y + 1),
-                .z = static_cast<float>(z_below),
-            };
+        if (view_snapshot.color_function != active_color_function || view_snapshot.formula != active_formula) {
+            active_color_function = view_snapshot.color_function;
+            active_formula = view_snapshot.formula;
+            // Clearing the cache drops the queued tasks, so the preview starts over with new ones
+            buddhabrot_preview.reset();
+            mandelbrot.clear_cache();
+        }
 
-            auto a = right - current;
-            auto b = below - current;
+        if (view_snapshot.width <= 0 || view_snapshot.height <= 0) {
+            continue;
+        }
 
-            auto normal = Vec3{
-                .x = a.y * b.z - a.z * b.y,
-                .y = a.z * b.x - a.x * b.z,
-                .z = a.x * b.y - a.y * b.x,
-            }
-                              .normalize();
+        update_exports();
+        if (view_snapshot.poster_requests != handled_poster_requests) {
+            handled_poster_requests = view_snapshot.poster_requests;
+            start_poster_export(view_snapshot);
+        }
+        if (view_snapshot.field_requests != handled_field_requests) {
+            handled_field_requests = view_snapshot.field_requests;
+            start_field_export(view_snapshot);
+        }
+        if (view_snapshot.screenshot_requests != handled_screenshot_requests) {
+            handled_screenshot_requests = view_snapshot.screenshot_requests;
+            start_screenshot(view_snapshot);
+        }
 
-            auto diffuse_factor = std::max(normal * light_direction, 0.0f);
+        auto const frame_start = PerformanceHud::Clock::now();
+
+        auto const frame_span = TraceSpan{"frame", frame_number};
+
+        auto& frame = frames.back();
+        auto& buffer = frame.buffer;
+        buffer.resize(view_snapshot.width, view_snapshot.height);
+        frame.view_sequence = view_snapshot.sequence;
+        frame.frame_number = frame_number;
+
+        if (view_snapshot.buddhabrot_visible) {
+            auto const span = TraceSpan{"render buddhabrot"};
+            update_buddhabrot_preview(view_snapshot);
+            buddhabrot_preview->render(buffer);
+            frame.is_resolved = false;
+        } else {
+            auto const span = TraceSpan{"render chunks"};
+            buddhabrot_preview.reset();
+            frame.is_resolved = render_view(mandelbrot, buffer, view_snapshot) && !view_snapshot.is_interacting();
+        }
+        {
+            auto const span = TraceSpan{"invalidate cache"};
+            mandelbrot.invalidate_cache();
+        }
+        {
+            auto const span = TraceSpan{"render overlay"};
+            performance_hud.update_rates(mandelbrot.statistics());
+            render_overlay(buffer, view_snapshot);
+        }
 
-            auto base_color = HSLColor{
-                .hue = static_cast<uint16_t>((static_cast<float>(m_buffer[buffer_position].color) / m_max_iterations_local) * 360),
-                .saturation = 50,
-                .lightness = 50,
-            }
-                                  .to_rgb();
+        performance_hud.record_frame(frame_start - last_frame_start, PerformanceHud::Clock::now() - frame_start);
+        last_frame_start = frame_start;
 
-            m_buffer[buffer_position] = Color{
-                static_cast<uint8_t>(base_color.r * diffuse_factor),
-                static_cast<uint8_t>(base_color.g * diffuse_factor),
-                static_cast<uint8_t>(base_color.b * diffuse_factor),
-            };
-        }
+        frames.publish();
+        ++frame_number;
     }
-};
+}
 
-void Buffer::blit(Chunk const& chunk, ScreenPosition position)
+void request_frame(uint32_t time)
 {
-    auto const buffer_col_start = std::clamp(position.y, 0l, m_height);
-    auto const buffer_col_end = std::clamp(position.y + chunk_size, 0l, m_height);
-    auto const col_height = buffer_col_end - buffer_col_start;
-    auto const chunk_col_start = std::clamp(-position.y, 0l, chunk_size);
-
-    auto const buffer_line_start = std::clamp(position.x, 0l, m_width);
-    auto const buffer_line_end = std::clamp(position.x + chunk_size, 0l, m_width);
-    auto line_width = buffer_line_end - buffer_line_start;
-    auto const chunk_line_start = std::clamp(-position.x, 0l, chunk_size);
+    requested_frame_time.store(time, std::memory_order_relaxed);
+    requested_frame_count.fetch_add(1, std::memory_order_release);
+    requested_frame_count.notify_one();
+}
 
-    if (col_height == 0 || line_width == 0) {
+void print_duration_statistics(char const* name, std::vector<double> durations)
+{
+    if (durations.empty()) {
+        std::cout << name << ": no samples\n";
         return;
     }
 
-    for (int64_t y = 0; y < col_height; ++y) {
-        auto* dest = &m_buffer.data()[(buffer_col_start + y) * m_width + buffer_line_start];
-        auto const* src = &chunk.buffer()[(chunk_col_start + y) * chunk_size + chunk_line_start];
-        std::memcpy(dest, src, line_width * sizeof(Color));
-    }
-}
+    std::sort(durations.begin(), durations.end());
+    auto const average = std::accumulate(durations.begin(), durations.end(), 0.0) / durations.size();
+    auto const percentile = [&](double p) { return durations[static_cast<std::size_t>(p * (durations.size() - 1))]; };
 
-Complex screen_space_to_mandelbrot_space(ScreenPosition screen_position, double chunk_resolution)
-{
-    // chunk_resolution: width and height of a chunk in mandelbrot space
-    // chunk_size: width and height of a chunk in screen space
-    return Complex{
-        .real = (chunk_resolution / chunk_size) * screen_position.x,
-        .imag = (chunk_resolution / chunk_size) * screen_position.y,
-    };
+    std::printf("%s: avg %.2fms, p50 %.2fms, p95 %.2fms, max %.2fms (%zu samples)\n",
+        name, average, percentile(0.5), percentile(0.95), durations.back(), durations.size());
 }
 
-ScreenPosition mandelbrot_space_to_screen_space(Complex mandelbrot_position, double chunk_resolution)
+// Feeds a recorded input log into the window callbacks in real time and presents frames into an offscreen buffer at 60Hz,
+// without a compositor. Runs until all events are dispatched and the last view is fully resolved.
+int replay_input_log(Window& window, char const* filepath)
 {
-    return ScreenPosition{
-        .x = static_cast<int64_t>((chunk_size / chunk_resolution) * mandelbrot_position.real),
-        .y = static_cast<int64_t>((chunk_size / chunk_resolution) * mandelbrot_position.imag),
-    };
-}
+    using Clock = std::chrono::steady_clock;
+    auto constexpr frame_interval = std::chrono::microseconds{16667};
+    auto constexpr timeout = std::chrono::seconds{120};
 
-struct Mandelbrot {
-    ScreenPosition top_left_global = ScreenPosition{-100, -100};
-    int32_t zoom_level = 1;
+    auto const events = load_input_log(filepath);
+    if (!events) {
+        std::cerr << "Failed to load input log " << filepath << "\n";
+        return 1;
+    }
 
-    void render(Buffer& buffer)
-    {
-        auto const chunk_resolution = get_chunk_resolution();
-        auto const top_left_mandelbrot_space = screen_space_to_mandelbrot_space(top_left_global, chunk_resolution);
+    if (events->empty() || events->front().type != InputEventType::RESIZE) {
+        dispatch_input_event(window, InputEvent{.time = 0, .type = InputEventType::RESIZE, .a = window.initial_width, .b = window.initial_height});
+    }
 
-        auto const chunk_x_count = static_cast<int32_t>(std::ceil(static_cast<double>(buffer.width()) / chunk_size)) + 1;
-        auto const chunk_y_count = static_cast<int32_t>(std::ceil(static_cast<double>(buffer.height()) / chunk_size)) + 1;
+    struct PendingInput {
+        Clock::time_point dispatch_time;
+        uint64_t view_sequence;
+    };
 
-        // Grid starts at 0+0i, with step width of chunk_resolution
-        auto const top_left_chunk_position = ChunkGridPosition{
-            static_cast<int64_t>(std::floor(top_left_mandelbrot_space.real / chunk_resolution)),
-            static_cast<int64_t>(std::floor(top_left_mandelbrot_space.imag / chunk_resolution)),
-        };
+    std::vector<PendingInput> pending_inputs;
+    std::vector<double> input_latencies;
+    std::vector<double> frame_intervals;
+    std::vector<uint32_t> data;
+
+    auto const start = Clock::now();
+    timespec cpu_start;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+
+    std::size_t next_event = 0;
+    auto last_input_time = start;
+    auto last_new_frame_time = start;
+    uint64_t last_frame_number = 0;
+    std::optional<Clock::duration> time_until_resolved;
+
+    for (auto tick = start; window.is_open; tick += frame_interval) {
+        std::this_thread::sleep_until(tick);
+        auto const now = Clock::now();
+        auto const time = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count());
+
+        for (; next_event < events->size() && (*events)[next_event].time <= time; ++next_event) {
+            dispatch_input_event(window, (*events)[next_event]);
+            pending_inputs.push_back(PendingInput{now, view.sequence});
+            last_input_time = now;
+        }
 
-        auto const top_left_chunk_global_screen_position = ScreenPosition{
-            .x = top_left_chunk_position.real * chunk_size,
-            .y = top_left_chunk_position.imag * chunk_size,
-        };
+        data.resize(window.width * window.height);
+        window.callback_draw(data.data(), window.width, window.height, time);
 
-        auto const top_left_local_screen_chunk_offset = ScreenPosition{
-            .x = top_left_chunk_global_screen_position.x - top_left_global.x,
-            .y = top_left_chunk_global_screen_position.y - top_left_global.y,
-        };
+        auto const& frame = frames.front();
+        if (frame.frame_number != last_frame_number) {
+            frame_intervals.push_back(std::chrono::duration<double, std::milli>(now - last_new_frame_time).count());
+            last_new_frame_time = now;
+            last_frame_number = frame.frame_number;
+        }
 
-        for (auto chunk_grid_x = 0; chunk_grid_x < chunk_x_count; ++chunk_grid_x) {
-            for (auto chunk_grid_y = 0; chunk_grid_y < chunk_y_count; ++chunk_grid_y) {
-                auto const chunk_grid_position = ChunkGridPosition{
-                    .real = top_left_chunk_position.real + chunk_grid_x,
-                    .imag = top_left_chunk_position.imag + chunk_grid_y,
-                };
+        std::erase_if(pending_inputs, [&](auto const& input) {
+            if (input.view_sequence > frame.view_sequence) {
+                return false;
+            }
+            input_latencies.push_back(std::chrono::duration<double, std::milli>(now - input.dispatch_time).count());
+            return true;
+        });
 
-                auto const local_screen_chunk_offset = ScreenPosition{
-                    .x = top_left_local_screen_chunk_offset.x + chunk_grid_x * chunk_size,
-                    .y = top_left_local_screen_chunk_offset.y + chunk_grid_y * chunk_size,
-                };
+        if (next_event == events->size() && pending_inputs.empty() && frame.view_sequence == view.sequence && frame.is_resolved) {
+            time_until_resolved = now - last_input_time;
+            break;
+        }
 
-                auto* chunk = get_or_create_chunk(chunk_resolution, chunk_grid_position);
-                if (chunk && chunk->is_ready()) {
-                    chunk->update_last_access_time();
-                    buffer.blit(*chunk, local_screen_chunk_offset);
-                } else {
-                    buffer.blit(dummy_chunk, local_screen_chunk_offset);
-                }
-            }
+        if (now - start > timeout) {
+            std::cerr << "Replay timed out before the view was resolved\n";
+            break;
         }
     }
 
-    double get_chunk_resolution()
-    {
-        return 2 * std::pow(0.9, zoom_level);
+    timespec cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    auto const cpu_time = (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+    auto const wall_time = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cout << "Replayed " << next_event << " input events from " << filepath << "\n";
+    print_duration_statistics("frame interval", frame_intervals);
+    print_duration_statistics("input to present latency", input_latencies);
+    if (time_until_resolved) {
+        std::printf("time until resolved after last input: %.2fms\n", std::chrono::duration<double, std::milli>(*time_until_resolved).count());
+    } else {
+        std::printf("time until resolved after last input: unresolved\n");
     }
+    std::printf("wall time: %.3fs, cpu time: %.3fs (%.2f cores)\n", wall_time, cpu_time, cpu_time / wall_time);
 
-    void create_thread_pool()
-    {
-        m_threads_running = true;
-
-        for (int32_t i = 0; i < thread_count; ++i) {
-            m_threads.emplace_back([&]() {
-                while (m_threads_running) {
-                    std::unique_lock<std::mutex> queue_lock{m_queue_mutex};
-                    m_queue_convar.wait(queue_lock, [&]() { return !m_chunk_queue.empty() || !m_threads_running; });
-
-                    if (!m_chunk_queue.empty()) {
-                        auto chunk = m_chunk_queue.front();
-                        m_chunk_queue.pop();
-                        queue_lock.unlock();
-                        chunk.get().compute();
-                    }
-                }
-            });
-        }
-    }
+    return time_until_resolved ? 0 : 1;
+}
 
-    void destroy_thread_pool()
-    {
-        m_threads_running = false;
-        m_queue_convar.notify_all();
-        for (auto& thread : m_threads) {
-            thread.join();
-        }
-        m_threads.clear();
+// Tiles for the web viewer, see web/tiles.html. Tile (z, x, y) covers [x, x + 1] * 4 / 2^z on the real axis and
+// [y, y + 1] * 4 / 2^z on the imaginary axis, with the imaginary axis pointing down like in the viewer.
+// x and y may be negative. A tile is one full resolution chunk, so all tiles are cached and computed by the thread pool.
+HttpResponse serve_tile(Mandelbrot& mandelbrot, HttpRequest const& request)
+{
+    if (request.path == "/info") {
+        auto const info = "{\"tile_size\":" + std::to_string(chunk_size)
+            + ",\"formulas\":" + std::to_string(formula_amount)
+            + ",\"color_functions\":" + std::to_string(color_function_amount)
+            + ",\"max_antialiasing_samples\":" + std::to_string(max_antialiasing_samples) + "}\n";
+        auto response = HttpResponse::text(200, info);
+        response.content_type = "application/json";
+        return response;
     }
 
-    void invalidate_cache()
-    {
-        auto const single_chunk_memory = chunk_size * chunk_size * sizeof(Color);
+    int zoom;
+    long long tile_x;
+    long long tile_y;
+    char extension[8];
+    int consumed = 0;
+    if (std::sscanf(request.path.c_str(), "/tiles/%d/%lld/%lld.%7[a-z]%n", &zoom, &tile_x, &tile_y, extension, &consumed) != 4
+        || static_cast<std::size_t>(consumed) != request.path.size()) {
+        return HttpResponse::text(404, "Not found, tiles are at /tiles/<z>/<x>/<y>.<qoi|rgba>\n");
+    }
 
-        std::size_t cache_memory = m_chunks.size() * single_chunk_memory;
+    auto const format = std::string_view{extension};
+    if (zoom < 0 || zoom > max_tile_zoom || (format != "qoi" && format != "rgba")) {
+        return HttpResponse::text(404, "Invalid zoom level or format\n");
+    }
 
-        if (cache_memory <= max_chunk_memory) {
-            return;
+    // Parameters default to the ones of the viewer
+    auto tile_parameters = ViewState{}.render_parameters();
+    auto const parse = [&](std::string_view name, auto& value, auto min, auto max) {
+        if (auto const parameter = query_parameter(request.query, name)) {
+            std::from_chars(parameter->data(), parameter->data() + parameter->size(), value);
+            value = std::clamp<std::remove_reference_t<decltype(value)>>(value, min, max);
         }
+    };
+    parse("formula", tile_parameters.formula, std::size_t{0}, formula_amount - 1);
+    parse("iterations", tile_parameters.max_iterations, auto_iterations, max_tile_iterations);
+    parse("color", tile_parameters.color_function, std::size_t{0}, color_function_amount - 1);
+    parse("antialiasing", tile_parameters.antialiasing_samples, int64_t{0}, max_antialiasing_samples);
+
+    auto const resolution = 4.0 / std::ldexp(1.0, zoom);
+    auto const tile = mandelbrot.request_tile(resolution, ChunkGridPosition{tile_x, tile_y}, tile_parameters).result.get();
+    auto const pixels = std::span{reinterpret_cast<Color const*>(tile.image.buffer().data()), tile.image.buffer().size()};
+
+    // The tile only depends on the URL
+    auto response = HttpResponse{
+        .status = 200,
+        .content_type = format == "qoi" ? "image/qoi" : "application/octet-stream",
+        .cache_control = "public, max-age=31536000, immutable",
+        .body = {},
+    };
+    if (format == "qoi") {
+        response.body = QOIImage::encode(pixels.data(), chunk_size, chunk_size);
+    } else {
+        response.body.reserve(pixels.size() * 4);
+        for (auto const pixel : pixels) {
+            response.body.insert(response.body.end(), {pixel.r, pixel.g, pixel.b, pixel.a});
+        }
+    }
+    return response;
+}
 
-        auto const memory_to_delete = cache_memory - max_chunk_memory;
-        auto const chunk_amount_to_delete = memory_to_delete / single_chunk_memory;
-
-        std::cout << "Removing " << chunk_amount_to_delete << " chunks\n";
-
-        std::vector<ChunkCacheListItem> chunks;
-        for (auto const& [identifier, chunk] : m_chunks) {
-            if (chunk.is_ready())
-                chunks.push_back(ChunkCacheListItem{identifier, &chunk});
+// Headless benchmarks of the hot paths, run with --benchmark
+int run_benchmarks()
+{
+    using Clock = std::chrono::steady_clock;
+    auto const seconds_since = [](Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+    auto const positions = std::array{Complex{-0.75, -0.125}, Complex{-0.7453, 0.1127}, Complex{-1.5, -0.25}, Complex{0.25, 0.0}};
+    for (auto const antialiasing_samples : {int64_t{0}, default_antialiasing_samples}) {
+        std::size_t chunk_count = 0;
+        uint64_t iteration_count = 0;
+
+        auto const start = Clock::now();
+        for (int repetition = 0; repetition < 4; ++repetition) {
+            for (auto const& position : positions) {
+                auto chunk = Chunk::create(position, 0.25, 0, 1000, 0, 1, antialiasing_samples);
+                chunk.compute();
+                iteration_count += chunk.iteration_count();
+                ++chunk_count;
+            }
         }
-        std::sort(std::begin(chunks), std::end(chunks), [](auto const& lhs, auto const& rhs) -> bool {
-            return lhs.chunk->last_access_time() < rhs.chunk->last_access_time();
-        });
+        auto const elapsed = seconds_since(start);
+
+        std::printf("chunk compute, %ld anti-aliasing samples: %s chunks/s, %s iterations/s\n", antialiasing_samples,
+            format_si(chunk_count / elapsed).c_str(), format_si(iteration_count / elapsed).c_str());
+    }
 
-        for (std::size_t i = 0; i < chunk_amount_to_delete; ++i) {
-            auto to_delete = chunks.at(i);
-            if (!to_delete.chunk->is_ready()) {
-                --i;
-                continue;
+#ifdef __AVX__
+    // Counted in reference cycles of the time stamp counter, which tick at a fixed rate independent of frequency scaling
+    auto const configured_interleave = kernel_interleave;
+    for (int32_t groups = 1; groups <= max_kernel_interleave; ++groups) {
+        kernel_interleave = groups;
+        uint64_t iteration_count = 0;
+
+        auto const start = __rdtsc();
+        for (int repetition = 0; repetition < 4; ++repetition) {
+            for (auto const& position : positions) {
+                auto chunk = Chunk::create(position, 0.25, 0, 1000, 0, 1, 0);
+                chunk.compute();
+                iteration_count += chunk.iteration_count();
             }
-            m_chunks.erase(to_delete.identifier);
         }
+        auto const cycles = __rdtsc() - start;
+
+        std::printf("kernel interleave %d%s: %.3f iterations/cycle\n", groups, groups == configured_interleave ? " (configured)" : "",
+            static_cast<double>(iteration_count) / cycles);
     }
+    kernel_interleave = configured_interleave;
+#endif
 
-    void clear_cache()
     {
-        destroy_thread_pool();
+        auto benchmark_view = ViewState{};
+        benchmark_view.width = 3840;
+        benchmark_view.height = 2160;
+        benchmark_view.zoom_level = 30;
+        benchmark_view.top_left_global = ScreenPosition{-4184, -778};
+
+        auto image = Buffer::init(benchmark_view.width, benchmark_view.height);
+        mandelbrot.create_thread_pool();
+        auto const start = Clock::now();
+        while (!render_view(mandelbrot, image, benchmark_view)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        std::printf("render 3840x2160: %.3fs until resolved\n", seconds_since(start));
+        mandelbrot.destroy_thread_pool();
 
+        mandelbrot.create_thread_pool();
+        auto const buddhabrot_parameters = BuddhabrotParameters::from_center(Complex{-0.4, 0}, 3.2, 1920, 1080, 0, 20, 1000, 4'000'000);
+        auto const buddhabrot_start = Clock::now();
         {
-            std::lock_guard<std::mutex> lock{m_queue_mutex};
+            auto const buddhabrot = Buddhabrot{mandelbrot, buddhabrot_parameters,
+                BuddhabrotSampler::create(buddhabrot_parameters.formula, buddhabrot_parameters.min_iterations, buddhabrot_parameters.max_iterations)};
+            while (!buddhabrot.wait(std::chrono::seconds{1})) { }
+            std::printf("buddhabrot 1920x1080: %.3fs for %s samples, %s samples/s per core\n", seconds_since(buddhabrot_start),
+                format_si(buddhabrot.samples()).c_str(), format_si(buddhabrot.samples_per_second_per_core()).c_str());
+        }
+        mandelbrot.destroy_thread_pool();
 
-            while (!m_chunk_queue.empty()) {
-                m_chunk_queue.pop();
-            }
+        auto const* pixels = reinterpret_cast<Color const*>(image.buffer().data());
+        auto const raw_size = static_cast<double>(image.buffer().size() * sizeof(Color));
+        int constexpr repetitions = 5;
 
-            m_chunks.clear();
+        std::vector<uint8_t> encoded;
+        auto const encode_start = Clock::now();
+        for (int repetition = 0; repetition < repetitions; ++repetition) {
+            encoded = QOIImage::encode(pixels, image.width(), image.height());
         }
+        auto const encode_elapsed = seconds_since(encode_start) / repetitions;
+        std::printf("qoi encode 3840x2160: %.2fms, %sB/s, ratio %.3f\n", encode_elapsed * 1000, format_si(raw_size / encode_elapsed).c_str(), encoded.size() / raw_size);
 
-        create_thread_pool();
-    }
-
-private:
-    struct ChunkIdentifier {
-        double chunk_resolution;
-        ChunkGridPosition chunk_grid_position;
-        int64_t max_iterations;
+        auto const path = std::filesystem::temp_directory_path() / "mandelbrot-benchmark.qoi";
+        if (!QOIImage::encode_to_file(path.c_str(), pixels, image.width(), image.height())) {
+            std::cerr << "Failed to write " << path << "\n";
+            return 1;
+        }
 
-        bool operator==(ChunkIdentifier const& other) const = default;
-    };
+        int width;
+        int height;
+        auto const decode_start = Clock::now();
+        auto const decoded = QOIDecoder::decode_file(path.c_str(), width, height);
+        auto const decode_elapsed = seconds_since(decode_start);
+        std::filesystem::remove(path);
 
-    struct HashChunkIdentifier {
-        std::size_t operator()(ChunkIdentifier const& id) const
-        {
-            return ((std::hash<double>()(id.chunk_resolution)
-                        ^ (std::hash<ChunkGridPosition>()(id.chunk_grid_position) << 1))
-                       >> 1)
-                ^ (std::hash<int64_t>()(id.max_iterations) << 1);
+        if (!decoded || width != image.width() || height != image.height() || std::memcmp(decoded->data(), pixels, raw_size) != 0) {
+            std::cerr << "qoi decode: mismatch after round trip\n";
+            return 1;
         }
-    };
+        std::printf("qoi decode 3840x2160: %.2fms, %sB/s\n", decode_elapsed * 1000, format_si(raw_size / decode_elapsed).c_str());
+    }
 
-    struct ChunkCacheListItem {
-        ChunkIdentifier identifier;
-        Chunk const* chunk;
-    };
+    {
+        auto const parameters = SequenceParameters{
+            .width = 1280,
+            .height = 720,
+            .center = Complex{-0.7453, 0.1127},
+            .start_zoom = 20,
+            .end_zoom = 24,
+            .frames_per_zoom_level = 10,
+            .formula = 0,
+            .max_iterations = 1000,
+            .color_function = 3,
+            .antialiasing_samples = default_antialiasing_samples,
+        };
+        auto const path = std::filesystem::temp_directory_path() / "mandelbrot-benchmark-sequence";
 
-    std::unordered_map<ChunkIdentifier, Chunk, HashChunkIdentifier> m_chunks;
+        mandelbrot.create_thread_pool();
+        auto const start = Clock::now();
+        auto const succeeded = render_sequence(mandelbrot, parameters, path, false);
+        auto const elapsed = seconds_since(start);
+        mandelbrot.destroy_thread_pool();
+        std::filesystem::remove_all(path);
+
+        if (!succeeded) {
+            return 1;
+        }
+        std::printf("sequence 1280x720: %.1f frames/min\n", parameters.frame_count() / elapsed * 60);
+    }
 
-    std::queue<std::reference_wrapper<Chunk>> m_chunk_queue;
-    std::mutex m_queue_mutex;
-    std::condition_variable m_queue_convar;
-    std::vector<std::thread> m_threads;
-    bool m_threads_running{true};
-    Chunk const dummy_chunk = Chunk::create_dummy();
+    return 0;
+}
 
-    Chunk* get_or_create_chunk(double chunk_resolution, ChunkGridPosition position)
-    {
-        auto chunk_identifier = ChunkIdentifier{
-            .chunk_resolution = chunk_resolution,
-            .chunk_grid_position = position,
-            .max_iterations = max_iterations,
+// Renders a calibration view with candidate settings and returns the ones that resolve the screen the fastest.
+// Chunk sizes and worker counts are compared first, then the queue depth for the best combination.
+Settings auto_tune(Settings settings)
+{
+    using Clock = std::chrono::steady_clock;
+
+    auto const time_until_resolved = [](Settings const& candidate) {
+        apply_settings(candidate);
+
+        // Seahorse valley, where most chunks need many iterations
+        auto calibration_view = ViewState{};
+        calibration_view.width = 1920;
+        calibration_view.height = 1080;
+        calibration_view.zoom_level = 25;
+        calibration_view.max_iterations = 1000;
+        auto const pixel_size = calibration_view.get_chunk_resolution() / chunk_size;
+        calibration_view.top_left_global = ScreenPosition{
+            .x = std::llround(-0.7453 / pixel_size) - calibration_view.width / 2,
+            .y = std::llround(0.1127 / pixel_size) - calibration_view.height / 2,
         };
 
-        if (m_chunks.contains(chunk_identifier) && m_chunks.at(chunk_identifier).is_ready()) {
-            return &m_chunks.at(chunk_identifier);
+        auto image = Buffer::init(calibration_view.width, calibration_view.height);
+        auto calibration = Mandelbrot{};
+        calibration.create_thread_pool();
+        auto const start = Clock::now();
+        while (!render_view(calibration, image, calibration_view)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
         }
+        auto const elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        calibration.destroy_thread_pool();
 
-        enqueue_chunk(chunk_identifier);
-        return nullptr;
+        std::printf("chunk_size %4ld, %3d threads, queue %4d: %.3fs\n", chunk_size, thread_count, max_queue_size, elapsed);
+        return elapsed;
     };
 
-    bool enqueue_chunk(ChunkIdentifier identifier)
-    {
-        if (m_chunk_queue.size() > max_queue_size) {
-            return false;
+    auto const hardware_threads = std::max<int32_t>(std::thread::hardware_concurrency(), 1);
+    auto thread_counts = std::vector<int32_t>{std::max(hardware_threads / 2, 1), hardware_threads, hardware_threads * 2};
+    thread_counts.erase(std::unique(thread_counts.begin(), thread_counts.end()), thread_counts.end());
+
+    auto best_time = std::numeric_limits<double>::infinity();
+    auto best = settings;
+    for (auto const candidate_chunk_size : {64, 128, 256, 512}) {
+        for (auto const candidate_thread_count : thread_counts) {
+            auto candidate = settings;
+            candidate.chunk_size = candidate_chunk_size;
+            candidate.thread_count = candidate_thread_count;
+            candidate.max_queue_size = candidate_thread_count;
+            if (auto const time = time_until_resolved(candidate); time < best_time) {
+                best_time = time;
+                best = candidate;
+            }
         }
+    }
 
-        if (m_chunks.contains(identifier)) {
-            return false;
+    for (auto const queue_factor : {2, 4}) {
+        auto candidate = best;
+        candidate.max_queue_size = best.thread_count * queue_factor;
+        if (auto const time = time_until_resolved(candidate); time < best_time) {
+            best_time = time;
+            best = candidate;
         }
+    }
 
-        auto const complex_chunk_position = Complex{
-            .real = identifier.chunk_grid_position.real * identifier.chunk_resolution,
-            .imag = identifier.chunk_grid_position.imag * identifier.chunk_resolution,
-        };
+    apply_settings(best);
+    return best;
+}
 
-        m_chunks.insert(std::make_pair(identifier, Chunk::create(complex_chunk_position, identifier.chunk_resolution, identifier.max_iterations)));
+int main(int argc, char** argv)
+{
+    trace_init();
 
-        auto& new_chunk = m_chunks.at(identifier);
-        {
-            std::lock_guard<std::mutex> lock{m_queue_mutex};
-            m_chunk_queue.push(new_chunk);
-        }
-        m_queue_convar.notify_one();
-        return true;
+    // Started by RemoteWorker, see worker.hpp
+    if (auto const exit_code = run_as_worker(argc, argv)) {
+        return *exit_code;
     }
-};
 
-void render_text_to_buffer(Buffer* buffer, ScreenPosition position, std::string_view text)
-{
-    int64_t const advance = 8 * text_scale;
-    unsigned char const fallback_glyph[8] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    trace_set_thread_name("wayland");
 
-    for (size_t n = 0; n < text.length(); ++n) {
-        uint8_t character = text[n];
-        auto const* glyph = character < 128 ? font8x8_basic[character] : fallback_glyph;
-        for (int64_t y = 0; y < 8; ++y) {
-            auto const glyph_row = glyph[y];
-            for (int64_t x = 0; x < 8; ++x) {
-                if ((glyph_row >> x) & 1) {
-                    for (int64_t i = 0; i < text_scale * text_scale; ++i) {
-                        auto pixel_position = ScreenPosition{
-                            .x = position.x + static_cast<int64_t>(n) * advance + x * text_scale + i % text_scale,
-                            .y = position.y + y * text_scale + i / text_scale,
-                        };
-
-                        buffer->set(pixel_position, Color(255, 255, 255));
-                    }
-                }
+    auto settings = Settings{};
+    auto const settings_path = host_settings_path();
+    if (!load_settings(settings_path, settings)) {
+        return 1;
+    }
+    apply_settings(settings);
+
+    char const* record_path = nullptr;
+    char const* replay_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        auto const argument = std::string_view{argv[i]};
+        if (argument == "--set" && i + 2 < argc) {
+            if (!settings.set(argv[i + 1], argv[i + 2])) {
+                std::cerr << "Invalid setting " << argv[i + 1] << " " << argv[i + 2] << "\n";
+                return 1;
             }
+            apply_settings(settings);
+            i += 2;
+        } else if (argument == "--auto-tune") {
+            settings = auto_tune(settings);
+            if (!save_settings(settings_path, settings)) {
+                std::cerr << "Failed to write " << settings_path.string() << "\n";
+                return 1;
+            }
+            std::printf("Saved chunk_size %ld, thread_count %d, max_queue_size %d to %s\n",
+                settings.chunk_size, settings.thread_count, settings.max_queue_size, settings_path.c_str());
+            return 0;
+        } else if (argument == "--record" && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (argument == "--replay" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (argument == "--formula" && i + 1 < argc) {
+            view.formula = std::stoull(argv[++i]) % formula_amount;
+        } else if (argument == "--antialiasing" && i + 1 < argc) {
+            view.antialiasing_samples = std::clamp<int64_t>(std::stoll(argv[++i]), 0, max_antialiasing_samples);
+        } else if (argument == "--screenshot-scale" && i + 1 < argc) {
+            screenshot_scale = std::clamp<int64_t>(std::stoll(argv[++i]), 1, poster_scale);
+        } else if (argument == "--benchmark") {
+            return run_benchmarks();
+        } else if (argument == "--poster" && i + 8 < argc) {
+            auto const parameters = ViewportParameters::from_center(
+                Complex{std::stod(argv[i + 4]), std::stod(argv[i + 5])}, std::stod(argv[i + 6]),
+                std::stoll(argv[i + 2]), std::stoll(argv[i + 3]), view.formula, std::stoll(argv[i + 7]), std::stoull(argv[i + 8]), view.antialiasing_samples);
+            mandelbrot.create_thread_pool();
+            auto progress = PosterProgress{};
+            auto const succeeded = export_poster(mandelbrot, parameters, argv[i + 1], progress, true);
+            mandelbrot.destroy_thread_pool();
+            return succeeded ? 0 : 1;
+        } else if (argument == "--field" && i + 7 < argc) {
+            auto const parameters = ViewportParameters::from_center(
+                Complex{std::stod(argv[i + 4]), std::stod(argv[i + 5])}, std::stod(argv[i + 6]),
+                std::stoll(argv[i + 2]), std::stoll(argv[i + 3]), view.formula, std::stoll(argv[i + 7]), 0, 0);
+            mandelbrot.create_thread_pool();
+            auto progress = PosterProgress{};
+            auto const succeeded = export_field(mandelbrot, parameters, argv[i + 1], progress, true);
+            mandelbrot.destroy_thread_pool();
+            return succeeded ? 0 : 1;
+        } else if (argument == "--recolor" && i + 4 < argc) {
+            return recolor_field(argv[i + 1], argv[i + 2], std::stoull(argv[i + 3]), std::max(std::stoll(argv[i + 4]), 1ll)) ? 0 : 1;
+        } else if (argument == "--buddhabrot" && i + 9 < argc) {
+            // 0 samples would trace until the Buddhabrot is destroyed, which only the interactive preview does
+            auto const samples = std::stoll(argv[i + 9]);
+            if (samples <= 0) {
+                std::cerr << "Invalid sample count " << argv[i + 9] << "\n";
+                return 1;
+            }
+            auto const parameters = BuddhabrotParameters::from_center(
+                Complex{std::stod(argv[i + 4]), std::stod(argv[i + 5])}, std::stod(argv[i + 6]), std::stoll(argv[i + 2]), std::stoll(argv[i + 3]),
+                view.formula, std::stoll(argv[i + 7]), std::stoll(argv[i + 8]), static_cast<uint64_t>(samples));
+            mandelbrot.create_thread_pool();
+            auto const succeeded = export_buddhabrot(mandelbrot, parameters, argv[i + 1]);
+            mandelbrot.destroy_thread_pool();
+            return succeeded ? 0 : 1;
+        } else if (argument == "--serve" && i + 1 < argc) {
+            mandelbrot.create_thread_pool();
+            return serve_http(static_cast<uint16_t>(std::stoul(argv[i + 1])), [&](HttpRequest const& request) {
+                return serve_tile(mandelbrot, request);
+            });
+        } else if (argument == "--sequence" && i + 10 < argc) {
+            auto const parameters = SequenceParameters{
+                .width = std::stoll(argv[i + 2]),
+                .height = std::stoll(argv[i + 3]),
+                .center = Complex{std::stod(argv[i + 4]), std::stod(argv[i + 5])},
+                .start_zoom = std::stod(argv[i + 6]),
+                .end_zoom = std::stod(argv[i + 7]),
+                .frames_per_zoom_level = std::max(std::stoll(argv[i + 8]), 1ll),
+                .formula = view.formula,
+                .max_iterations = std::stoll(argv[i + 9]),
+                .color_function = std::stoull(argv[i + 10]),
+                .antialiasing_samples = view.antialiasing_samples,
+            };
+            mandelbrot.create_thread_pool();
+            auto const succeeded = render_sequence(mandelbrot, parameters, argv[i + 1], true);
+            mandelbrot.destroy_thread_pool();
+            return succeeded ? 0 : 1;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--set <setting> <value>]... [--formula <formula>] [--antialiasing <samples>] [--screenshot-scale <n>] [--record <input log> | --replay <input log> | --benchmark]\n"
+                      << "       " << argv[0] << " --poster <output> <width> <height> <center real> <center imag> <real span> <max iterations> <color function>\n"
+                      << "       " << argv[0] << " --sequence <output directory | -> <width> <height> <center real> <center imag> <start zoom> <end zoom> <frames per zoom level> <max iterations> <color function>\n"
+                      << "       " << argv[0] << " --field <output.npy> <width> <height> <center real> <center imag> <real span> <max iterations>\n"
+                      << "       " << argv[0] << " --recolor <input.npy> <output> <color function> <color iterations>\n"
+                      << "       " << argv[0] << " --buddhabrot <output> <width> <height> <center real> <center imag> <real span> <min iterations> <max iterations> <samples>\n"
+                      << "       " << argv[0] << " --serve <port>\n"
+                      << "       " << argv[0] << " --auto-tune\n";
+            return 1;
         }
     }
-}
-
-std::optional<Buffer> buffer = {};
-
-auto mandelbrot = Mandelbrot{};
-
-auto cursor_position = ScreenPosition{0, 0};
-auto cursor_start_local_position = ScreenPosition{0, 0};
-auto cursor_start_global_position = ScreenPosition{0, 0};
-auto lmb_pressed = false;
-
-int main()
-{
-    auto window = Window::open("Mandelbrot", 600, 500);
 
-    buffer = Buffer::init(800, 600);
+    // Replaying does not need a compositor, the window only holds the callbacks
+    auto window = replay_path ? std::make_unique<Window>() : Window::open("Mandelbrot", 600, 500);
+    if (replay_path) {
+        window->initial_width = 600;
+        window->initial_height = 500;
+    }
 
     window->callback_window_resize = [](int width, int height) {
-        buffer->resize(width, height);
+        view.width = width;
+        view.height = height;
+        publish_view();
     };
 
     window->callback_pointer_motion = [](int x, int y) {
@@ -985,8 +2205,10 @@ int main()
             cursor_position.y - cursor_start_local_position.y,
         };
 
-        mandelbrot.top_left_global.x = cursor_start_global_position.x - local_offset.x;
-        mandelbrot.top_left_global.y = cursor_start_global_position.y - local_offset.y;
+        view.top_left_global.x = cursor_start_global_position.x - local_offset.x;
+        view.top_left_global.y = cursor_start_global_position.y - local_offset.y;
+        view.last_interaction_time = std::chrono::steady_clock::now();
+        publish_view();
     };
 
     window->callback_pointer_button = [](uint32_t button, wl_pointer_button_state state) {
@@ -999,10 +2221,13 @@ int main()
         if (!lmb_pressed && is_pressed) {
             cursor_start_local_position.x = cursor_position.x;
             cursor_start_local_position.y = cursor_position.y;
-            cursor_start_global_position = mandelbrot.top_left_global;
+            cursor_start_global_position = view.top_left_global;
         }
 
         lmb_pressed = is_pressed;
+        view.is_dragging = is_pressed;
+        view.last_interaction_time = std::chrono::steady_clock::now();
+        publish_view();
     };
 
     window->callback_pointer_axis = [](wl_pointer_axis axis, int value) {
@@ -1018,18 +2243,20 @@ int main()
         };
 
         auto const cursor_position_global_screen_space = ScreenPosition{
-            .x = mandelbrot.top_left_global.x + cursor_position_local_screen_space.x,
-            .y = mandelbrot.top_left_global.y + cursor_position_local_screen_space.y,
+            .x = view.top_left_global.x + cursor_position_local_screen_space.x,
+            .y = view.top_left_global.y + cursor_position_local_screen_space.y,
         };
 
-        auto const cursor_position_mandelbrot_space = screen_space_to_mandelbrot_space(cursor_position_global_screen_space, mandelbrot.get_chunk_resolution());
+        auto const cursor_position_mandelbrot_space = screen_space_to_mandelbrot_space(cursor_position_global_screen_space, view.get_chunk_resolution());
 
-        mandelbrot.zoom_level = std::max<int32_t>(mandelbrot.zoom_level + value, 1);
+        view.zoom_level = std::max<int32_t>(view.zoom_level + value, 1);
 
-        auto const new_cursor_position_global_screen_space = mandelbrot_space_to_screen_space(cursor_position_mandelbrot_space, mandelbrot.get_chunk_resolution());
+        auto const new_cursor_position_global_screen_space = mandelbrot_space_to_screen_space(cursor_position_mandelbrot_space, view.get_chunk_resolution());
 
-        mandelbrot.top_left_global.x = new_cursor_position_global_screen_space.x - cursor_position_local_screen_space.x;
-        mandelbrot.top_left_global.y = new_cursor_position_global_screen_space.y - cursor_position_local_screen_space.y;
+        view.top_left_global.x = new_cursor_position_global_screen_space.x - cursor_position_local_screen_space.x;
+        view.top_left_global.y = new_cursor_position_global_screen_space.y - cursor_position_local_screen_space.y;
+        view.last_interaction_time = std::chrono::steady_clock::now();
+        publish_view();
     };
 
     window->callback_keyboard_key = [&window](Scancodes scancode, wl_keyboard_key_state state) {
@@ -1039,90 +2266,98 @@ int main()
 
         switch (scancode) {
         case Scancodes::S:
-            if (buffer.has_value()) {
-                std::string filename;
-                for (int image_number = 0;; ++image_number) {
-                    filename = "mandelbrot-" + std::to_string(image_number) + ".qoi";
-                    if (!std::filesystem::exists(filename)) {
-                        break;
-                    }
-                }
-                QOIImage::encode_to_file(filename.c_str(), reinterpret_cast<Color*>(buffer->buffer().data()), buffer->width(), buffer->height());
-                last_message = "Saved screenshot to " + std::filesystem::current_path().string() + "/" + filename;
-                last_message_time = global_time;
-            }
+            ++view.screenshot_requests;
+            break;
+        case Scancodes::E:
+            ++view.poster_requests;
+            break;
+        case Scancodes::R:
+            ++view.field_requests;
             break;
         case Scancodes::I:
-            info_text_visible = !info_text_visible;
+            view.info_text_visible = !view.info_text_visible;
+            break;
+        case Scancodes::P:
+            view.perf_hud_visible = !view.perf_hud_visible;
             break;
         case Scancodes::PLUS:
-            max_iterations += 50;
+            view.max_iterations = view.base_max_iterations() + 50;
             break;
         case Scancodes::H:
-            help_text_visible = !help_text_visible;
+            view.help_text_visible = !view.help_text_visible;
             break;
         case Scancodes::MINUS:
-            max_iterations -= 50;
+            view.max_iterations = std::max<int64_t>(view.base_max_iterations() - 50, 50);
+            break;
+        case Scancodes::B:
+            view.buddhabrot_visible = !view.buddhabrot_visible;
+            break;
+        case Scancodes::M:
+            view.max_iterations = view.max_iterations == auto_iterations ? view.base_max_iterations() : auto_iterations;
             break;
         case Scancodes::Q:
             window->is_open = false;
             break;
         case Scancodes::C:
-            color_function = (color_function + 1) % color_function_amount;
-            mandelbrot.clear_cache();
+            view.color_function = (view.color_function + 1) % color_function_amount;
+            break;
+        case Scancodes::F:
+            view.formula = (view.formula + 1) % formula_amount;
+            break;
+        case Scancodes::A:
+            view.antialiasing_samples = view.antialiasing_samples == 0 ? 4 : view.antialiasing_samples * 2;
+            if (view.antialiasing_samples > max_antialiasing_samples) {
+                view.antialiasing_samples = 0;
+            }
             break;
         default:
             std::cout << "Scancode: " << std::to_string(static_cast<uint32_t>(scancode)) << "\n";
         }
-    };
-
-    mandelbrot.create_thread_pool();
 
-    window->callback_draw = [](uint32_t* data, [[maybe_unused]] int width, [[maybe_unused]] int height, uint32_t time) {
-        global_time = time;
-        mandelbrot.render(*buffer);
-
-        mandelbrot.invalidate_cache();
+        publish_view();
+    };
 
-        int line = 0;
-        auto render_next_line = [&](auto text) {
-            auto position = ScreenPosition{
-                .x = 10,
-                .y = 10 + line++ * 8 * text_scale,
-            };
-            render_text_to_buffer(&*buffer, position, text);
-        };
+    if (record_path && !record_input(*window, record_path)) {
+        std::cerr << "Failed to open input log " << record_path << "\n";
+        return 1;
+    }
 
-        if (info_text_visible) {
-            render_next_line("max iterations: " + std::to_string(max_iterations));
-            render_next_line("zoom: " + std::to_string(mandelbrot.zoom_level));
-            auto const top_left_mandelbrot_space = screen_space_to_mandelbrot_space(mandelbrot.top_left_global, mandelbrot.get_chunk_resolution());
-            render_next_line("mandelbrot real: " + std::to_string(top_left_mandelbrot_space.real));
-            render_next_line("mandelbrot imag: " + std::to_string(top_left_mandelbrot_space.imag));
-            ++line;
+    mandelbrot.create_thread_pool();
+    auto render_thread = std::thread{render_thread_main};
+
+    window->callback_draw = [](uint32_t* data, int width, int height, uint32_t time) {
+        static uint32_t* presented_data = nullptr;
+
+        // Only present finished frames here, composing happens on the render thread
+        if (frames.update() || data != presented_data) {
+            auto const span = TraceSpan{"present"};
+            auto& frame = frames.front().buffer;
+            auto const copy_width = std::min<int64_t>(width, frame.width());
+            auto const copy_height = std::min<int64_t>(height, frame.height());
+            for (int64_t y = 0; y < copy_height; ++y) {
+                std::memcpy(data + y * width, frame.buffer().data() + y * frame.width(), copy_width * sizeof(Color));
+            }
+            presented_data = data;
         }
 
-        if (help_text_visible) {
-            render_next_line("Keybindings:");
-            render_next_line("H: Toggle this help text");
-            render_next_line("I: Toggle informations");
-            render_next_line("S: Screenshot");
-            render_next_line("+: Increase max iterations");
-            render_next_line("-: Decrease max iterations");
-            render_next_line("C: Change colors");
-            ++line;
-        }
+        request_frame(time);
+    };
 
-        if (last_message_time + message_display_duration >= time) {
-            render_next_line(last_message);
-        }
+    auto exit_code = 0;
+    if (replay_path) {
+        exit_code = replay_input_log(*window, replay_path);
+    } else {
+        window->mainloop();
+    }
 
-        memcpy(data, reinterpret_cast<uint32_t*>(buffer->buffer().data()), buffer->buffer().size() * 4);
+    render_thread_running = false;
+    request_frame(0);
+    render_thread.join();
+    cancel_exports();
 
-        ++frame_number;
-    };
+    mandelbrot.destroy_thread_pool();
 
-    window->mainloop();
+    trace_flush();
 
-    mandelbrot.destroy_thread_pool();
+    return exit_code;
 }
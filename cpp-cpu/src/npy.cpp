@@ -0,0 +1,198 @@
+#include "npy.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string_view constexpr npy_magic = "\x93NUMPY";
+std::string_view constexpr field_descr = "[('iterations', '<f4'), ('distance', '<f4'), ('normal_x', '<f4'), ('normal_y', '<f4')]";
+std::size_t constexpr npy_alignment = 64;
+
+static_assert(sizeof(FieldSample) == 4 * sizeof(float), "The dtype in field_descr has no padding");
+
+std::optional<FieldFileWriter> FieldFileWriter::open(char const* filepath, int64_t width, int64_t height)
+{
+    FILE* out_file = fopen(filepath, "w");
+    if (!out_file) {
+        return {};
+    }
+
+    // Version 1.0: magic, version, little endian header length, then the header padded with spaces and ended by a newline
+    auto header = std::string{"{'descr': "} + std::string{field_descr} + ", 'fortran_order': False, 'shape': (" + std::to_string(height) + ", " + std::to_string(width) + "), }";
+    auto const prefix_size = npy_magic.size() + 4;
+    header.append(npy_alignment - (prefix_size + header.size() + 1) % npy_alignment, ' ');
+    header.push_back('\n');
+
+    auto const header_size = static_cast<uint16_t>(header.size());
+    uint8_t prefix[10];
+    std::memcpy(prefix, npy_magic.data(), npy_magic.size());
+    prefix[6] = 1;
+    prefix[7] = 0;
+    std::memcpy(&prefix[8], &header_size, sizeof(header_size));
+
+    if (fwrite(prefix, 1, sizeof(prefix), out_file) != sizeof(prefix) || fwrite(header.data(), 1, header.size(), out_file) != header.size()) {
+        fclose(out_file);
+        return {};
+    }
+
+    return FieldFileWriter{out_file, width, height};
+}
+
+FieldFileWriter::FieldFileWriter(FILE* file, int64_t width, int64_t height)
+    : m_file{file}
+    , m_width{width}
+    , m_remaining_rows{height}
+{ }
+
+FieldFileWriter::FieldFileWriter(FieldFileWriter&& other) noexcept
+    : m_file{other.m_file}
+    , m_width{other.m_width}
+    , m_remaining_rows{other.m_remaining_rows}
+{
+    other.m_file = nullptr;
+}
+
+FieldFileWriter::~FieldFileWriter()
+{
+    if (m_file) {
+        fclose(m_file);
+    }
+}
+
+bool FieldFileWriter::write_rows(FieldSample const* data, int64_t row_count)
+{
+    if (row_count > m_remaining_rows) {
+        return false;
+    }
+    m_remaining_rows -= row_count;
+
+    auto const sample_count = static_cast<std::size_t>(row_count * m_width);
+    return fwrite(data, sizeof(FieldSample), sample_count, m_file) == sample_count;
+}
+
+bool FieldFileWriter::finish()
+{
+    auto const closed = fclose(m_file) == 0;
+    m_file = nullptr;
+    return closed && m_remaining_rows == 0;
+}
+
+// Reads the decimal integer at position in the header and advances position past it. Fails if it is above limit.
+std::optional<int64_t> parse_header_integer(std::string_view header, std::size_t& position, int64_t limit)
+{
+    int64_t value = 0;
+    auto const start = position;
+    while (position < header.size() && header[position] >= '0' && header[position] <= '9') {
+        value = value * 10 + (header[position++] - '0');
+        if (value > limit) {
+            return {};
+        }
+    }
+    if (position == start) {
+        return {};
+    }
+    return value;
+}
+
+std::optional<FieldFile> FieldFile::open(char const* filepath, std::string& error)
+{
+    auto const file = ::open(filepath, O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        error = "cannot open the file";
+        return {};
+    }
+
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0 || file_stat.st_size < 12) {
+        close(file);
+        error = "not a .npy file";
+        return {};
+    }
+
+    auto const mapping_size = static_cast<std::size_t>(file_stat.st_size);
+    auto* const mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) {
+        error = "cannot map the file";
+        return {};
+    }
+
+    auto const fail = [&](char const* message) -> std::optional<FieldFile> {
+        munmap(mapping, mapping_size);
+        error = message;
+        return {};
+    };
+
+    // Version 1 has a 16 bit header length, versions 2 and 3 a 32 bit one
+    auto const* const bytes = static_cast<uint8_t const*>(mapping);
+    if (std::memcmp(bytes, npy_magic.data(), npy_magic.size()) != 0 || bytes[6] < 1 || bytes[6] > 3) {
+        return fail("not a .npy file");
+    }
+    uint32_t header_size = 0;
+    auto const prefix_size = bytes[6] == 1 ? 10 : 12;
+    std::memcpy(&header_size, &bytes[8], prefix_size - 8);
+    auto const data_offset = static_cast<std::size_t>(prefix_size) + header_size;
+    if (data_offset > mapping_size) {
+        return fail("truncated header");
+    }
+
+    auto const header = std::string_view{reinterpret_cast<char const*>(bytes + prefix_size), header_size};
+    auto const descr = header.find("'descr': ");
+    if (descr == std::string_view::npos || header.substr(descr + 9, field_descr.size()) != field_descr) {
+        return fail("the dtype is not the one of a field export");
+    }
+    if (header.find("'fortran_order': False") == std::string_view::npos) {
+        return fail("only C order is supported");
+    }
+
+    auto shape = header.find("'shape': (");
+    if (shape == std::string_view::npos) {
+        return fail("the header has no shape");
+    }
+    shape += 10;
+    // No dimension can be larger than the samples that fit into the file, which also keeps the digits from overflowing
+    auto const sample_capacity = static_cast<int64_t>((mapping_size - data_offset) / sizeof(FieldSample));
+    auto const height = parse_header_integer(header, shape, sample_capacity);
+    if (!height || header.substr(shape, 2) != ", ") {
+        return fail("the array is not two dimensional or larger than the file");
+    }
+    shape += 2;
+    auto const width = parse_header_integer(header, shape, sample_capacity);
+    if (!width || header.substr(shape, 1) != ")") {
+        return fail("the array is not two dimensional or larger than the file");
+    }
+
+    if (data_offset % alignof(FieldSample) != 0 || (*width != 0 && *height > sample_capacity / *width)) {
+        return fail("the file is shorter than its shape");
+    }
+
+    return FieldFile{mapping, mapping_size, data_offset, *width, *height};
+}
+
+FieldFile::FieldFile(void* mapping, std::size_t mapping_size, std::size_t data_offset, int64_t width, int64_t height)
+    : m_mapping{mapping}
+    , m_mapping_size{mapping_size}
+    , m_samples{reinterpret_cast<FieldSample const*>(static_cast<uint8_t const*>(mapping) + data_offset)}
+    , m_width{width}
+    , m_height{height}
+{ }
+
+FieldFile::FieldFile(FieldFile&& other) noexcept
+    : m_mapping{other.m_mapping}
+    , m_mapping_size{other.m_mapping_size}
+    , m_samples{other.m_samples}
+    , m_width{other.m_width}
+    , m_height{other.m_height}
+{
+    other.m_mapping = nullptr;
+}
+
+FieldFile::~FieldFile()
+{
+    if (m_mapping) {
+        munmap(m_mapping, m_mapping_size);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <span>
+#include <string>
+
+// Raw iteration fields as NumPy .npy files, https://numpy.org/doc/stable/reference/generated/numpy.lib.format.html
+//
+// The array has the shape (height, width) and a structured dtype with one float32 field per member of FieldSample, so
+// numpy.load(path, mmap_mode="r")["distance"] maps a single plane without reading the file. The data starts at a multiple
+// of 64 bytes and rows are stored top to bottom.
+
+static_assert(std::endian::native == std::endian::little, "Field files are little endian");
+
+struct FieldSample {
+    float iterations; // Fractional escape count, infinity inside the set
+    float distance; // Exterior distance estimate in complex units, 0 inside the set
+    float normal_x; // Direction of z / dz at the escape, the normal of Phong shading, 0 inside the set
+    float normal_y;
+};
+
+// Writes a field file in blocks of rows, so only one block has to be in memory at a time
+struct FieldFileWriter {
+    static std::optional<FieldFileWriter> open(char const* filepath, int64_t width, int64_t height);
+
+    FieldFileWriter(FieldFileWriter&& other) noexcept;
+    FieldFileWriter& operator=(FieldFileWriter&&) = delete;
+    FieldFileWriter(FieldFileWriter const&) = delete;
+    ~FieldFileWriter();
+
+    bool write_rows(FieldSample const* data, int64_t row_count);
+
+    // Closes the file, fails unless all rows were written
+    bool finish();
+
+private:
+    FILE* m_file;
+    int64_t m_width;
+    int64_t m_remaining_rows;
+
+    FieldFileWriter(FILE* file, int64_t width, int64_t height);
+};
+
+// A field file mapped into memory read only, pages are loaded when the rows are accessed
+struct FieldFile {
+    // Fails if the file is not a two dimensional array with the dtype of FieldSample
+    static std::optional<FieldFile> open(char const* filepath, std::string& error);
+
+    FieldFile(FieldFile&& other) noexcept;
+    FieldFile& operator=(FieldFile&&) = delete;
+    FieldFile(FieldFile const&) = delete;
+    ~FieldFile();
+
+    [[nodiscard]] int64_t width() const
+    {
+        return m_width;
+    }
+
+    [[nodiscard]] int64_t height() const
+    {
+        return m_height;
+    }
+
+    [[nodiscard]] std::span<FieldSample const> rows(int64_t first_row, int64_t row_count) const
+    {
+        return {m_samples + first_row * m_width, static_cast<std::size_t>(row_count * m_width)};
+    }
+
+private:
+    void* m_mapping;
+    std::size_t m_mapping_size;
+    FieldSample const* m_samples;
+    int64_t m_width;
+    int64_t m_height;
+
+    FieldFile(void* mapping, std::size_t mapping_size, std::size_t data_offset, int64_t width, int64_t height);
+};
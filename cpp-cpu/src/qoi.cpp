@@ -0,0 +1,403 @@
+#include "qoi.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <endian.h>
+#include <thread>
+#include <unistd.h>
+
+uint32_t constexpr alpha_mask = 0xff000000;
+std::size_t constexpr min_strip_pixels = 256 * 1024;
+
+uint8_t constexpr QOI_OP_INDEX = 0x00;
+uint8_t constexpr QOI_OP_DIFF = 0x40;
+uint8_t constexpr QOI_OP_LUMA = 0x80;
+uint8_t constexpr QOI_OP_RUN = 0xc0;
+uint8_t constexpr QOI_OP_RGB = 0xfe;
+uint8_t constexpr QOI_OP_RGBA = 0xff;
+uint8_t constexpr QOI_MASK_2 = 0xc0;
+
+uint8_t index_position(Color color)
+{
+    return (color.r * 3 + color.g * 5 + color.b * 7 + color.a * 11) % 64;
+}
+
+void write_be32(uint8_t* out, uint32_t value)
+{
+    value = htobe32(value);
+    std::memcpy(out, &value, 4);
+}
+
+std::array<uint8_t, 14> QOIImage::header(int width, int height)
+{
+    std::array<uint8_t, HEADER_SIZE> header;
+    std::memcpy(header.data(), "qoif", 4);
+    write_be32(&header[4], width);
+    write_be32(&header[8], height);
+    header[12] = 3; // channels
+    header[13] = 0; // colorspace
+    return header;
+}
+
+std::vector<uint8_t> QOIImage::encode(Color const* data, int width, int height)
+{
+    auto const ops = encode_rows(data, width, height);
+    auto const image_header = header(width, height);
+
+    std::vector<uint8_t> out(HEADER_SIZE + ops.size() + END_MARKER.size());
+    auto* position = std::copy(image_header.begin(), image_header.end(), out.data());
+    position = std::copy(ops.begin(), ops.end(), position);
+    std::copy(END_MARKER.begin(), END_MARKER.end(), position);
+
+    return out;
+}
+
+std::vector<uint8_t> QOIImage::encode_rows(Color const* data, int width, int height)
+{
+    auto const pixel_count = static_cast<std::size_t>(width) * height;
+
+    auto const max_strips = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    auto const strip_count = std::clamp<std::size_t>(pixel_count / min_strip_pixels, 1, max_strips);
+    auto const rows_per_strip = (height + strip_count - 1) / strip_count;
+
+    std::vector<std::vector<uint8_t>> strips(strip_count);
+    {
+        std::vector<std::thread> threads;
+        for (std::size_t strip = 1; strip < strip_count; ++strip) {
+            auto const first_row = std::min<std::size_t>(strip * rows_per_strip, height);
+            auto const last_row = std::min<std::size_t>((strip + 1) * rows_per_strip, height);
+            threads.emplace_back(encode_strip, data + first_row * width, (last_row - first_row) * width, std::ref(strips[strip]));
+        }
+        encode_strip(data, std::min<std::size_t>(rows_per_strip, height) * width, strips[0]);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    if (strip_count == 1) {
+        return std::move(strips[0]);
+    }
+
+    std::size_t encoded_size = 0;
+    for (auto const& strip : strips) {
+        encoded_size += strip.size();
+    }
+
+    std::vector<uint8_t> out(encoded_size);
+    auto* position = out.data();
+    for (auto const& strip : strips) {
+        position = std::copy(strip.begin(), strip.end(), position);
+    }
+
+    return out;
+}
+
+int QOIImage::encode_to_file(char const* filepath, Color const* data, int width, int height)
+{
+    auto const encoded = encode(data, width, height);
+
+    FILE* out_file = fopen(filepath, "w");
+    if (!out_file) {
+        return 0;
+    }
+
+    auto const written = fwrite(encoded.data(), 1, encoded.size(), out_file);
+    fclose(out_file);
+
+    return written == encoded.size();
+}
+
+// The decoder state at the start of a strip depends on all previous strips. The strip is made independent of it
+// by starting with an empty index and a QOI_OP_RGB: every index entry referenced by a QOI_OP_INDEX has then been
+// written by this strip, and the decoder has written the same pixel to it. Because all pixels are opaque, an empty
+// entry never matches. So the concatenated strips are still a valid QOI stream.
+void QOIImage::encode_strip(Color const* data, std::size_t pixel_count, std::vector<uint8_t>& out)
+{
+    // QOI_OP_RGB is the largest op used for opaque pixels
+    out.resize(pixel_count * 4);
+    auto* op = out.data();
+
+    std::array<uint32_t, 64> index{};
+    Color last_pixel;
+
+    for (std::size_t pixel_index = 0; pixel_index < pixel_count;) {
+        Color pixel;
+        pixel.color = data[pixel_index].color | alpha_mask;
+
+        if (pixel_index > 0 && pixel == last_pixel) {
+            // Find the end of the run with a plain compare loop instead of going through the op selection for every pixel
+            auto run_end = pixel_index + 1;
+            while (run_end < pixel_count && (data[run_end].color | alpha_mask) == last_pixel.color) {
+                ++run_end;
+            }
+
+            auto run_length = run_end - pixel_index;
+            for (; run_length >= 62; run_length -= 62) {
+                *op++ = QOI_OP_RUN | 61;
+            }
+            if (run_length > 0) {
+                *op++ = QOI_OP_RUN | (run_length - 1);
+            }
+
+            pixel_index = run_end;
+            continue;
+        }
+
+        auto const position = index_position(pixel);
+        if (index[position] == pixel.color) {
+            *op++ = QOI_OP_INDEX | position;
+        } else {
+            index[position] = pixel.color;
+
+            auto const dr = pixel.r - last_pixel.r;
+            auto const dg = pixel.g - last_pixel.g;
+            auto const db = pixel.b - last_pixel.b;
+            auto const diff_dr_dg = dr - dg;
+            auto const diff_db_dg = db - dg;
+
+            if (pixel_index == 0) {
+                op[0] = QOI_OP_RGB;
+                op[1] = pixel.r;
+                op[2] = pixel.g;
+                op[3] = pixel.b;
+                op += 4;
+            } else if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                *op++ = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+            } else if (dg >= -32 && dg <= 31 && diff_dr_dg >= -8 && diff_dr_dg <= 7 && diff_db_dg >= -8 && diff_db_dg <= 7) {
+                op[0] = QOI_OP_LUMA | (dg + 32);
+                op[1] = ((diff_dr_dg + 8) << 4) | (diff_db_dg + 8);
+                op += 2;
+            } else {
+                op[0] = QOI_OP_RGB;
+                op[1] = pixel.r;
+                op[2] = pixel.g;
+                op[3] = pixel.b;
+                op += 4;
+            }
+        }
+
+        last_pixel = pixel;
+        ++pixel_index;
+    }
+
+    out.resize(op - out.data());
+}
+
+std::optional<QOIFileWriter> QOIFileWriter::open(char const* filepath, int width, int height, long resume_offset)
+{
+    if (resume_offset > 0) {
+        FILE* out_file = fopen(filepath, "r+");
+        if (!out_file) {
+            return {};
+        }
+
+        if (ftruncate(fileno(out_file), resume_offset) != 0 || fseek(out_file, resume_offset, SEEK_SET) != 0) {
+            fclose(out_file);
+            return {};
+        }
+
+        return QOIFileWriter{out_file, width};
+    }
+
+    FILE* out_file = fopen(filepath, "w");
+    if (!out_file) {
+        return {};
+    }
+
+    auto const header = QOIImage::header(width, height);
+    if (fwrite(header.data(), 1, header.size(), out_file) != header.size()) {
+        fclose(out_file);
+        return {};
+    }
+
+    return QOIFileWriter{out_file, width};
+}
+
+QOIFileWriter::QOIFileWriter(FILE* file, int width)
+    : m_file{file}
+    , m_width{width}
+{ }
+
+QOIFileWriter::QOIFileWriter(QOIFileWriter&& other) noexcept
+    : m_file{other.m_file}
+    , m_width{other.m_width}
+{
+    other.m_file = nullptr;
+}
+
+QOIFileWriter::~QOIFileWriter()
+{
+    if (m_file) {
+        fclose(m_file);
+    }
+}
+
+bool QOIFileWriter::write_rows(Color const* data, int row_count)
+{
+    auto const ops = QOIImage::encode_rows(data, m_width, row_count);
+    return fwrite(ops.data(), 1, ops.size(), m_file) == ops.size();
+}
+
+long QOIFileWriter::sync()
+{
+    if (fflush(m_file) != 0 || fsync(fileno(m_file)) != 0) {
+        return -1;
+    }
+    return ftell(m_file);
+}
+
+bool QOIFileWriter::finish()
+{
+    auto const written = fwrite(QOIImage::END_MARKER.data(), 1, QOIImage::END_MARKER.size(), m_file) == QOIImage::END_MARKER.size();
+    auto const closed = fclose(m_file) == 0;
+    m_file = nullptr;
+    return written && closed;
+}
+
+std::optional<QOIDecoder> QOIDecoder::open(char const* filepath)
+{
+    FILE* in_file = fopen(filepath, "r");
+    if (!in_file) {
+        return {};
+    }
+
+    uint8_t header[QOIImage::HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), in_file) != sizeof(header) || std::memcmp(header, "qoif", 4) != 0) {
+        fclose(in_file);
+        return {};
+    }
+
+    uint32_t width;
+    uint32_t height;
+    std::memcpy(&width, &header[4], 4);
+    std::memcpy(&height, &header[8], 4);
+
+    return QOIDecoder{in_file, static_cast<int>(be32toh(width)), static_cast<int>(be32toh(height))};
+}
+
+QOIDecoder::QOIDecoder(FILE* file, int width, int height)
+    : m_file{file}
+    , m_width{width}
+    , m_height{height}
+{ }
+
+QOIDecoder::QOIDecoder(QOIDecoder&& other) noexcept
+    : m_file{other.m_file}
+    , m_width{other.m_width}
+    , m_height{other.m_height}
+    , m_rows_read{other.m_rows_read}
+    , m_run{other.m_run}
+    , m_last_pixel{other.m_last_pixel}
+    , m_index{other.m_index}
+    , m_input{other.m_input}
+    , m_input_position{other.m_input_position}
+    , m_input_size{other.m_input_size}
+{
+    other.m_file = nullptr;
+}
+
+QOIDecoder::~QOIDecoder()
+{
+    if (m_file) {
+        fclose(m_file);
+    }
+}
+
+bool QOIDecoder::read_byte(uint8_t& byte)
+{
+    if (m_input_position == m_input_size) {
+        m_input_size = fread(m_input.data(), 1, m_input.size(), m_file);
+        m_input_position = 0;
+        if (m_input_size == 0) {
+            return false;
+        }
+    }
+
+    byte = m_input[m_input_position++];
+    return true;
+}
+
+bool QOIDecoder::read_rows(Color* out, int row_count)
+{
+    if (m_rows_read + row_count > m_height) {
+        return false;
+    }
+
+    auto const pixel_count = static_cast<std::size_t>(row_count) * m_width;
+    for (std::size_t pixel_index = 0; pixel_index < pixel_count; ++pixel_index) {
+        if (m_run > 0) {
+            --m_run;
+            out[pixel_index] = m_last_pixel;
+            continue;
+        }
+
+        uint8_t op;
+        if (!read_byte(op)) {
+            return false;
+        }
+
+        auto pixel = m_last_pixel;
+        if (op == QOI_OP_RGB || op == QOI_OP_RGBA) {
+            uint8_t rgba[4] = {0, 0, 0, pixel.a};
+            for (int i = 0; i < (op == QOI_OP_RGB ? 3 : 4); ++i) {
+                if (!read_byte(rgba[i])) {
+                    return false;
+                }
+            }
+            pixel.r = rgba[0];
+            pixel.g = rgba[1];
+            pixel.b = rgba[2];
+            pixel.a = rgba[3];
+        } else {
+            switch (op & QOI_MASK_2) {
+            case QOI_OP_INDEX:
+                pixel = m_index[op];
+                break;
+            case QOI_OP_DIFF:
+                pixel.r += ((op >> 4) & 0x03) - 2;
+                pixel.g += ((op >> 2) & 0x03) - 2;
+                pixel.b += (op & 0x03) - 2;
+                break;
+            case QOI_OP_LUMA: {
+                uint8_t second;
+                if (!read_byte(second)) {
+                    return false;
+                }
+                int const dg = (op & 0x3f) - 32;
+                pixel.r += dg - 8 + ((second >> 4) & 0x0f);
+                pixel.g += dg;
+                pixel.b += dg - 8 + (second & 0x0f);
+                break;
+            }
+            case QOI_OP_RUN:
+                m_run = op & 0x3f;
+                break;
+            }
+        }
+
+        m_index[index_position(pixel)] = pixel;
+        m_last_pixel = pixel;
+        out[pixel_index] = pixel;
+    }
+
+    m_rows_read += row_count;
+    return true;
+}
+
+std::optional<std::vector<Color>> QOIDecoder::decode_file(char const* filepath, int& width, int& height)
+{
+    auto decoder = open(filepath);
+    if (!decoder) {
+        return {};
+    }
+
+    width = decoder->width();
+    height = decoder->height();
+
+    std::vector<Color> pixels(static_cast<std::size_t>(width) * height);
+    if (!decoder->read_rows(pixels.data(), height)) {
+        return {};
+    }
+
+    return pixels;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "color.hpp"
+
+#include <array>
+#include <cstdio>
+#include <optional>
+#include <vector>
+
+// https://qoiformat.org/qoi-specification.pdf
+struct QOIImage {
+    // Encodes the image into one contiguous buffer, including header and end marker.
+    // Large images are split into strips of rows that are encoded in parallel, see encode_strip().
+    static std::vector<uint8_t> encode(Color const* data, int width, int height);
+
+    static int encode_to_file(char const* filepath, Color const* data, int width, int height);
+
+    // Encodes only the ops for the given rows, without header and end marker.
+    // The result does not depend on any previous rows, so it can be appended to any QOI stream of the same width.
+    static std::vector<uint8_t> encode_rows(Color const* data, int width, int height);
+
+    static std::array<uint8_t, 14> header(int width, int height);
+
+    static std::size_t constexpr HEADER_SIZE = 14;
+    static std::array<uint8_t, 8> constexpr END_MARKER = {0, 0, 0, 0, 0, 0, 0, 1};
+
+private:
+    static void encode_strip(Color const* data, std::size_t pixel_count, std::vector<uint8_t>& out);
+};
+
+// Writes a QOI file in independently encoded blocks of rows, so only one block has to be in memory at a time.
+// Every block ends at a known file offset, which allows resuming an interrupted file from there.
+struct QOIFileWriter {
+    // With a resume_offset, the existing file is truncated to that offset and writing continues after it
+    static std::optional<QOIFileWriter> open(char const* filepath, int width, int height, long resume_offset = 0);
+
+    QOIFileWriter(QOIFileWriter&& other) noexcept;
+    QOIFileWriter& operator=(QOIFileWriter&&) = delete;
+    QOIFileWriter(QOIFileWriter const&) = delete;
+    ~QOIFileWriter();
+
+    bool write_rows(Color const* data, int row_count);
+
+    // Flushes everything written so far to disk and returns the file offset after it
+    long sync();
+
+    // Writes the end marker and closes the file
+    bool finish();
+
+private:
+    FILE* m_file;
+    int m_width;
+
+    QOIFileWriter(FILE* file, int width);
+};
+
+// Decodes a QOI file row by row, only buffering a fixed amount of the compressed input
+struct QOIDecoder {
+    static std::optional<QOIDecoder> open(char const* filepath);
+
+    QOIDecoder(QOIDecoder&& other) noexcept;
+    QOIDecoder& operator=(QOIDecoder&&) = delete;
+    QOIDecoder(QOIDecoder const&) = delete;
+    ~QOIDecoder();
+
+    [[nodiscard]] int width() const
+    {
+        return m_width;
+    }
+
+    [[nodiscard]] int height() const
+    {
+        return m_height;
+    }
+
+    // Decodes the next row_count rows into out, which must hold row_count * width() pixels.
+    // Returns false if the file ends early or more rows are requested than the image has.
+    bool read_rows(Color* out, int row_count);
+
+    // Decodes the whole file at once
+    static std::optional<std::vector<Color>> decode_file(char const* filepath, int& width, int& height);
+
+private:
+    FILE* m_file;
+    int m_width;
+    int m_height;
+    int m_rows_read{0};
+    int m_run{0};
+    Color m_last_pixel;
+    std::array<Color, 64> m_index{};
+    std::array<uint8_t, 64 * 1024> m_input{};
+    std::size_t m_input_position{0};
+    std::size_t m_input_size{0};
+
+    QOIDecoder(FILE* file, int width, int height);
+
+    bool read_byte(uint8_t& byte);
+};
@@ -0,0 +1,105 @@
+#include "settings.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+template <typename T>
+bool parse_setting(std::string_view value, T& out, T min, T max)
+{
+    T parsed;
+    auto const [end, error] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+    if (error != std::errc{} || end != value.data() + value.size() || parsed < min || parsed > max) {
+        return false;
+    }
+    out = parsed;
+    return true;
+}
+
+bool Settings::set(std::string_view name, std::string_view value)
+{
+    if (name == "chunk_size") {
+        int64_t parsed;
+        if (!parse_setting<int64_t>(value, parsed, 16, 4096) || parsed % 16 != 0) {
+            return false;
+        }
+        chunk_size = parsed;
+        return true;
+    }
+    if (name == "thread_count") {
+        return parse_setting<int32_t>(value, thread_count, 0, 4096);
+    }
+    if (name == "max_queue_size") {
+        return parse_setting<int32_t>(value, max_queue_size, 0, 1 << 20);
+    }
+    if (name == "max_chunk_memory") {
+        return parse_setting<std::size_t>(value, max_chunk_memory, 1, SIZE_MAX);
+    }
+    if (name == "worker_processes") {
+        return parse_setting<int32_t>(value, worker_processes, 0, 4096);
+    }
+    if (name == "kernel_interleave") {
+        return parse_setting<int32_t>(value, kernel_interleave, 0, 4);
+    }
+    return false;
+}
+
+std::filesystem::path host_settings_path()
+{
+    std::filesystem::path config_home;
+    if (auto const* xdg_config_home = std::getenv("XDG_CONFIG_HOME"); xdg_config_home && *xdg_config_home) {
+        config_home = xdg_config_home;
+    } else if (auto const* home = std::getenv("HOME")) {
+        config_home = std::filesystem::path{home} / ".config";
+    } else {
+        config_home = ".";
+    }
+
+    char hostname[256] = "default";
+    gethostname(hostname, sizeof(hostname) - 1);
+    return config_home / "mandelbrot" / (std::string{hostname} + ".conf");
+}
+
+bool load_settings(std::filesystem::path const& path, Settings& settings)
+{
+    FILE* in_file = fopen(path.c_str(), "r");
+    if (!in_file) {
+        return true;
+    }
+
+    auto success = true;
+    char line[256];
+    for (int line_number = 1; fgets(line, sizeof(line), in_file); ++line_number) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+
+        char name[64];
+        char value[64];
+        if (sscanf(line, "%63s %63s", name, value) != 2 || !settings.set(name, value)) {
+            std::cerr << path.string() << ":" << line_number << ": invalid setting\n";
+            success = false;
+        }
+    }
+
+    fclose(in_file);
+    return success;
+}
+
+bool save_settings(std::filesystem::path const& path, Settings const& settings)
+{
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    FILE* out_file = fopen(path.c_str(), "w");
+    if (!out_file) {
+        return false;
+    }
+
+    fprintf(out_file, "chunk_size %ld\nthread_count %d\nmax_queue_size %d\nmax_chunk_memory %zu\nworker_processes %d\nkernel_interleave %d\n",
+        settings.chunk_size, settings.thread_count, settings.max_queue_size, settings.max_chunk_memory, settings.worker_processes, settings.kernel_interleave);
+    return fclose(out_file) == 0;
+}
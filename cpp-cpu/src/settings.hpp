@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+// Renderer parameters that depend on the machine. They are loaded from the settings file of the host, can be overridden
+// on the command line and are written by --auto-tune.
+// Settings files are text files with one "<name> <value>" pair per line, lines starting with '#' are comments.
+struct Settings {
+    int64_t chunk_size = 256; // Must be a multiple of 16, so every sample step covers whole AVX vectors
+    int32_t thread_count = 0; // 0 uses one worker per hardware thread
+    int32_t max_queue_size = 0; // 0 uses thread_count
+    std::size_t max_chunk_memory = 1024 * 1024 * 1024; // 1GiB
+    int32_t worker_processes = 0; // Compute chunks in this many separate processes instead of threads, see worker.hpp
+    int32_t kernel_interleave = 0; // Vectors the AVX kernel iterates together, 0 uses default_kernel_interleave
+
+    // Returns false for unknown names and invalid values
+    bool set(std::string_view name, std::string_view value);
+};
+
+// $XDG_CONFIG_HOME/mandelbrot/<hostname>.conf, so one home directory can be shared between machines
+std::filesystem::path host_settings_path();
+
+// A missing file is not an error and leaves the settings unchanged
+bool load_settings(std::filesystem::path const& path, Settings& settings);
+
+bool save_settings(std::filesystem::path const& path, Settings const& settings);
@@ -0,0 +1,121 @@
+#include "trace.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+bool trace_enabled = false;
+
+struct TraceRingBuffer {
+    static std::size_t constexpr CAPACITY = 1 << 16;
+
+    std::string thread_name;
+    std::size_t thread_id;
+    // Only the owning thread writes, trace_flush() reads after all threads are joined
+    std::atomic<uint64_t> head{0};
+    std::array<TraceEvent, CAPACITY> events;
+};
+
+char const* trace_path = nullptr;
+auto trace_start = std::chrono::steady_clock::time_point{};
+std::mutex trace_ring_buffers_mutex;
+std::vector<std::unique_ptr<TraceRingBuffer>> trace_ring_buffers;
+thread_local TraceRingBuffer* trace_thread_ring_buffer = nullptr;
+
+TraceRingBuffer& trace_get_ring_buffer()
+{
+    if (!trace_thread_ring_buffer) {
+        // Only taken once per thread
+        std::lock_guard<std::mutex> lock{trace_ring_buffers_mutex};
+        auto ring_buffer = std::make_unique<TraceRingBuffer>();
+        ring_buffer->thread_id = trace_ring_buffers.size();
+        ring_buffer->thread_name = "thread " + std::to_string(ring_buffer->thread_id);
+        trace_thread_ring_buffer = ring_buffer.get();
+        trace_ring_buffers.push_back(std::move(ring_buffer));
+    }
+    return *trace_thread_ring_buffer;
+}
+
+void trace_init()
+{
+    trace_path = std::getenv("MANDELBROT_TRACE");
+    trace_enabled = trace_path && *trace_path;
+    trace_start = std::chrono::steady_clock::now();
+}
+
+uint64_t trace_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_start).count();
+}
+
+void trace_set_thread_name(char const* name)
+{
+    if (trace_enabled) {
+        trace_get_ring_buffer().thread_name = name;
+    }
+}
+
+void trace_record(TraceEvent const& event)
+{
+    auto& ring_buffer = trace_get_ring_buffer();
+    auto const head = ring_buffer.head.load(std::memory_order_relaxed);
+    ring_buffer.events[head % TraceRingBuffer::CAPACITY] = event;
+    ring_buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void trace_flush()
+{
+    if (!trace_enabled) {
+        return;
+    }
+
+    FILE* out_file = fopen(trace_path, "w");
+    if (!out_file) {
+        std::cerr << "Failed to open trace file " << trace_path << "\n";
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock{trace_ring_buffers_mutex};
+
+    fprintf(out_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (auto const& ring_buffer : trace_ring_buffers) {
+        fprintf(out_file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", ring_buffer->thread_id, ring_buffer->thread_name.c_str());
+        first = false;
+
+        // Older events have been overwritten if the ring buffer wrapped around
+        auto const head = ring_buffer->head.load(std::memory_order_acquire);
+        auto const begin = head > TraceRingBuffer::CAPACITY ? head - TraceRingBuffer::CAPACITY : 0;
+        for (auto i = begin; i < head; ++i) {
+            auto const& event = ring_buffer->events[i % TraceRingBuffer::CAPACITY];
+            fprintf(out_file, ",\n{\"name\":\"%s\",\"cat\":\"mandelbrot\",\"ph\":\"%c\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f",
+                event.name, static_cast<char>(event.phase), ring_buffer->thread_id, event.timestamp / 1000.0);
+            switch (event.phase) {
+            case TracePhase::COMPLETE:
+                fprintf(out_file, ",\"dur\":%.3f", event.duration / 1000.0);
+                break;
+            case TracePhase::INSTANT:
+                fprintf(out_file, ",\"s\":\"t\"");
+                break;
+            case TracePhase::ASYNC_BEGIN:
+            case TracePhase::ASYNC_END:
+                fprintf(out_file, ",\"id\":%" PRIu64, event.id);
+                break;
+            }
+            fprintf(out_file, ",\"args\":{\"id\":%" PRIu64 "}}", event.id);
+        }
+    }
+    fprintf(out_file, "\n]}\n");
+
+    fclose(out_file);
+    std::cout << "Wrote trace to " << trace_path << "\n";
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+
+// Opt-in event tracing, enabled by setting MANDELBROT_TRACE to an output path.
+// Every thread records into its own lock-free ring buffer, trace_flush() writes all of them as Chrome trace JSON,
+// which can be opened in chrome://tracing or https://ui.perfetto.dev.
+
+enum class TracePhase : char {
+    COMPLETE = 'X',
+    INSTANT = 'i',
+    ASYNC_BEGIN = 'b',
+    ASYNC_END = 'e',
+};
+
+struct TraceEvent {
+    char const* name; // Must be a string literal
+    uint64_t timestamp; // ns since trace_init()
+    uint64_t duration; // ns, only used by COMPLETE events
+    uint64_t id;
+    TracePhase phase;
+};
+
+// Only written by trace_init(), before any other thread is started
+extern bool trace_enabled;
+
+void trace_init();
+void trace_flush();
+void trace_set_thread_name(char const* name);
+uint64_t trace_now();
+void trace_record(TraceEvent const& event);
+
+inline void trace_instant(char const* name, uint64_t id = 0)
+{
+    if (trace_enabled) [[unlikely]] {
+        trace_record(TraceEvent{name, trace_now(), 0, id, TracePhase::INSTANT});
+    }
+}
+
+inline void trace_async_begin(char const* name, uint64_t id)
+{
+    if (trace_enabled) [[unlikely]] {
+        trace_record(TraceEvent{name, trace_now(), 0, id, TracePhase::ASYNC_BEGIN});
+    }
+}
+
+inline void trace_async_end(char const* name, uint64_t id)
+{
+    if (trace_enabled) [[unlikely]] {
+        trace_record(TraceEvent{name, trace_now(), 0, id, TracePhase::ASYNC_END});
+    }
+}
+
+// Records a COMPLETE event from construction until destruction
+struct TraceSpan {
+    explicit TraceSpan(char const* name, uint64_t id = 0)
+        : m_name{name}
+        , m_id{id}
+    {
+        if (trace_enabled) [[unlikely]] {
+            m_start = trace_now();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (trace_enabled) [[unlikely]] {
+            trace_record(TraceEvent{m_name, m_start, trace_now() - m_start, m_id, TracePhase::COMPLETE});
+        }
+    }
+
+    TraceSpan(TraceSpan const&) = delete;
+    TraceSpan& operator=(TraceSpan const&) = delete;
+
+private:
+    char const* m_name;
+    uint64_t m_id;
+    uint64_t m_start{0};
+};
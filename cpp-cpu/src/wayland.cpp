@@ -90,7 +90,7 @@ void handler_xdg_toplevel_configure(void* data, xdg_toplevel*, int32_t width, in
     wl_shm_pool_destroy(shm_pool);
 
     if (window->callback_window_resize) {
-        window->callback_window_resize(width, height);
+        window->callback_window_resize(window->width, window->height);
     }
 }
 
@@ -10,12 +10,19 @@
 
 enum class Scancodes {
     Q = 16,
+    E = 18,
+    R = 19,
     I = 23,
+    P = 25,
     PLUS = 27,
+    A = 30,
     S = 31,
+    F = 33,
     H = 35,
     MINUS = 53,
     C = 46,
+    M = 50,
+    B = 48,
 };
 
 struct Window {
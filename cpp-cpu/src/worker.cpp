@@ -0,0 +1,260 @@
+#include "worker.hpp"
+
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Sends or receives exactly size bytes. Waits at most until deadline for each chunk of data, if one is given.
+bool transfer_all(int socket, void* data, std::size_t size, bool is_send, std::optional<std::chrono::steady_clock::time_point> deadline = {})
+{
+    auto* bytes = static_cast<uint8_t*>(data);
+    while (size > 0) {
+        if (deadline) {
+            auto const remaining = std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now()).count();
+            auto descriptor = pollfd{.fd = socket, .events = static_cast<short>(is_send ? POLLOUT : POLLIN), .revents = 0};
+            if (remaining <= 0 || poll(&descriptor, 1, static_cast<int>(remaining)) <= 0) {
+                return false;
+            }
+        }
+
+        auto const transferred = is_send ? send(socket, bytes, size, MSG_NOSIGNAL) : recv(socket, bytes, size, 0);
+        if (transferred <= 0) {
+            if (transferred < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += transferred;
+        size -= transferred;
+    }
+    return true;
+}
+
+template <typename T>
+bool send_message(int socket, T const& message)
+{
+    return transfer_all(socket, const_cast<T*>(&message), sizeof(T), true);
+}
+
+template <typename T>
+bool receive_message(int socket, T& message, std::optional<std::chrono::steady_clock::time_point> deadline = {})
+{
+    return transfer_all(socket, &message, sizeof(T), false, deadline);
+}
+
+std::optional<SharedChunkArena> SharedChunkArena::create(std::size_t slot_pixels, std::size_t slot_count)
+{
+    auto const fd = memfd_create("mandelbrot chunks", MFD_CLOEXEC);
+    if (fd < 0) {
+        return {};
+    }
+
+    auto const size = slot_pixels * slot_count * sizeof(Color);
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return {};
+    }
+
+    auto* pixels = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pixels == MAP_FAILED) {
+        close(fd);
+        return {};
+    }
+
+    return SharedChunkArena{fd, static_cast<Color*>(pixels), slot_pixels, slot_count};
+}
+
+SharedChunkArena::SharedChunkArena(int fd, Color* pixels, std::size_t slot_pixels, std::size_t slot_count)
+    : m_fd{fd}
+    , m_pixels{pixels}
+    , m_slot_pixels{slot_pixels}
+    , m_slot_count{slot_count}
+{
+    // Lowest slots first
+    m_free_slots.reserve(slot_count);
+    for (auto slot = slot_count; slot > 0; --slot) {
+        m_free_slots.push_back(slot - 1);
+    }
+}
+
+SharedChunkArena::SharedChunkArena(SharedChunkArena&& other) noexcept
+    : m_fd{other.m_fd}
+    , m_pixels{other.m_pixels}
+    , m_slot_pixels{other.m_slot_pixels}
+    , m_slot_count{other.m_slot_count}
+    , m_free_slots{std::move(other.m_free_slots)}
+{
+    other.m_fd = -1;
+    other.m_pixels = nullptr;
+}
+
+SharedChunkArena::~SharedChunkArena()
+{
+    if (m_pixels) {
+        munmap(m_pixels, m_slot_pixels * m_slot_count * sizeof(Color));
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+std::optional<std::size_t> SharedChunkArena::allocate()
+{
+    if (m_free_slots.empty()) {
+        return {};
+    }
+    auto const slot = m_free_slots.back();
+    m_free_slots.pop_back();
+    return slot;
+}
+
+void SharedChunkArena::release(std::size_t slot)
+{
+    m_free_slots.push_back(slot);
+}
+
+std::span<Color> SharedChunkArena::slot(std::size_t slot) const
+{
+    return std::span<Color>{m_pixels + slot * m_slot_pixels, m_slot_pixels};
+}
+
+std::optional<std::size_t> SharedChunkArena::find(Color const* pixels) const
+{
+    if (pixels < m_pixels || pixels >= m_pixels + m_slot_pixels * m_slot_count) {
+        return {};
+    }
+    return (pixels - m_pixels) / m_slot_pixels;
+}
+
+RemoteWorker::RemoteWorker(SharedChunkArena const& arena, int64_t chunk_size)
+    : m_arena{arena}
+    , m_chunk_size{chunk_size}
+{ }
+
+RemoteWorker::~RemoteWorker()
+{
+    stop();
+}
+
+std::optional<WorkerResult> RemoteWorker::run(WorkerJob const& job, std::chrono::milliseconds timeout)
+{
+    if (m_pid < 0 && !start()) {
+        return {};
+    }
+
+    WorkerResult result;
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    if (!send_message(m_socket, job) || !receive_message(m_socket, result, deadline) || result.job_id != job.job_id) {
+        auto const pid = m_pid;
+        auto const timed_out = std::chrono::steady_clock::now() >= deadline;
+        auto const status = stop();
+        if (timed_out) {
+            std::cerr << "Worker process " << pid << " did not answer in time, reassigning its chunk\n";
+        } else {
+            std::cerr << "Worker process " << pid << " failed" << (WIFSIGNALED(status) ? " with signal " + std::to_string(WTERMSIG(status)) : std::string{}) << ", reassigning its chunk\n";
+        }
+        return {};
+    }
+
+    return result;
+}
+
+bool RemoteWorker::start()
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) {
+        return false;
+    }
+
+    // Everything the child needs is prepared before forking, only async-signal-safe calls are allowed after it
+    auto const socket_argument = std::to_string(sockets[1]);
+    auto const shared_memory_argument = std::to_string(m_arena.fd());
+    char const* const arguments[] = {"/proc/self/exe", "--worker", socket_argument.c_str(), shared_memory_argument.c_str(), nullptr};
+
+    auto const pid = fork();
+    if (pid < 0) {
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        fcntl(sockets[1], F_SETFD, 0);
+        fcntl(m_arena.fd(), F_SETFD, 0);
+        execv(arguments[0], const_cast<char* const*>(arguments));
+        _exit(127);
+    }
+
+    close(sockets[1]);
+    m_pid = pid;
+    m_socket = sockets[0];
+
+    auto const hello = WorkerHello{
+        .magic = WORKER_PROTOCOL_MAGIC,
+        .version = WORKER_PROTOCOL_VERSION,
+        .chunk_size = m_chunk_size,
+        .slot_count = m_arena.slot_count(),
+    };
+    if (!send_message(m_socket, hello)) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+int RemoteWorker::stop()
+{
+    if (m_socket >= 0) {
+        close(m_socket);
+        m_socket = -1;
+    }
+
+    // Killing a process that already died does not change its exit status
+    int status = 0;
+    if (m_pid >= 0) {
+        kill(m_pid, SIGKILL);
+        waitpid(m_pid, &status, 0);
+        m_pid = -1;
+    }
+    return status;
+}
+
+int run_worker(int socket, int shared_memory_fd, std::function<WorkerResult(WorkerJob const& job, int64_t chunk_size, std::span<Color> pixels)> const& compute)
+{
+    WorkerHello hello;
+    if (!receive_message(socket, hello) || hello.magic != WORKER_PROTOCOL_MAGIC || hello.version != WORKER_PROTOCOL_VERSION || hello.slot_count == 0) {
+        std::cerr << "Worker: invalid hello\n";
+        return 1;
+    }
+
+    auto const slot_pixels = static_cast<std::size_t>(hello.chunk_size * hello.chunk_size);
+    auto* mapping = mmap(nullptr, slot_pixels * hello.slot_count * sizeof(Color), PROT_READ | PROT_WRITE, MAP_SHARED, shared_memory_fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Worker: failed to map the shared memory\n";
+        return 1;
+    }
+    auto* const shared_pixels = static_cast<Color*>(mapping);
+
+    WorkerJob job;
+    while (receive_message(socket, job)) {
+        if (job.slot >= hello.slot_count) {
+            std::cerr << "Worker: invalid slot " << job.slot << "\n";
+            return 1;
+        }
+
+        auto const result = compute(job, hello.chunk_size, std::span<Color>{shared_pixels + job.slot * slot_pixels, slot_pixels});
+        if (!send_message(socket, result)) {
+            return 1;
+        }
+    }
+
+    // The viewer closed the socket
+    return 0;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "color.hpp"
+
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <sys/types.h>
+#include <vector>
+
+// Out-of-process render workers, enabled with the worker_processes setting.
+//
+// The viewer talks to every worker process over a stream socket. All messages are fixed size structs of fixed width
+// little endian fields without pointers. Worker processes get a shared memory file and write their results into chunk
+// slots in it, which the viewer blits without copying.
+
+static_assert(std::endian::native == std::endian::little, "The worker protocol is little endian");
+
+uint32_t constexpr WORKER_PROTOCOL_MAGIC = 0x4d414e44; // "MAND"
+uint32_t constexpr WORKER_PROTOCOL_VERSION = 2;
+
+// Viewer to worker, once after connecting
+struct WorkerHello {
+    uint32_t magic;
+    uint32_t version;
+    int64_t chunk_size;
+    uint64_t slot_count;
+};
+
+// Viewer to worker, the parameters of one chunk, see Chunk::create()
+struct WorkerJob {
+    uint64_t job_id;
+    double position_real;
+    double position_imag;
+    double complex_size;
+    uint64_t formula;
+    int64_t max_iterations;
+    uint64_t color_function;
+    int64_t sample_step;
+    int64_t antialiasing_samples;
+    uint64_t slot;
+};
+
+// Worker to viewer, after the pixels were written to the slot of the job
+struct WorkerResult {
+    uint64_t job_id;
+    uint64_t iteration_count;
+    int64_t max_iterations; // The limit the chunk was computed with, which may be higher than in the job if that was adaptive
+    uint64_t bounded_count;
+};
+
+// Chunk slots in a shared memory file. The file is sparse, so only slots that have been written use memory.
+// Allocation is not thread safe.
+struct SharedChunkArena {
+    static std::optional<SharedChunkArena> create(std::size_t slot_pixels, std::size_t slot_count);
+
+    SharedChunkArena(SharedChunkArena&& other) noexcept;
+    SharedChunkArena& operator=(SharedChunkArena&&) = delete;
+    SharedChunkArena(SharedChunkArena const&) = delete;
+    ~SharedChunkArena();
+
+    std::optional<std::size_t> allocate();
+    void release(std::size_t slot);
+
+    [[nodiscard]] std::span<Color> slot(std::size_t slot) const;
+
+    // The slot that contains the pixels, if they are in the arena
+    [[nodiscard]] std::optional<std::size_t> find(Color const* pixels) const;
+
+    [[nodiscard]] int fd() const
+    {
+        return m_fd;
+    }
+
+    [[nodiscard]] std::size_t slot_count() const
+    {
+        return m_slot_count;
+    }
+
+private:
+    int m_fd;
+    Color* m_pixels;
+    std::size_t m_slot_pixels;
+    std::size_t m_slot_count;
+    std::vector<std::size_t> m_free_slots;
+
+    SharedChunkArena(int fd, Color* pixels, std::size_t slot_pixels, std::size_t slot_count);
+};
+
+// A worker process as seen by the viewer. The process is started on demand and restarted after it crashed or timed out.
+struct RemoteWorker {
+    RemoteWorker(SharedChunkArena const& arena, int64_t chunk_size);
+    RemoteWorker(RemoteWorker const&) = delete;
+    RemoteWorker& operator=(RemoteWorker const&) = delete;
+    ~RemoteWorker();
+
+    // Runs the job and waits for its result. Returns nothing if the worker crashed, sent garbage or did not answer within
+    // timeout, the worker is then killed and the job can be given to another one.
+    std::optional<WorkerResult> run(WorkerJob const& job, std::chrono::milliseconds timeout);
+
+private:
+    SharedChunkArena const& m_arena;
+    int64_t m_chunk_size;
+    pid_t m_pid{-1};
+    int m_socket{-1};
+
+    bool start();
+    // Returns the wait status of the process
+    int stop();
+};
+
+// The main loop of a worker process. Computes the chunk of every job into pixels and returns its result.
+// Returns when the viewer closes the socket.
+int run_worker(int socket, int shared_memory_fd, std::function<WorkerResult(WorkerJob const& job, int64_t chunk_size, std::span<Color> pixels)> const& compute);
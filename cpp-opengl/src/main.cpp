@@ -2,32 +2,148 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
 const char* vertexShaderSource = R"(
 #version 440 core
 layout (location = 0) in vec2 posIn;
 
-out smooth vec2 pos;
-
 void main() {
     gl_Position = vec4(posIn, 0.0, 1.0);
-    pos = posIn;
 }
 )";
 
-const char* fragmentShaderSource = R"(
+// The fragment shaders are assembled from a header, the iteration of one precision and a main. Every precision defines
+// start_state(), z = c packed into 128 bits, and advance(), which continues the iteration of a packed z for at most
+// max_its iterations and returns how many it ran until z escaped. The packed z lives in the state textures of the
+// progressive mode, as raw bits so that double and double-float are stored without rounding.
+const char* fragmentShaderHeader = R"(
 #version 440 core
-out vec4 FragColor;
+uniform int max_iterations;
+uniform vec2 viewport_size;
+
+// The position in [-1, 1], from the pixel center instead of an interpolated varying: drivers may interpolate differently
+// per program, and the progressive and the single pass have to iterate the same c
+vec2 pixel_pos() {
+    return gl_FragCoord.xy / viewport_size * 2. - 1.;
+}
+)";
+
+const char* fragmentShaderFloat = R"(
+uniform vec2 center;
+uniform vec2 scale;
+
+int mandelbrot(inout vec2 z, vec2 c, int max_its) {
+    for (int i = 0; i < max_its; i++){
+        if (dot(z, z) > 4.) return i;
+        z = vec2(z.x * z.x - z.y * z.y, 2. * z.x * z.y) + c;
+    }
+    return max_its;
+}
 
-in vec2 pos;
+uvec4 start_state() {
+    return uvec4(floatBitsToUint(center + pixel_pos() * scale), 0, 0);
+}
+
+int advance(inout uvec4 state, int max_its) {
+    vec2 z = uintBitsToFloat(state.xy);
+    int n = mandelbrot(z, center + pixel_pos() * scale, max_its);
+    state.xy = floatBitsToUint(z);
+    return n;
+}
+)";
+
+// Double-float arithmetic: a number is the unevaluated sum hi + lo of two floats, which gives 48 bits of mantissa using
+// only float instructions. precise keeps the compiler from reassociating the error terms away.
+const char* fragmentShaderDoubleFloat = R"(
+uniform vec2 center_hi;
+uniform vec2 center_lo;
+uniform vec2 scale;
+
+vec2 quick_two_sum(float a, float b) {
+    precise float s = a + b;
+    precise float e = b - (s - a);
+    return vec2(s, e);
+}
+
+vec2 two_sum(float a, float b) {
+    precise float s = a + b;
+    precise float v = s - a;
+    precise float e = (a - (s - v)) + (b - v);
+    return vec2(s, e);
+}
+
+// Splits a into two halves of 12 bits, whose products are exact in float
+vec2 split(float a) {
+    precise float t = 4097. * a;
+    precise float hi = t - (t - a);
+    precise float lo = a - hi;
+    return vec2(hi, lo);
+}
+
+// Dekker's product instead of fma(a, b, -p), which some drivers (e.g. llvmpipe) evaluate unfused
+vec2 two_prod(float a, float b) {
+    precise float p = a * b;
+    vec2 a_split = split(a);
+    vec2 b_split = split(b);
+    precise float e = ((a_split.x * b_split.x - p) + a_split.x * b_split.y + a_split.y * b_split.x) + a_split.y * b_split.y;
+    return vec2(p, e);
+}
 
+vec2 df_add(vec2 a, vec2 b) {
+    vec2 s = two_sum(a.x, b.x);
+    precise float e = s.y + a.y + b.y;
+    return quick_two_sum(s.x, e);
+}
+
+vec2 df_mul(vec2 a, vec2 b) {
+    vec2 p = two_prod(a.x, b.x);
+    precise float e = p.y + (a.x * b.y + a.y * b.x);
+    return quick_two_sum(p.x, e);
+}
+
+int mandelbrot(inout vec2 z_real, inout vec2 z_imag, vec2 c_real, vec2 c_imag, int max_its) {
+    for (int i = 0; i < max_its; i++){
+        vec2 z_real_2 = df_mul(z_real, z_real);
+        vec2 z_imag_2 = df_mul(z_imag, z_imag);
+        if (z_real_2.x + z_imag_2.x > 4.) return i;
+        // Doubling is exact, so 2 z_real z_imag needs no extra rounding
+        z_imag = df_add(2. * df_mul(z_real, z_imag), c_imag);
+        z_real = df_add(df_add(z_real_2, -z_imag_2), c_real);
+    }
+    return max_its;
+}
+
+vec4 point() {
+    vec2 c_real = df_add(vec2(center_hi.x, center_lo.x), two_prod(pixel_pos().x, scale.x));
+    vec2 c_imag = df_add(vec2(center_hi.y, center_lo.y), two_prod(pixel_pos().y, scale.y));
+    return vec4(c_real, c_imag);
+}
+
+uvec4 start_state() {
+    return floatBitsToUint(point());
+}
+
+int advance(inout uvec4 state, int max_its) {
+    vec4 c = point();
+    vec4 z = uintBitsToFloat(state);
+    int n = mandelbrot(z.xy, z.zw, c.xy, c.zw, max_its);
+    state = floatBitsToUint(z);
+    return n;
+}
+)";
+
+const char* fragmentShaderDouble = R"(
 uniform dvec2 center;
 uniform dvec2 scale;
-uniform int max_iterations;
 
-int mandelbrot(dvec2 c, int max_its) {
-    dvec2 z = c;
+int mandelbrot(inout dvec2 z, dvec2 c, int max_its) {
     for (int i = 0; i < max_its; i++){
         if (dot(z, z) > 4.) return i;
         z = dvec2(z.x * z.x - z.y * z.y, 2. * z.x * z.y) + c;
@@ -35,26 +151,203 @@ int mandelbrot(dvec2 c, int max_its) {
     return max_its;
 }
 
-void main() {
-    dvec2 mandelbrotPos = center + dvec2(pos) * scale;
-    int n = mandelbrot(mandelbrotPos, max_iterations);
+uvec4 start_state() {
+    dvec2 c = center + dvec2(pixel_pos()) * scale;
+    return uvec4(unpackDouble2x32(c.x), unpackDouble2x32(c.y));
+}
+
+int advance(inout uvec4 state, int max_its) {
+    dvec2 z = dvec2(packDouble2x32(state.xy), packDouble2x32(state.zw));
+    int n = mandelbrot(z, center + dvec2(pixel_pos()) * scale, max_its);
+    state = uvec4(unpackDouble2x32(z.x), unpackDouble2x32(z.y));
+    return n;
+}
+)";
+
+const char* fragmentShaderColor = R"(
+vec4 color(int n) {
     float a = 0.1;
-    FragColor = vec4(0.5 * sin(a * float(n)) + 0.5, 0.5 * sin(a * float(n) + 2.094) + 0.5, 0.5 * sin(a * float(n) + 4.188) + 0.5, 255);
+    return vec4(0.5 * sin(a * float(n)) + 0.5, 0.5 * sin(a * float(n) + 2.094) + 0.5, 0.5 * sin(a * float(n) + 4.188) + 0.5, 255);
+}
+)";
+
+// Runs all iterations in one pass
+const char* fragmentShaderMain = R"(
+out vec4 FragColor;
+
+void main() {
+    uvec4 state = start_state();
+    FragColor = color(advance(state, max_iterations));
+}
+)";
+
+// One step of the progressive mode: reads the state of the last frame and runs at most iteration_budget more
+// iterations on the unfinished pixels. progress is the iteration count and 1 once the pixel escaped or reached
+// max_iterations, 0 before that. After panning, the state is read shift pixels away and the exposed pixels start over.
+const char* fragmentShaderProgressive = R"(
+layout (location = 0) out uvec4 z_out;
+layout (location = 1) out ivec2 progress_out;
+
+uniform usampler2D z_state;
+uniform isampler2D progress_state;
+uniform bool reset;
+uniform ivec2 shift;
+uniform int iteration_budget;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy) - shift;
+    bool exposed = reset || any(lessThan(texel, ivec2(0))) || any(greaterThanEqual(texel, ivec2(viewport_size)));
+    uvec4 z = exposed ? start_state() : texelFetch(z_state, texel, 0);
+    ivec2 progress = exposed ? ivec2(0) : texelFetch(progress_state, texel, 0).xy;
+    if (progress.y == 0) {
+        int budget = min(iteration_budget, max_iterations - progress.x);
+        int n = advance(z, budget);
+        progress.x += n;
+        progress.y = n < budget || progress.x >= max_iterations ? 1 : 0;
+    }
+    z_out = z;
+    progress_out = progress;
+}
+)";
+
+// Only the unfinished pixels pass, for the occlusion query that ends the progressive mode
+const char* fragmentShaderUnfinished = R"(
+uniform isampler2D progress_state;
+
+void main() {
+    if (texelFetch(progress_state, ivec2(gl_FragCoord.xy), 0).y != 0)
+        discard;
+}
+)";
+
+// The last image, reprojected into the current view: preview_scale and preview_offset map the position of a pixel to its
+// position in the last view, preview_extent is the part of the texture the last image was rendered into. Where the last
+// image does not reach, or there is none, the pixel is drawn like the inside.
+const char* fragmentShaderPreview = R"(
+uniform sampler2D preview;
+uniform bool has_preview;
+uniform vec2 preview_scale;
+uniform vec2 preview_offset;
+uniform vec2 preview_extent;
+
+vec4 preview_color() {
+    vec2 uv = (pixel_pos() * preview_scale + preview_offset) * 0.5 + 0.5;
+    if (!has_preview || any(lessThan(uv, vec2(0.))) || any(greaterThan(uv, vec2(1.))))
+        return color(max_iterations);
+    return texture(preview, uv * preview_extent);
+}
+)";
+
+const char* fragmentShaderReproject = R"(
+out vec4 FragColor;
+
+void main() {
+    FragColor = preview_color();
 }
 )";
 
+// Pixels that did not escape yet keep the color of the last image until they are finished
+const char* fragmentShaderColorize = R"(
+out vec4 FragColor;
+
+uniform isampler2D progress_state;
+
+void main() {
+    ivec2 progress = texelFetch(progress_state, ivec2(gl_FragCoord.xy), 0).xy;
+    FragColor = progress.y == 1 ? color(progress.x) : preview_color();
+}
+)";
+
+enum class Precision {
+    FLOAT,
+    DOUBLE_FLOAT,
+    DOUBLE,
+    AUTO,
+};
+
+const char* precision_names[] = {"float", "double-float", "double", "auto"};
+
 GLFWwindow* window;
 GLuint vao, vbo_pos;
-GLuint shader;
+GLuint shaders[3]; // By Precision, 0 if the shader failed to compile
+GLuint progressive_shaders[3]; // By Precision, like shaders
+GLuint colorize_shader;
+GLuint unfinished_shader;
+GLuint reproject_shader;
 glm::dvec2 pos_middle = glm::dvec2(0);
 double pixel_per_mandelbrot = 0.003;
 int max_iterations = 500;
 bool redraw = true;
+glm::dvec2 pan_pixels = glm::dvec2(0); // Dragged but not applied to the view yet, in framebuffer pixels with y up
+bool zoomed = false; // Scrolled since the last frame
+
+// AUTO uses the fastest path that resolves the pixels: float at shallow zoom, then double-float or double, whichever
+// was faster in calibrate_precisions(), and double once double-float runs out of bits
+Precision precision_mode = Precision::AUTO;
+Precision active_precision = Precision::FLOAT;
+double calibration_ms[3] = {0, 0, 0};
+
+// GL_TIME_ELAPSED queries around the Mandelbrot pass. The result of a frame is read after the next frame was submitted,
+// so that waiting for it does not stall the pipeline.
+struct PassTimer {
+    GLuint query;
+    bool pending;
+    Precision precision;
+    double scale; // Render scale of the timed frame
+    double computed_fraction; // Of the pixels of the frame, less than 1 if only the strips exposed by panning were computed
+};
+PassTimer pass_timers[2];
+int current_pass_timer = 0;
+double pass_time_ms[3] = {0, 0, 0}; // Moving average per path, 0 until it was used
+double last_pass_time_ms = 0;
+
+// While the view changes, frames are rendered at render_scale times the window size and upscaled, which adapts to keep
+// the Mandelbrot pass within frame_budget_ms. Once the view did not change for settle_seconds, it is rendered at full
+// resolution.
+bool adaptive_resolution = true;
+double frame_budget_ms = 1000.0 / 60;
+double const min_render_scale = 0.25;
+double const settle_seconds = 0.3;
+double const min_timed_fraction = 0.05; // Of the pixels of a frame, for its pass time to adapt the render scale
+double render_scale = 1;
+double last_change_time = 0;
+
+// The progressive mode keeps z and the progress of every pixel in two sets of state textures. Each frame reads one set
+// and writes the other, running at most iteration_budget iterations per pixel, so a frame takes the same time at any
+// max_iterations and the image refines over the following frames. The precision is chosen when the view changes.
+bool progressive = true;
+int iteration_budget = 100;
+int progress_iterations = 0; // Iterations every pixel got since the view changed
+bool progress_finished = false; // No pixel is unfinished, known before progress_iterations reaches max_iterations
+GLuint state_fbos[2], z_textures[2], progress_textures[2];
+int state_width = 0;
+int state_height = 0;
+int current_state = 0; // The set written last
+
+// A GL_ANY_SAMPLES_PASSED query over the unfinished pixels after a step. Like the pass timers, its result is read once
+// it is available, and it only counts if no pixels started over since the step.
+GLuint unfinished_query;
+bool unfinished_query_pending = false;
+int unfinished_query_generation = 0;
+int progress_generation = 0; // Incremented whenever pixels start over
+
+// Frames are drawn into two images in turn, the last one is shown and reused for the next frame: panning shifts it and
+// only computes the exposed strips, zooming reprojects it as a preview until the pixels are computed again
+GLuint image_fbos[2], image_textures[2];
+int current_image = 0; // The image written last
+bool has_image = false; // Whether the last image is valid, i.e. not resized since
+glm::dvec2 image_center;
+double image_pixel_per_mandelbrot;
+int image_width = 0; // The part of the image textures the last image was rendered into
+int image_height = 0;
+int render_width = 0; // The part the current frame is rendered into
+int render_height = 0;
 
 int width = 1290;
 int height = 720;
 
-void init_shader() {
+// Returns 0 if compiling or linking failed
+GLuint compile_program(const char* name, std::string const& fragment_source) {
     int success;
     char info_log[1024];
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -67,27 +360,48 @@ void init_shader() {
         exit(1);
     }
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
+    const char* fragment_source_data = fragment_source.c_str();
+    glShaderSource(fragmentShader, 1, &fragment_source_data, NULL);
     glCompileShader(fragmentShader);
     glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
     if (!success) {
         glGetShaderInfoLog(fragmentShader, 1024, nullptr, info_log);
-        std::cerr << "shader compilation error: name: mandelbrot.frag\n" << info_log << std::endl;
-        exit(1);
+        std::cerr << "shader compilation error: name: mandelbrot.frag (" << name << ")\n" << info_log << std::endl;
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return 0;
     }
-    shader = glCreateProgram();
-    glAttachShader(shader, vertexShader);
-    glAttachShader(shader, fragmentShader);
-    glLinkProgram(shader);
-    glGetProgramiv(shader, GL_LINK_STATUS, &success);
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
     if (!success) {
-        glGetProgramInfoLog(shader, 1024, nullptr, info_log);
-        std::cerr << "program linking error: \n" << info_log << std::endl;
+        glGetProgramInfoLog(program, 1024, nullptr, info_log);
+        std::cerr << "program linking error (" << name << "): \n" << info_log << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+// The double shader is optional, drivers without GL_ARB_gpu_shader_fp64 fail to compile it
+void init_shader() {
+    const char* precision_sources[] = {fragmentShaderFloat, fragmentShaderDoubleFloat, fragmentShaderDouble};
+    for (int i = 0; i < 3; ++i) {
+        shaders[i] = compile_program(precision_names[i], std::string(fragmentShaderHeader) + precision_sources[i] + fragmentShaderColor + fragmentShaderMain);
+        progressive_shaders[i] = compile_program(precision_names[i], std::string(fragmentShaderHeader) + precision_sources[i] + fragmentShaderProgressive);
+        if (!progressive_shaders[i])
+            shaders[i] = 0;
+    }
+    colorize_shader = compile_program("colorize", std::string(fragmentShaderHeader) + fragmentShaderColor + fragmentShaderPreview + fragmentShaderColorize);
+    unfinished_shader = compile_program("unfinished", std::string(fragmentShaderHeader) + fragmentShaderUnfinished);
+    reproject_shader = compile_program("reproject", std::string(fragmentShaderHeader) + fragmentShaderColor + fragmentShaderPreview + fragmentShaderReproject);
+    if (!shaders[static_cast<int>(Precision::FLOAT)] || !shaders[static_cast<int>(Precision::DOUBLE_FLOAT)] || !colorize_shader || !unfinished_shader || !reproject_shader) {
         exit(1);
     }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    glUseProgram(shader);
 }
 
 void init_quad() {
@@ -114,11 +428,410 @@ void render_quad() {
     glBindVertexArray(0);
 }
 
-void update_mandelbrot() {
-    glUniform2d(glGetUniformLocation(shader, "center"), pos_middle.x, pos_middle.y);
-    glUniform2d(glGetUniformLocation(shader, "scale"), pixel_per_mandelbrot * (width / 2), pixel_per_mandelbrot * (height / 2));
-    glUniform1i(glGetUniformLocation(shader, "max_iterations"), max_iterations);
+// Integer textures are only complete with nearest filtering
+GLuint create_render_texture(GLenum internal_format) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    return texture;
+}
+
+void check_framebuffer(const char* name) {
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << name << " framebuffer is incomplete" << std::endl;
+        exit(1);
+    }
+}
+
+// Recreates the state textures and images at the window size, returns true if they were recreated and hold nothing
+bool resize_render_targets() {
+    if (state_width == width && state_height == height)
+        return false;
+    if (state_width != 0) {
+        glDeleteFramebuffers(2, state_fbos);
+        glDeleteTextures(2, z_textures);
+        glDeleteTextures(2, progress_textures);
+        glDeleteFramebuffers(2, image_fbos);
+        glDeleteTextures(2, image_textures);
+    }
+    glGenFramebuffers(2, state_fbos);
+    glGenFramebuffers(2, image_fbos);
+    for (int i = 0; i < 2; ++i) {
+        z_textures[i] = create_render_texture(GL_RGBA32UI);
+        progress_textures[i] = create_render_texture(GL_RG32I);
+        glBindFramebuffer(GL_FRAMEBUFFER, state_fbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, z_textures[i], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, progress_textures[i], 0);
+        GLenum const attachments[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, attachments);
+        check_framebuffer("state");
+
+        image_textures[i] = create_render_texture(GL_RGBA8);
+        glBindFramebuffer(GL_FRAMEBUFFER, image_fbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image_textures[i], 0);
+        check_framebuffer("image");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    state_width = width;
+    state_height = height;
+    has_image = false;
+    return true;
+}
+
+// Half the extent of the view, so that a pixel is pixel_per_mandelbrot wide and panning by whole pixels keeps them aligned
+glm::dvec2 view_scale() {
+    return glm::dvec2(width, height) * (pixel_per_mandelbrot / 2);
+}
+
+void init_pass_timers() {
+    for (auto& timer : pass_timers) {
+        glGenQueries(1, &timer.query);
+        timer.pending = false;
+    }
+}
+
+void begin_pass_timer() {
+    glBeginQuery(GL_TIME_ELAPSED, pass_timers[current_pass_timer].query);
+}
+
+void end_pass_timer(double computed_fraction) {
+    glEndQuery(GL_TIME_ELAPSED);
+    PassTimer& timer = pass_timers[current_pass_timer];
+    timer.pending = true;
+    timer.precision = active_precision;
+    timer.scale = static_cast<double>(render_width) / width;
+    timer.computed_fraction = computed_fraction;
+}
+
+// Smallest pixel size relative to the magnitude of the coordinates that a path still resolves. Each path keeps a few
+// bits of its mantissa (24, 48 and 53 bits) as headroom for the rounding errors that accumulate over the iterations.
+double precision_limit(Precision precision) {
+    switch (precision) {
+    case Precision::FLOAT:
+        return std::ldexp(1.0, -20);
+    case Precision::DOUBLE_FLOAT:
+        return std::ldexp(1.0, -44);
+    default:
+        return std::ldexp(1.0, -49);
+    }
+}
+
+Precision select_precision() {
+    bool const has_double = shaders[static_cast<int>(Precision::DOUBLE)] != 0;
+    if (precision_mode != Precision::AUTO) {
+        return precision_mode == Precision::DOUBLE && !has_double ? Precision::DOUBLE_FLOAT : precision_mode;
+    }
+
+    double const magnitude = std::max({std::abs(pos_middle.x) + pixel_per_mandelbrot * width / 2, std::abs(pos_middle.y) + pixel_per_mandelbrot * height / 2, 2.0});
+    double const relative_pixel_size = pixel_per_mandelbrot / magnitude;
+    if (relative_pixel_size >= precision_limit(Precision::FLOAT)) {
+        return Precision::FLOAT;
+    }
+
+    // fp64 is often emulated or runs at a fraction of the float rate, then double-float is faster
+    bool const double_is_slow = !has_double || calibration_ms[static_cast<int>(Precision::DOUBLE)] > calibration_ms[static_cast<int>(Precision::DOUBLE_FLOAT)];
+    if (relative_pixel_size >= precision_limit(Precision::DOUBLE_FLOAT) && double_is_slow) {
+        return Precision::DOUBLE_FLOAT;
+    }
+    return has_double ? Precision::DOUBLE : Precision::DOUBLE_FLOAT;
+}
+
+void set_uniforms(GLuint shader, Precision precision, glm::dvec2 center, glm::dvec2 scale, int iterations) {
+    glUseProgram(shader);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glUniform2f(glGetUniformLocation(shader, "viewport_size"), viewport[2], viewport[3]);
+    switch (precision) {
+    case Precision::FLOAT:
+        glUniform2f(glGetUniformLocation(shader, "center"), center.x, center.y);
+        glUniform2f(glGetUniformLocation(shader, "scale"), scale.x, scale.y);
+        break;
+    case Precision::DOUBLE_FLOAT: {
+        // The low part is the rounding error of the high part
+        glm::vec2 const center_hi = glm::vec2(center);
+        glm::vec2 const center_lo = glm::vec2(center - glm::dvec2(center_hi));
+        glUniform2f(glGetUniformLocation(shader, "center_hi"), center_hi.x, center_hi.y);
+        glUniform2f(glGetUniformLocation(shader, "center_lo"), center_lo.x, center_lo.y);
+        glUniform2f(glGetUniformLocation(shader, "scale"), scale.x, scale.y);
+        break;
+    }
+    default:
+        glUniform2d(glGetUniformLocation(shader, "center"), center.x, center.y);
+        glUniform2d(glGetUniformLocation(shader, "scale"), scale.x, scale.y);
+        break;
+    }
+    glUniform1i(glGetUniformLocation(shader, "max_iterations"), iterations);
+}
+
+// Times every path on a view inside the set, where every pixel runs all iterations
+void calibrate_precisions() {
+    int const calibration_size = 256;
+    glViewport(0, 0, calibration_size, calibration_size);
+    for (int i = 0; i < 3; ++i) {
+        if (!shaders[i])
+            continue;
+        set_uniforms(shaders[i], static_cast<Precision>(i), glm::dvec2(-0.1, 0.1), glm::dvec2(0.01), 1000);
+        render_quad(); // Warm up, drivers may compile the shader on first use
+        glFinish();
+        auto const start = std::chrono::steady_clock::now();
+        render_quad();
+        glFinish();
+        calibration_ms[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    glViewport(0, 0, width, height);
+}
+
+// Binds the last image as the preview of shader, reprojected from its view into the current one. Zooming samples it
+// linearly, panning by whole pixels copies it.
+void set_preview_uniforms(GLuint shader) {
+    glm::dvec2 const image_scale = glm::dvec2(width, height) * (image_pixel_per_mandelbrot / 2);
+    glm::vec2 const preview_scale = glm::vec2(view_scale() / image_scale);
+    glm::vec2 const preview_offset = glm::vec2((pos_middle - image_center) / image_scale);
+    glUniform1i(glGetUniformLocation(shader, "has_preview"), has_image);
+    glUniform2f(glGetUniformLocation(shader, "preview_scale"), preview_scale.x, preview_scale.y);
+    glUniform2f(glGetUniformLocation(shader, "preview_offset"), preview_offset.x, preview_offset.y);
+    glUniform2f(glGetUniformLocation(shader, "preview_extent"), static_cast<float>(image_width) / width, static_cast<float>(image_height) / height);
+    glUniform1i(glGetUniformLocation(shader, "preview"), 2);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, image_textures[current_image]);
+    GLint const filter = pixel_per_mandelbrot == image_pixel_per_mandelbrot && image_width == render_width ? GL_NEAREST : GL_LINEAR;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Advances the state by one iteration budget and colorizes it into image_fbos[target_image]. reset starts over from
+// z = c, shift moves the state by that many pixels and starts over only on the exposed pixels.
+void render_progressive(bool reset, glm::ivec2 shift, int target_image) {
+    // The state of one precision cannot be continued by another
+    if (!reset && select_precision() != active_precision)
+        reset = true;
+    if (reset) {
+        active_precision = select_precision();
+    }
+    if (reset || shift != glm::ivec2(0)) {
+        progress_iterations = 0; // After panning, the exposed pixels start over
+        progress_finished = false;
+        ++progress_generation;
+    }
+
+    GLuint shader = progressive_shaders[static_cast<int>(active_precision)];
+    set_uniforms(shader, active_precision, pos_middle, view_scale(), max_iterations);
+    glUniform1i(glGetUniformLocation(shader, "reset"), reset);
+    glUniform2i(glGetUniformLocation(shader, "shift"), shift.x, shift.y);
+    glUniform1i(glGetUniformLocation(shader, "iteration_budget"), iteration_budget);
+    glUniform1i(glGetUniformLocation(shader, "z_state"), 0);
+    glUniform1i(glGetUniformLocation(shader, "progress_state"), 1);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, z_textures[current_state]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, progress_textures[current_state]);
+
+    current_state = 1 - current_state;
+    glBindFramebuffer(GL_FRAMEBUFFER, state_fbos[current_state]);
+    begin_pass_timer();
+    render_quad();
+    end_pass_timer(1);
+    progress_iterations += iteration_budget;
+
+    glUseProgram(colorize_shader);
+    glUniform1i(glGetUniformLocation(colorize_shader, "max_iterations"), max_iterations);
+    glUniform2f(glGetUniformLocation(colorize_shader, "viewport_size"), render_width, render_height);
+    glUniform1i(glGetUniformLocation(colorize_shader, "progress_state"), 1);
+    set_preview_uniforms(colorize_shader);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, progress_textures[current_state]);
+    glBindFramebuffer(GL_FRAMEBUFFER, image_fbos[target_image]);
     render_quad();
+
+    // Writes nothing, the image is only bound because the progress texture must not be
+    if (!unfinished_query_pending) {
+        glUseProgram(unfinished_shader);
+        glUniform1i(glGetUniformLocation(unfinished_shader, "progress_state"), 1);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, unfinished_query);
+        render_quad();
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        unfinished_query_pending = true;
+        unfinished_query_generation = progress_generation;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Whether the progressive mode still has unfinished pixels to iterate
+bool is_refining() {
+    return progressive && !progress_finished && progress_iterations < max_iterations;
+}
+
+// Renders all iterations into image_fbos[target_image]. After panning, the last image is shifted and only the exposed
+// strips are computed. After zooming, the reprojected last image is shown first and computed in the next frame, so
+// scrolling does not wait for the full computation of every step.
+void render_single(bool reset, glm::ivec2 shift, int target_image) {
+    glBindFramebuffer(GL_FRAMEBUFFER, image_fbos[target_image]);
+    if (has_image && (zoomed || (!reset && shift != glm::ivec2(0)))) {
+        glUseProgram(reproject_shader);
+        glUniform1i(glGetUniformLocation(reproject_shader, "max_iterations"), max_iterations);
+        glUniform2f(glGetUniformLocation(reproject_shader, "viewport_size"), render_width, render_height);
+        set_preview_uniforms(reproject_shader);
+        render_quad();
+        if (zoomed) {
+            redraw = true;
+            return;
+        }
+    }
+
+    active_precision = select_precision();
+    set_uniforms(shaders[static_cast<int>(active_precision)], active_precision, pos_middle, view_scale(), max_iterations);
+    begin_pass_timer();
+    if (reset || !has_image) {
+        render_quad();
+        end_pass_timer(1);
+    } else {
+        // The columns and rows that were outside of the last image, the corner they share is computed twice
+        glEnable(GL_SCISSOR_TEST);
+        if (shift.x != 0) {
+            glScissor(shift.x > 0 ? 0 : render_width + shift.x, 0, std::abs(shift.x), render_height);
+            render_quad();
+        }
+        if (shift.y != 0) {
+            glScissor(0, shift.y > 0 ? 0 : render_height + shift.y, render_width, std::abs(shift.y));
+            render_quad();
+        }
+        glDisable(GL_SCISSOR_TEST);
+        double const strip_pixels = std::abs(shift.x) * render_height + std::abs(shift.y) * render_width;
+        end_pass_timer(std::min(strip_pixels / (render_width * render_height), 1.0));
+    }
+}
+
+void update_title() {
+    char title[160];
+    int length = std::snprintf(title, sizeof(title), "Mandelbrot - %s", precision_names[static_cast<int>(active_precision)]);
+    if (last_pass_time_ms > 0)
+        length += std::snprintf(title + length, sizeof(title) - length, " - %.1f ms GPU", last_pass_time_ms);
+    if (image_width != width)
+        length += std::snprintf(title + length, sizeof(title) - length, " - %d%% resolution", static_cast<int>(std::lround(100.0 * image_width / width)));
+    if (is_refining())
+        std::snprintf(title + length, sizeof(title) - length, " - %d/%d iterations", progress_iterations, max_iterations);
+    glfwSetWindowTitle(window, title);
+}
+
+// The pass time grows with the number of pixels, the square of the scale. Passes over the strips exposed by panning are
+// extrapolated to the whole frame, which a reset needs, unless they are so thin that the fixed cost of a pass dominates
+// their time. The scale aims a bit below the budget and only changes by more than 10%, so that the resolution does not
+// flicker between frames.
+void adapt_render_scale(PassTimer const& timer, double elapsed_ms) {
+    if (!adaptive_resolution) {
+        render_scale = 1;
+        return;
+    }
+    if (timer.computed_fraction < min_timed_fraction)
+        return;
+    double const frame_ms = std::max(elapsed_ms / std::max(timer.computed_fraction, 1e-3), 0.01);
+    double const target = std::clamp(timer.scale * std::sqrt(0.8 * frame_budget_ms / frame_ms), min_render_scale, 1.0);
+    if (std::abs(target - render_scale) > 0.1 * render_scale)
+        render_scale = target;
+}
+
+// Reads the result of a pending pass timer, wait blocks until it is available
+void read_pass_timer(PassTimer& timer, bool wait) {
+    if (!timer.pending)
+        return;
+    if (!wait) {
+        GLint available;
+        glGetQueryObjectiv(timer.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+    }
+    GLuint64 elapsed_ns;
+    glGetQueryObjectui64v(timer.query, GL_QUERY_RESULT, &elapsed_ns);
+    timer.pending = false;
+
+    last_pass_time_ms = elapsed_ns / 1e6;
+    double& average = pass_time_ms[static_cast<int>(timer.precision)];
+    average = average == 0 ? last_pass_time_ms : 0.9 * average + 0.1 * last_pass_time_ms;
+    adapt_render_scale(timer, last_pass_time_ms);
+    update_title();
+}
+
+// Ends the progressive mode once no pixel is unfinished, without waiting for the query
+void read_unfinished_query() {
+    if (!unfinished_query_pending)
+        return;
+    GLint available;
+    glGetQueryObjectiv(unfinished_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+    GLint any_unfinished;
+    glGetQueryObjectiv(unfinished_query, GL_QUERY_RESULT, &any_unfinished);
+    unfinished_query_pending = false;
+    if (!any_unfinished && unfinished_query_generation == progress_generation) {
+        progress_finished = true;
+        update_title();
+    }
+}
+
+// The resolution of a frame rendered at scale times the window size
+glm::ivec2 render_size(double scale) {
+    return glm::ivec2(std::clamp(static_cast<int>(std::lround(width * scale)), 1, width),
+        std::clamp(static_cast<int>(std::lround(height * scale)), 1, height));
+}
+
+// The whole pixels of a frame of the given size that pan_pixels covers, rounded towards zero. The tolerance keeps the
+// rounding errors of the fractions carried in pan_pixels from losing a pixel.
+glm::ivec2 pan_shift(glm::ivec2 size) {
+    glm::dvec2 const pixels = pan_pixels * glm::dvec2(size) / glm::dvec2(width, height);
+    return glm::ivec2(pixels + glm::sign(pixels) * 1e-6);
+}
+
+// reset is set when anything but the position changed since the last call. scale is the resolution relative to the
+// window.
+void update_mandelbrot(bool reset, double scale) {
+    if (resize_render_targets())
+        reset = true;
+    glm::ivec2 const size = render_size(scale);
+    render_width = size.x;
+    render_height = size.y;
+    // The state and the last image are laid out for another resolution
+    if (render_width != image_width || render_height != image_height)
+        reset = true;
+
+    // The view moves by whole render pixels, which keeps the last image aligned to it, the rest of the pan is kept for
+    // the next frame. A reset has nothing to align to and takes all of it.
+    glm::ivec2 const shift = reset ? glm::ivec2(0) : pan_shift(size);
+    glm::dvec2 const moved = reset ? pan_pixels : glm::dvec2(shift) * glm::dvec2(width, height) / glm::dvec2(size);
+    pos_middle -= moved * pixel_per_mandelbrot;
+    pan_pixels -= moved;
+    glViewport(0, 0, render_width, render_height);
+
+    // The timer is reused every other frame, its result has to be read by then
+    current_pass_timer = 1 - current_pass_timer;
+    read_pass_timer(pass_timers[current_pass_timer], true);
+
+    int const target_image = 1 - current_image;
+    if (progressive)
+        render_progressive(reset, shift, target_image);
+    else
+        render_single(reset, shift, target_image);
+    current_image = target_image;
+    has_image = true;
+    image_center = pos_middle;
+    image_pixel_per_mandelbrot = pixel_per_mandelbrot;
+    image_width = render_width;
+    image_height = render_height;
+    zoomed = false;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, image_fbos[current_image]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, image_width, image_height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, image_width == width ? GL_NEAREST : GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+    update_title();
 }
 
 void print_usage() {
@@ -134,8 +847,28 @@ void print_usage() {
     std::cout << "Zoom: mouse scroll\n";
     std::cout << "Move: drag while holding the left mouse button\n";
     std::cout << "change max iterations: Arrow up and down\n";
+    std::cout << "cycle precision: P\n";
+    std::cout << "toggle progressive mode: M\n";
+    std::cout << "change iterations per frame: Arrow left and right\n";
+    std::cout << "toggle adaptive resolution: R\n";
     std::cout << '\n';
     std::cout << "max iterations: " << max_iterations << '\n';
+    std::cout << "progressive mode: " << (progressive ? "on" : "off") << ", " << iteration_budget << " iterations per frame\n";
+    std::cout << "adaptive resolution: " << (adaptive_resolution ? "on" : "off") << ", " << std::lround(100 * render_scale) << "% while the view changes, frame budget " << frame_budget_ms << " ms\n";
+    std::cout << "precision: " << precision_names[static_cast<int>(precision_mode)] << " (using " << precision_names[static_cast<int>(select_precision())] << ")\n";
+    std::cout << "calibration:";
+    for (int i = 0; i < 3; ++i) {
+        if (shaders[i])
+            std::cout << ' ' << precision_names[i] << ' ' << calibration_ms[i] << " ms";
+        else
+            std::cout << ' ' << precision_names[i] << " unavailable";
+    }
+    std::cout << "\nGPU pass times:";
+    for (int i = 0; i < 3; ++i) {
+        if (pass_time_ms[i] > 0)
+            std::cout << ' ' << precision_names[i] << ' ' << pass_time_ms[i] << " ms";
+    }
+    std::cout << '\n';
 }
 
 void framebuffer_size_callback(GLFWwindow*, int w, int h) {
@@ -150,6 +883,7 @@ void scroll_callback(GLFWwindow*, double xoffset, double yoffset) {
         pixel_per_mandelbrot /= 1.5;
     else
         pixel_per_mandelbrot *= 1.5;
+    zoomed = true;
     redraw = true;
 }
 
@@ -160,6 +894,18 @@ void key_callback(GLFWwindow*, int key, int, int action, int mods) {
         max_iterations += 10;
     if (key == GLFW_KEY_PAGE_DOWN || key == GLFW_KEY_DOWN)
         max_iterations -= 10;
+    if (key == GLFW_KEY_P)
+        precision_mode = static_cast<Precision>((static_cast<int>(precision_mode) + 1) % 4);
+    if (key == GLFW_KEY_M)
+        progressive = !progressive;
+    if (key == GLFW_KEY_RIGHT)
+        iteration_budget *= 2;
+    if (key == GLFW_KEY_LEFT)
+        iteration_budget = std::max(iteration_budget / 2, 1);
+    if (key == GLFW_KEY_R) {
+        adaptive_resolution = !adaptive_resolution;
+        render_scale = 1;
+    }
     print_usage();
     redraw = true;
 }
@@ -170,7 +916,25 @@ glm::dvec2 cursor_pos() {
     return glm::dvec2(x, y);
 }
 
-int main() {
+int main(int argc, char** argv) {
+    // --precision forces a path, e.g. to test double-float on a driver where auto picks double
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::string(argv[i]) == "--frame-budget") {
+            char* end = nullptr;
+            frame_budget_ms = std::strtod(argv[i + 1], &end);
+            if (end == argv[i + 1] || *end != '\0' || !std::isfinite(frame_budget_ms) || frame_budget_ms <= 0) {
+                std::cerr << "--frame-budget must be a positive number of milliseconds" << std::endl;
+                return 1;
+            }
+        }
+        if (std::string(argv[i]) != "--precision")
+            continue;
+        for (int mode = 0; mode < 4; ++mode) {
+            if (std::string(argv[i + 1]) == precision_names[mode])
+                precision_mode = static_cast<Precision>(mode);
+        }
+    }
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
@@ -199,26 +963,44 @@ int main() {
 
     init_shader();
     init_quad();
+    init_pass_timers();
+    glGenQueries(1, &unfinished_query);
+    calibrate_precisions();
     print_usage();
 
     glm::dvec2 last_cursor_pos = cursor_pos();
-    glm::dvec2 cursor_pos_offset = glm::dvec2(0);
 
     // Mainloop
     while (!glfwWindowShouldClose(window)) {
-        cursor_pos_offset = cursor_pos() - last_cursor_pos;
-        last_cursor_pos = cursor_pos();
-        if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
-            pos_middle.x -= cursor_pos_offset.x * pixel_per_mandelbrot;
-            pos_middle.y += cursor_pos_offset.y * pixel_per_mandelbrot;
-            redraw = true;
+        // A minimized window has an empty framebuffer, which no render target can be created for
+        if (width == 0 || height == 0) {
+            glfwWaitEvents();
+            continue;
         }
 
-        if (redraw) {
+        glm::dvec2 const cursor_pos_offset = cursor_pos() - last_cursor_pos;
+        last_cursor_pos += cursor_pos_offset;
+        bool const dragged = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS && cursor_pos_offset != glm::dvec2(0);
+        if (dragged)
+            pan_pixels += glm::dvec2(cursor_pos_offset.x, -cursor_pos_offset.y);
+
+        // Panning is drawn once it covers a whole render pixel. The progressive mode keeps drawing until every pixel ran
+        // max_iterations or escaped, and a view rendered at a reduced resolution is drawn again at full resolution once
+        // it settled.
+        if (redraw || dragged)
+            last_change_time = glfwGetTime();
+        bool const settled = !redraw && !dragged && glfwGetTime() - last_change_time > settle_seconds;
+        double const scale = settled ? 1.0 : render_scale;
+        bool const panned = pan_shift(render_size(scale)) != glm::ivec2(0);
+        if (redraw || panned || is_refining() || (settled && image_width != width)) {
+            bool const reset = redraw;
             redraw = false;
-            update_mandelbrot();
+            update_mandelbrot(reset, scale);
             glfwSwapBuffers(window);
         }
+        for (auto& timer : pass_timers)
+            read_pass_timer(timer, false);
+        read_unfinished_query();
         glfwPollEvents();
     }
 
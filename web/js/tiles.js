@@ -0,0 +1,299 @@
+// Tile viewer for the C++ tile server, started with "Mandelbrot --serve <port>".
+// Tile (z, x, y) covers [x, x + 1] * 4 / 2^z on the real axis and [y, y + 1] * 4 / 2^z on the imaginary axis,
+// see serve_tile() in cpp-cpu/src/main.cpp.
+
+var server = "http://127.0.0.1:8080";
+var tileSize = 256;
+var maxZoom = 48;
+var center = [-0.5, 0];
+var zoom = 1;
+var parameters = "";
+var tiles = new Map(); // "z/x/y" -> {image, controller, failed}, in insertion order for eviction
+var maxCachedTiles = 1024;
+var maxFallbackLevels = 6;
+var drawScheduled = false;
+var dragPosition = null;
+var formulaNames = ["Mandelbrot", "z^3 + c", "z^4 + c", "Julia", "Burning Ship"];
+
+function load() {
+    var canvas = document.getElementById("canvasTiles");
+    var divControls = document.getElementById("divControls");
+    var nav = document.getElementsByTagName("nav")[0];
+
+    function resize() {
+        canvas.width = document.documentElement.clientWidth;
+        canvas.height = document.documentElement.clientHeight - (divControls.offsetHeight + nav.clientHeight + 10);
+        canvas.style.top = nav.clientHeight + "px";
+        divControls.style.top = (nav.clientHeight + canvas.height + 5) + "px";
+        scheduleDraw();
+    }
+    window.addEventListener("resize", resize);
+    resize();
+
+    canvas.addEventListener("mousedown", function (event) {
+        dragPosition = [event.clientX, event.clientY];
+    });
+    window.addEventListener("mouseup", function () {
+        dragPosition = null;
+    });
+    window.addEventListener("mousemove", function (event) {
+        if (dragPosition === null) {
+            return;
+        }
+        center[0] -= (event.clientX - dragPosition[0]) * pixelSize(zoom);
+        center[1] -= (event.clientY - dragPosition[1]) * pixelSize(zoom);
+        dragPosition = [event.clientX, event.clientY];
+        scheduleDraw();
+    });
+
+    // Zooms by whole tile levels and keeps the point under the cursor in place
+    canvas.addEventListener("wheel", function (event) {
+        event.preventDefault();
+        var newZoom = Math.min(Math.max(zoom + (event.deltaY < 0 ? 1 : -1), 0), maxZoom);
+        var rect = canvas.getBoundingClientRect();
+        var offsetX = event.clientX - rect.left - canvas.width / 2;
+        var offsetY = event.clientY - rect.top - canvas.height / 2;
+        var pointX = center[0] + offsetX * pixelSize(zoom);
+        var pointY = center[1] + offsetY * pixelSize(zoom);
+        zoom = newZoom;
+        center[0] = pointX - offsetX * pixelSize(zoom);
+        center[1] = pointY - offsetY * pixelSize(zoom);
+        scheduleDraw();
+    }, {passive: false});
+
+    reconnect();
+}
+
+function reconnect() {
+    server = document.getElementById("textFieldServer").value.replace(/\/+$/, "");
+    document.getElementById("labelProgress").innerHTML = "Connecting...";
+
+    fetch(server + "/info").then(function (response) {
+        return response.json();
+    }).then(function (info) {
+        tileSize = info.tile_size;
+        fillSelect(document.getElementById("selectFormula"), info.formulas, function (i) {
+            return i < formulaNames.length ? formulaNames[i] : "Formula " + i;
+        });
+        fillSelect(document.getElementById("selectColor"), info.color_functions, function (i) {
+            return (i + 1).toString();
+        });
+        parametersChanged();
+    }).catch(function () {
+        document.getElementById("labelProgress").innerHTML = "Server not reachable, start it with: Mandelbrot --serve 8080";
+    });
+}
+
+function fillSelect(select, count, name) {
+    var selected = select.value;
+    select.innerHTML = "";
+    for (var i = 0; i < count; i++) {
+        var option = document.createElement("option");
+        option.value = i.toString();
+        option.text = name(i);
+        select.add(option);
+    }
+    if (selected !== "" && parseInt(selected) < count) {
+        select.value = selected;
+    }
+}
+
+function parametersChanged() {
+    parameters = "?formula=" + document.getElementById("selectFormula").value
+        + "&color=" + document.getElementById("selectColor").value
+        + "&iterations=" + Math.max(parseInt(document.getElementById("textFieldIterations").value) || 0, 0); // 0 is automatic
+
+    tiles.forEach(function (tile) {
+        if (tile.controller) {
+            tile.controller.abort();
+        }
+    });
+    tiles.clear();
+    scheduleDraw();
+}
+
+function tileComplexSize(z) {
+    return 4 / Math.pow(2, z);
+}
+
+function pixelSize(z) {
+    return tileComplexSize(z) / tileSize;
+}
+
+function scheduleDraw() {
+    if (!drawScheduled) {
+        drawScheduled = true;
+        window.requestAnimationFrame(function () {
+            drawScheduled = false;
+            draw();
+        });
+    }
+}
+
+function draw() {
+    var canvas = document.getElementById("canvasTiles");
+    var ctx = canvas.getContext("2d");
+    ctx.imageSmoothingEnabled = false;
+    ctx.fillStyle = "#000000";
+    ctx.fillRect(0, 0, canvas.width, canvas.height);
+
+    var size = tileComplexSize(zoom);
+    var left = center[0] - canvas.width / 2 * pixelSize(zoom);
+    var top = center[1] - canvas.height / 2 * pixelSize(zoom);
+    var firstX = Math.floor(left / size);
+    var firstY = Math.floor(top / size);
+    var lastX = Math.floor((left + canvas.width * pixelSize(zoom)) / size);
+    var lastY = Math.floor((top + canvas.height * pixelSize(zoom)) / size);
+
+    var visible = new Set();
+    var loading = 0;
+    for (var x = firstX; x <= lastX; x++) {
+        for (var y = firstY; y <= lastY; y++) {
+            var key = zoom + "/" + x + "/" + y;
+            var screenX = Math.round((x * size - left) / pixelSize(zoom));
+            var screenY = Math.round((y * size - top) / pixelSize(zoom));
+            visible.add(key);
+
+            var tile = tiles.get(key);
+            if (tile && tile.image) {
+                ctx.drawImage(tile.image, screenX, screenY);
+                continue;
+            }
+
+            drawFallback(ctx, zoom, x, y, screenX, screenY);
+            if (!tile) {
+                requestTile(zoom, x, y, key);
+            }
+            if (!tile || !tile.failed) {
+                loading++;
+            }
+        }
+    }
+
+    // Tiles that scrolled out of view before they arrived are not needed anymore, the server still caches them
+    tiles.forEach(function (tile, key) {
+        if (!tile.image && !visible.has(key)) {
+            if (tile.controller) {
+                tile.controller.abort();
+            }
+            tiles.delete(key);
+        }
+    });
+
+    var excess = tiles.size - maxCachedTiles;
+    tiles.forEach(function (tile, key) {
+        if (excess > 0 && !visible.has(key)) {
+            tiles.delete(key);
+            excess--;
+        }
+    });
+
+    document.getElementById("labelProgress").innerHTML = (loading > 0 ? "Loading " + loading + " tiles" : "Done")
+        + ", zoom " + zoom + ", center " + center[0].toPrecision(17) + " " + center[1].toPrecision(17);
+}
+
+// Draws the part of the closest loaded coarser tile, so zooming in never shows an empty tile
+function drawFallback(ctx, z, x, y, screenX, screenY) {
+    for (var level = 1; level <= maxFallbackLevels && level <= z; level++) {
+        var factor = Math.pow(2, level);
+        var parentX = Math.floor(x / factor);
+        var parentY = Math.floor(y / factor);
+        var parent = tiles.get((z - level) + "/" + parentX + "/" + parentY);
+        if (parent && parent.image) {
+            var sourceSize = tileSize / factor;
+            ctx.drawImage(parent.image, (x - parentX * factor) * sourceSize, (y - parentY * factor) * sourceSize, sourceSize, sourceSize,
+                screenX, screenY, tileSize, tileSize);
+            return;
+        }
+    }
+}
+
+function requestTile(z, x, y, key) {
+    var tile = {image: null, controller: new AbortController(), failed: false};
+    tiles.set(key, tile);
+
+    fetch(server + "/tiles/" + z + "/" + x + "/" + y + ".qoi" + parameters, {signal: tile.controller.signal}).then(function (response) {
+        if (!response.ok) {
+            throw new Error(response.statusText);
+        }
+        return response.arrayBuffer();
+    }).then(function (buffer) {
+        return createImageBitmap(decodeQoi(buffer));
+    }).then(function (image) {
+        tile.image = image;
+        tile.controller = null;
+        if (tiles.get(key) === tile) {
+            scheduleDraw();
+        }
+    }).catch(function () {
+        // Failed tiles are not requested again until the parameters change
+        tile.failed = true;
+        tile.controller = null;
+    });
+}
+
+// https://qoiformat.org/qoi-specification.pdf
+function decodeQoi(buffer) {
+    var bytes = new Uint8Array(buffer);
+    var header = new DataView(buffer);
+    if (bytes.length < 14 || header.getUint32(0) !== 0x716f6966) {
+        throw new Error("Not a QOI image");
+    }
+
+    var width = header.getUint32(4);
+    var height = header.getUint32(8);
+    var pixels = new Uint8ClampedArray(width * height * 4);
+    var index = new Uint8Array(64 * 4);
+    var r = 0, g = 0, b = 0, a = 255;
+    var run = 0;
+    var position = 14;
+
+    for (var i = 0; i < pixels.length; i += 4) {
+        if (run > 0) {
+            run--;
+        } else {
+            var op = bytes[position++];
+            if (op === 0xfe) {
+                r = bytes[position++];
+                g = bytes[position++];
+                b = bytes[position++];
+            } else if (op === 0xff) {
+                r = bytes[position++];
+                g = bytes[position++];
+                b = bytes[position++];
+                a = bytes[position++];
+            } else if ((op & 0xc0) === 0x00) {
+                var indexPosition = (op & 0x3f) * 4;
+                r = index[indexPosition];
+                g = index[indexPosition + 1];
+                b = index[indexPosition + 2];
+                a = index[indexPosition + 3];
+            } else if ((op & 0xc0) === 0x40) {
+                r = (r + ((op >> 4) & 0x03) - 2) & 0xff;
+                g = (g + ((op >> 2) & 0x03) - 2) & 0xff;
+                b = (b + (op & 0x03) - 2) & 0xff;
+            } else if ((op & 0xc0) === 0x80) {
+                var next = bytes[position++];
+                var greenDifference = (op & 0x3f) - 32;
+                r = (r + greenDifference - 8 + ((next >> 4) & 0x0f)) & 0xff;
+                g = (g + greenDifference) & 0xff;
+                b = (b + greenDifference - 8 + (next & 0x0f)) & 0xff;
+            } else {
+                run = op & 0x3f;
+            }
+
+            var hash = ((r * 3 + g * 5 + b * 7 + a * 11) % 64) * 4;
+            index[hash] = r;
+            index[hash + 1] = g;
+            index[hash + 2] = b;
+            index[hash + 3] = a;
+        }
+
+        pixels[i] = r;
+        pixels[i + 1] = g;
+        pixels[i + 2] = b;
+        pixels[i + 3] = a;
+    }
+
+    return new ImageData(pixels, width, height);
+}